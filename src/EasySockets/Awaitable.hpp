@@ -0,0 +1,288 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+#ifndef _EASYSOCKETS_AWAITABLE_HPP_
+#define _EASYSOCKETS_AWAITABLE_HPP_
+
+#include "Capture.hpp"
+#include "Connection.hpp"
+#include "Error.hpp"
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+namespace es {
+
+/**
+ * Coroutine type returned by every co_await-able operation. Frames are
+ * allocated through asio's per-thread recycling allocator, so a steady
+ * request/response loop reuses the same few frames.
+ * */
+template <class T>
+using Awaitable = boost::asio::awaitable<T>;
+
+/**
+ * A connection driven from a C++20 coroutine rather than through the
+ * server's event queue. Reads and sends complete straight into the
+ * awaiting coroutine; no READ_*, SEND_* or ACCEPT_* events are queued
+ * for them. Closing still queues CLOSE_HANDLE/ERROR_HANDLE unless events
+ * are disabled on the server.
+ * 
+ * Instances are cheap to copy and keep the underlying connection alive.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <class ServerTy>
+class AwaitableConnection {
+public:
+  typedef typename ServerTy::ConnectionTy ConnectionTy;
+  typedef typename ServerTy::ConnectionP ConnectionP;
+  typedef typename ServerTy::Transfer Transfer;
+protected:
+  ServerTy* _server;
+  ConnectionP _connection;
+public:
+  /**
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  AwaitableConnection()
+    : _server(nullptr)
+  {}
+
+  /**
+   * 
+   * @param server The server owning the connection.
+   * @param connection The socket connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  AwaitableConnection(
+    ServerTy& server,
+    ConnectionP connection)
+    : _server(&server),
+      _connection(std::move(connection))
+  {}
+
+  explicit operator bool () const {
+    return _connection && _connection->is_open();
+  }
+
+  ConnectionTy* operator -> () const {
+    return _connection.get();
+  }
+
+  ConnectionHandle handle() const {
+    return _connection ? _connection->handle : es::NULL_HANDLE;
+  }
+
+  /**
+   * Receives the next frame, as defined by the server's read mode. Yields
+   * a null buffer once the remote end has closed the connection; any
+   * other failure closes the connection and is thrown as a
+   * boost::system::system_error.
+   * On a server that supports compression, the connection negotiates it
+   * like any other, and frames are yielded decompressed.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  Awaitable<StreamBufferP> read_frame()
+  {
+    ServerTy& server = *_server;
+    ConnectionP connection = _connection;
+    boost::system::error_code error;
+    std::size_t nbytes_received;
+
+    if (!connection->is_open()) {
+      co_return StreamBufferP();
+    }
+
+    if (server._compressor_factory) {
+      // Received bytes go through the server's _receive(), the same as
+      // for callback reads, so that compression is negotiated and
+      // compressed records are decoded.
+      std::size_t nbytes = server._current_read_mode() == es::READ_UNTIL ? 0 : server._read_buffer_nbytes;
+
+      while (!(nbytes_received = server._buffered_frame_nbytes(*connection, nbytes))) {
+        StreamBufferP chunk = server._acquire_buffer();
+        std::size_t nbytes_chunk = co_await connection->socket.async_read_some(
+          chunk->prepare(server._receive_chunk_nbytes),
+          boost::asio::redirect_error(boost::asio::use_awaitable, error)
+        );
+
+        if (nbytes_chunk && connection->is_open()) {
+          chunk->commit(nbytes_chunk);
+
+          if (!server._receive(*connection, chunk->data(), error)) {
+            server._release_buffer(std::move(chunk));
+            break;
+          }
+        }
+
+        server._release_buffer(std::move(chunk));
+
+        if (error) {
+          nbytes_received = nbytes ? std::min(nbytes, connection->read_buffer->size()) : 0;
+          break;
+        }
+      }
+    } else if (server._current_read_mode() == es::READ_UNTIL) {
+      nbytes_received = co_await boost::asio::async_read_until(
+        connection->socket, *connection->read_buffer, server._read_delimeter,
+        boost::asio::redirect_error(boost::asio::use_awaitable, error)
+      );
+    } else if (server._current_read_mode() == es::READ_AVAILABLE && !connection->read_buffer->size()) {
+      nbytes_received = co_await connection->socket.async_read_some(
+        connection->read_buffer->prepare(server._read_buffer_nbytes),
+        boost::asio::redirect_error(boost::asio::use_awaitable, error)
+      );
+
+      connection->read_buffer->commit(nbytes_received);
+    } else if (server._current_read_mode() == es::READ_AVAILABLE) {
+      nbytes_received = std::min(server._read_buffer_nbytes, connection->read_buffer->size());
+    } else {
+      std::size_t nbytes = server._read_buffer_nbytes;
+      std::size_t nbytes_buffered = connection->read_buffer->size();
+
+      co_await boost::asio::async_read(
+        connection->socket, *connection->read_buffer,
+        boost::asio::transfer_exactly(nbytes > nbytes_buffered ? nbytes - nbytes_buffered : 0),
+        boost::asio::redirect_error(boost::asio::use_awaitable, error)
+      );
+
+      nbytes_received = std::min(nbytes, connection->read_buffer->size());
+    }
+
+    if (!connection->is_open()) {
+      co_return StreamBufferP();
+    }
+
+    StreamBufferP frame;
+
+    if (nbytes_received) {
+      frame = server._take_frame(*connection, nbytes_received);
+
+      if (server._capture) {
+        server._capture->append(es::CAPTURE_READ, connection->handle, frame->data());
+      }
+    }
+
+    if (error || !nbytes_received) {
+      Error failure(es::ERROR_READ, error);
+
+      server._handle_error(connection->handle, failure);
+      server._close_after_send(connection);
+
+      if (!frame && failure && !failure.is_cancelled() && failure.code != boost::asio::error::eof) {
+        throw boost::system::system_error(failure.code);
+      }
+    }
+
+    co_return frame;
+  }
+
+  /**
+   * Sends the passed buffer and yields the number of bytes sent once it
+   * has been written. The payload goes through the connection's write
+   * queue, so it is ordered with respect to sendb()/sends(). Failures are
+   * thrown as a boost::system::system_error.
+   * 
+   * @param payload The bytes to send.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  Awaitable<std::size_t> send(
+    StreamBufferP payload)
+  {
+    return boost::asio::async_initiate<const boost::asio::use_awaitable_t<>, void(boost::system::error_code, std::size_t)>(
+      [](auto handler, ServerTy* server, ConnectionHandle handle, StreamBufferP payload) {
+        auto shared_handler = std::make_shared<decltype(handler)>(std::move(handler));
+
+        server->_queue_send(handle, Transfer { es::make_uid(), std::move(payload),
+          [shared_handler](boost::system::error_code error, std::size_t nbytes_sent) {
+            (*shared_handler)(error, nbytes_sent);
+          }
+        });
+      },
+      boost::asio::use_awaitable, _server, handle(), std::move(payload)
+    );
+  }
+
+  /**
+   * Same as send(), copying the passed string into a buffer.
+   * 
+   * @param payload The bytes to send.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  Awaitable<std::size_t> sends(
+    const std::string& payload)
+  {
+    StreamBufferP buffer = std::make_shared<StreamBuffer>();
+
+    buffer->commit(boost::asio::buffer_copy(
+      buffer->prepare(payload.size()), boost::asio::buffer(payload)
+    ));
+
+    return send(std::move(buffer));
+  }
+
+  /**
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void close()
+  {
+    if (_connection) {
+      _server->_close(_connection);
+    }
+  }
+
+  /**
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void shutdown_write()
+  {
+    if (_connection) {
+      _server->_shutdown_after_send(_connection);
+    }
+  }
+};
+
+}
+
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,489 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+
+
+#ifndef _EASYSOCKETS_CAPTURE_HPP_
+#define _EASYSOCKETS_CAPTURE_HPP_
+
+#include "EasySockets.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace es {
+
+enum {
+  CAPTURE_OPEN  = 0x01,
+  CAPTURE_READ  = 0x02,
+  CAPTURE_SEND  = 0x03,
+  CAPTURE_CLOSE = 0x04
+};
+
+enum {
+  CAPTURE_ELIDED = 0x01
+};
+
+/**
+ * Start of a capture file. Records follow the header back to back, each
+ * padded to a multiple of 8 bytes. The committed size is updated after
+ * every record, so a capture can be read while it is still being
+ * written.
+ * */
+struct CaptureFileHeader {
+  static constexpr uint64_t magic_value = 0x3230504143534545; // "EESCAP02"
+
+  uint64_t magic;
+  uint64_t started_ns;
+  std::atomic<uint64_t> nbytes_committed;
+  std::atomic<uint64_t> nrecords_dropped;
+};
+
+/**
+ * Header of one record. The time is in nanoseconds since the capture
+ * started, measured by the steady clock. A record flagged CAPTURE_ELIDED
+ * holds only the size of its bytes, not the bytes themselves.
+ * */
+struct CaptureRecordHeader {
+  uint64_t when_ns;
+  uint64_t handle;
+  uint32_t nbytes;
+  uint8_t kind;
+  uint8_t flags;
+  uint8_t reserved[2];
+};
+
+/**
+ * One record, as returned by CaptureReader. The data points into the
+ * reader's mapping, and is null for an elided record.
+ * */
+struct CaptureRecord {
+  int kind;
+  ConnectionHandle handle;
+  std::chrono::nanoseconds when;
+  const char* data;
+  std::size_t nbytes;
+};
+
+/**
+ * Append-only, memory-mapped log of what every connection of a server
+ * received and was asked to send, and when. Appending is a copy into the
+ * mapping, with no system call, so a capture can stay on in production.
+ * The file is sized up front; once it is full, further records are
+ * dropped and counted instead of stalling the server. Closing the log
+ * trims the file to the records it holds.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class CaptureLog {
+protected:
+  int _descriptor;
+  char* _memory;
+  std::size_t _memory_nbytes;
+  std::size_t _offset;
+  std::chrono::steady_clock::time_point _started;
+
+  CaptureFileHeader* _header() const {
+    return reinterpret_cast<CaptureFileHeader*>(_memory);
+  }
+
+  static std::size_t _padded(
+    std::size_t nbytes)
+  {
+    return (nbytes + 7) & ~static_cast<std::size_t>(7);
+  }
+
+  /**
+   * Appends a record of the passed size holding the passed bytes, or
+   * counts it as dropped if it does not fit.
+   *
+   * @param kind CAPTURE_OPEN, CAPTURE_READ, CAPTURE_SEND or CAPTURE_CLOSE.
+   * @param handle The handle of the connection.
+   * @param data The bytes kept, as a buffer sequence.
+   * @param nbytes The size recorded.
+   * @param flags CAPTURE_ELIDED if the bytes are not kept, zero otherwise.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class ConstBufferSequence>
+  void _append(
+    int kind,
+    ConnectionHandle handle,
+    const ConstBufferSequence& data,
+    std::size_t nbytes,
+    int flags)
+  {
+    if (!_memory) {
+      return;
+    }
+
+    std::size_t nbytes_kept = boost::asio::buffer_size(data);
+    std::size_t nbytes_record = sizeof(CaptureRecordHeader) + _padded(nbytes_kept);
+
+    if (nbytes_record > _memory_nbytes - _offset) {
+      _header()->nrecords_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    CaptureRecordHeader record;
+
+    record.when_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - _started
+    ).count());
+    record.handle = handle;
+    record.nbytes = static_cast<uint32_t>(nbytes);
+    record.kind = static_cast<uint8_t>(kind);
+    record.flags = static_cast<uint8_t>(flags);
+    std::memset(record.reserved, 0, sizeof(record.reserved));
+
+    std::memcpy(_memory + _offset, &record, sizeof(record));
+    boost::asio::buffer_copy(boost::asio::buffer(_memory + _offset + sizeof(record), nbytes_kept), data);
+
+    _offset += nbytes_record;
+    _header()->nbytes_committed.store(_offset, std::memory_order_release);
+  }
+public:
+  typedef std::shared_ptr<CaptureLog> Pointer;
+
+  CaptureLog()
+    : _descriptor(-1),
+      _memory(nullptr),
+      _memory_nbytes(0),
+      _offset(0)
+  {}
+
+  ~CaptureLog() {
+    close();
+  }
+
+  CaptureLog(const CaptureLog&) = delete;
+  CaptureLog& operator = (const CaptureLog&) = delete;
+
+  /**
+   * Creates the passed file, replacing any existing one, and maps it.
+   * Returns null on failure.
+   *
+   * @param path The path of the capture file.
+   * @param capacity_nbytes The most bytes the capture may take up.
+   * @param error Set on failure.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static Pointer create(
+    const std::string& path,
+    std::size_t capacity_nbytes,
+    boost::system::error_code& error)
+  {
+    Pointer capture = std::make_shared<CaptureLog>();
+    std::size_t nbytes = std::max(_padded(capacity_nbytes), sizeof(CaptureFileHeader));
+
+    capture->_descriptor = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (capture->_descriptor < 0 || ::ftruncate(capture->_descriptor, static_cast<off_t>(nbytes))) {
+      error = boost::system::error_code(errno, boost::system::system_category());
+      return nullptr;
+    }
+
+    void* memory = ::mmap(nullptr, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED, capture->_descriptor, 0);
+
+    if (memory == MAP_FAILED) {
+      error = boost::system::error_code(errno, boost::system::system_category());
+      return nullptr;
+    }
+
+    capture->_memory = static_cast<char*>(memory);
+    capture->_memory_nbytes = nbytes;
+    capture->_offset = sizeof(CaptureFileHeader);
+    capture->_started = std::chrono::steady_clock::now();
+
+    CaptureFileHeader* header = capture->_header();
+
+    header->magic = CaptureFileHeader::magic_value;
+    header->started_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()
+    ).count());
+    header->nbytes_committed.store(capture->_offset, std::memory_order_release);
+    header->nrecords_dropped.store(0, std::memory_order_relaxed);
+
+    return capture;
+  }
+
+  /**
+   * Appends a record holding the passed bytes, or counts it as dropped
+   * if it does not fit.
+   *
+   * @param kind CAPTURE_OPEN, CAPTURE_READ, CAPTURE_SEND or CAPTURE_CLOSE.
+   * @param handle The handle of the connection.
+   * @param data The bytes, as a buffer sequence.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class ConstBufferSequence>
+  void append(
+    int kind,
+    ConnectionHandle handle,
+    const ConstBufferSequence& data)
+  {
+    _append(kind, handle, data, boost::asio::buffer_size(data), 0);
+  }
+
+  /**
+   * Same as above, for records without bytes.
+   *
+   * @param kind CAPTURE_OPEN or CAPTURE_CLOSE.
+   * @param handle The handle of the connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void append(
+    int kind,
+    ConnectionHandle handle)
+  {
+    append(kind, handle, boost::asio::const_buffer());
+  }
+
+  /**
+   * Same as above, for bytes that are only counted, such as a range of a
+   * file sent with sendfile(). The record is flagged CAPTURE_ELIDED.
+   *
+   * @param kind CAPTURE_READ or CAPTURE_SEND.
+   * @param handle The handle of the connection.
+   * @param nbytes The number of bytes.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void append_elided(
+    int kind,
+    ConnectionHandle handle,
+    std::size_t nbytes)
+  {
+    _append(kind, handle, boost::asio::const_buffer(), nbytes, es::CAPTURE_ELIDED);
+  }
+
+  /**
+   * Returns the number of bytes written so far, header included.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::size_t nbytes() const {
+    return _offset;
+  }
+
+  /**
+   * Returns the number of records dropped because the capture was full.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t ndropped() const {
+    return _memory ? _header()->nrecords_dropped.load(std::memory_order_relaxed) : 0;
+  }
+
+  /**
+   * Unmaps the capture and trims the file to the records it holds.
+   * Records appended afterwards are ignored.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void close()
+  {
+    if (_memory) {
+      ::munmap(_memory, _memory_nbytes);
+      _memory = nullptr;
+
+      if (::ftruncate(_descriptor, static_cast<off_t>(_offset))) {
+        // The file keeps its full size; readers go by the committed size.
+      }
+    }
+
+    if (_descriptor >= 0) {
+      ::close(_descriptor);
+      _descriptor = -1;
+    }
+  }
+};
+
+/**
+ * Reads the records of a capture file in the order they were written.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class CaptureReader {
+protected:
+  const char* _memory;
+  std::size_t _memory_nbytes;
+  std::size_t _offset;
+public:
+  CaptureReader()
+    : _memory(nullptr),
+      _memory_nbytes(0),
+      _offset(0)
+  {}
+
+  ~CaptureReader() {
+    close();
+  }
+
+  CaptureReader(const CaptureReader&) = delete;
+  CaptureReader& operator = (const CaptureReader&) = delete;
+
+  /**
+   * Maps the passed capture file.
+   *
+   * @param path The path of the capture file.
+   * @param error Set on failure.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool open(
+    const std::string& path,
+    boost::system::error_code& error)
+  {
+    close();
+
+    int descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status;
+
+    if (descriptor < 0 || ::fstat(descriptor, &status)) {
+      error = boost::system::error_code(errno, boost::system::system_category());
+      if (descriptor >= 0) {
+        ::close(descriptor);
+      }
+      return false;
+    }
+
+    if (static_cast<std::size_t>(status.st_size) < sizeof(CaptureFileHeader)) {
+      ::close(descriptor);
+      error = boost::asio::error::invalid_argument;
+      return false;
+    }
+
+    void* memory = ::mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_SHARED, descriptor, 0);
+
+    ::close(descriptor);
+
+    if (memory == MAP_FAILED) {
+      error = boost::system::error_code(errno, boost::system::system_category());
+      return false;
+    }
+
+    _memory = static_cast<const char*>(memory);
+    _memory_nbytes = static_cast<std::size_t>(status.st_size);
+    _offset = sizeof(CaptureFileHeader);
+
+    if (header().magic != CaptureFileHeader::magic_value) {
+      close();
+      error = boost::asio::error::invalid_argument;
+      return false;
+    }
+
+    return true;
+  }
+
+  const CaptureFileHeader& header() const {
+    return *reinterpret_cast<const CaptureFileHeader*>(_memory);
+  }
+
+  /**
+   * Returns the wall clock time the capture started at.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::chrono::system_clock::time_point started() const {
+    return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+      std::chrono::nanoseconds(header().started_ns)
+    ));
+  }
+
+  /**
+   * Reads the next record into the passed one. Returns false once every
+   * committed record has been read.
+   *
+   * @param record Set to the next record.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool next(
+    CaptureRecord& record)
+  {
+    if (!_memory) {
+      return false;
+    }
+
+    std::size_t nbytes_committed = std::min<std::size_t>(
+      header().nbytes_committed.load(std::memory_order_acquire), _memory_nbytes
+    );
+
+    if (nbytes_committed - _offset < sizeof(CaptureRecordHeader)) {
+      return false;
+    }
+
+    CaptureRecordHeader stored;
+
+    std::memcpy(&stored, _memory + _offset, sizeof(stored));
+
+    bool is_elided = stored.flags & es::CAPTURE_ELIDED;
+    std::size_t nbytes_kept = is_elided ? 0 : stored.nbytes;
+    std::size_t nbytes_record = sizeof(stored) + ((nbytes_kept + 7) & ~static_cast<std::size_t>(7));
+
+    if (nbytes_record > nbytes_committed - _offset) {
+      return false;
+    }
+
+    record.kind = stored.kind;
+    record.handle = stored.handle;
+    record.when = std::chrono::nanoseconds(stored.when_ns);
+    record.data = is_elided ? nullptr : _memory + _offset + sizeof(stored);
+    record.nbytes = stored.nbytes;
+
+    _offset += nbytes_record;
+
+    return true;
+  }
+
+  void close()
+  {
+    if (_memory) {
+      ::munmap(const_cast<char*>(_memory), _memory_nbytes);
+      _memory = nullptr;
+    }
+  }
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,126 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+#ifndef _EASYSOCKETS_CODEC_HPP_
+#define _EASYSOCKETS_CODEC_HPP_
+
+#include "EasySockets.hpp"
+
+#include <string>
+
+namespace es {
+
+/**
+ * Default codec of a server: frames are handed over as they were
+ * received and payloads are sent as they are.
+ * 
+ * A codec is a class with a Message type and the two functions below.
+ * decode() runs on the thread that received the frame, right after it
+ * was read; when it returns false the connection is closed and the
+ * passed error reported through an ERROR_HANDLE event. encode() writes a
+ * message into a buffer taken from the server's buffer pool.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class RawCodec {
+public:
+  typedef StreamBufferP Message;
+
+  /**
+   * 
+   * @param connection The handle of the connection the frame came from.
+   * @param frame The received frame.
+   * @param message Set to the decoded message.
+   * @param error Set when the frame cannot be decoded.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool decode(
+    ConnectionHandle,
+    const StreamBufferP& frame,
+    Message& message,
+    boost::system::error_code&)
+  {
+    message = frame;
+    return true;
+  }
+
+  /**
+   * 
+   * @param connection The handle of the connection the message goes to.
+   * @param message The message to send.
+   * @param buffer The buffer to write the encoded message into.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void encode(
+    ConnectionHandle,
+    const Message& message,
+    StreamBuffer& buffer)
+  {
+    buffer.commit(boost::asio::buffer_copy(buffer.prepare(message->size()), message->data()));
+  }
+};
+
+/**
+ * Codec turning every frame into a std::string, delimeter included when
+ * reading until one.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class StringCodec {
+public:
+  typedef std::string Message;
+
+  bool decode(
+    ConnectionHandle,
+    const StreamBufferP& frame,
+    Message& message,
+    boost::system::error_code&)
+  {
+    message.assign(
+      boost::asio::buffers_begin(frame->data()),
+      boost::asio::buffers_end(frame->data())
+    );
+
+    return true;
+  }
+
+  void encode(
+    ConnectionHandle,
+    const Message& message,
+    StreamBuffer& buffer)
+  {
+    buffer.commit(boost::asio::buffer_copy(buffer.prepare(message.size()), boost::asio::buffer(message)));
+  }
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,264 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+
+#ifndef _EASYSOCKETS_COMPRESSION_HPP_
+#define _EASYSOCKETS_COMPRESSION_HPP_
+
+#include "EasySockets.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+
+namespace es {
+
+/**
+ * Transport stage compressing everything sent on one connection and
+ * decompressing everything received on it. The stream keeps its state
+ * from one payload to the next, so repeated content compresses against
+ * everything sent before it.
+ * 
+ * On the wire the stream is a sequence of records, each a 4 byte big
+ * endian header followed by its bytes. The header's top bit tells if
+ * the record is compressed, and the remaining 31 bits give its size.
+ * Payloads smaller than the threshold are sent as stored records
+ * without going through the compressor at all.
+ * 
+ * Implementations only provide the compression itself: _compress() and
+ * _decompress() must flush everything they are given, so that every
+ * record can be decompressed as soon as it arrives.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class Compressor {
+public:
+  typedef std::unique_ptr<Compressor> Pointer;
+  typedef std::function<Pointer()> Factory;
+
+  /**
+   * Sent first by a peer asking for compression, and echoed by the
+   * server when it agrees. Everything after it is made of records.
+   * */
+  static constexpr const char* magic = "\x89" "ESZ";
+  static constexpr std::size_t magic_nbytes = 4;
+protected:
+  static constexpr uint32_t _compressed_flag = 0x80000000u;
+  static constexpr std::size_t _max_record_input_nbytes = 16 * 1024 * 1024;
+
+  std::size_t _threshold_nbytes;
+  std::size_t _max_output_nbytes;
+  StreamBuffer _scratch;
+  unsigned char _header[4];
+  std::size_t _header_nbytes;
+  std::size_t _record_nbytes_left;
+  bool _is_record_compressed;
+
+  virtual void _reset() = 0;
+
+  /**
+   * Appends the compressed form of the passed bytes to the passed buffer,
+   * flushed so that it can be decompressed on its own.
+   * 
+   * @param input The bytes to compress.
+   * @param output The buffer to append to.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  virtual void _compress(
+    boost::asio::const_buffer input,
+    StreamBuffer& output) = 0;
+
+  /**
+   * Appends the decompressed form of the passed bytes, which may be any
+   * part of a compressed record, to the passed buffer. Returns false if
+   * they cannot be decompressed, or if they would append more than the
+   * passed number of bytes.
+   * 
+   * @param input The compressed bytes.
+   * @param output The buffer to append to.
+   * @param max_output_nbytes The most bytes that may be appended.
+   * @param error Set when the bytes cannot be decompressed.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  virtual bool _decompress(
+    boost::asio::const_buffer input,
+    StreamBuffer& output,
+    std::size_t max_output_nbytes,
+    boost::system::error_code& error) = 0;
+
+  static void _write_header(
+    StreamBuffer& output,
+    uint32_t header)
+  {
+    unsigned char bytes[4] = {
+      static_cast<unsigned char>(header >> 24),
+      static_cast<unsigned char>(header >> 16),
+      static_cast<unsigned char>(header >> 8),
+      static_cast<unsigned char>(header)
+    };
+
+    output.commit(boost::asio::buffer_copy(output.prepare(4), boost::asio::buffer(bytes)));
+  }
+public:
+  static constexpr std::size_t default_max_output_nbytes = 64 * 1024 * 1024;
+
+  /**
+   * 
+   * @param threshold_nbytes Payloads smaller than this are not compressed.
+   * @param max_output_nbytes The largest a buffer may grow to through decompress().
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  explicit Compressor(
+    std::size_t threshold_nbytes,
+    std::size_t max_output_nbytes = default_max_output_nbytes)
+    : _threshold_nbytes(threshold_nbytes),
+      _max_output_nbytes(max_output_nbytes),
+      _header_nbytes(0),
+      _record_nbytes_left(0),
+      _is_record_compressed(false)
+  {}
+
+  virtual ~Compressor() {}
+
+  Compressor(const Compressor&) = delete;
+  Compressor& operator = (const Compressor&) = delete;
+
+  /**
+   * Forgets everything sent and received so far, so that the compressor
+   * can be used for another connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void reset()
+  {
+    _header_nbytes = 0;
+    _record_nbytes_left = 0;
+    _is_record_compressed = false;
+    _reset();
+  }
+
+  /**
+   * Appends the records carrying the passed payload to the passed buffer.
+   * 
+   * @param input The payload.
+   * @param output The buffer to append to.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void compress(
+    boost::asio::const_buffer input,
+    StreamBuffer& output)
+  {
+    if (input.size() < _threshold_nbytes) {
+      _write_header(output, static_cast<uint32_t>(input.size()));
+      output.commit(boost::asio::buffer_copy(output.prepare(input.size()), input));
+      return;
+    }
+
+    while (input.size()) {
+      std::size_t nbytes = std::min(input.size(), _max_record_input_nbytes);
+
+      _compress(boost::asio::buffer(input.data(), nbytes), _scratch);
+      _write_header(output, _compressed_flag | static_cast<uint32_t>(_scratch.size()));
+      output.commit(boost::asio::buffer_copy(output.prepare(_scratch.size()), _scratch.data()));
+      _scratch.consume(_scratch.size());
+
+      input += nbytes;
+    }
+  }
+
+  /**
+   * Appends the payload bytes carried by the passed part of the record
+   * stream to the passed buffer. Records may be split anywhere; the
+   * remainder of a split record is picked up by the next call. Returns
+   * false if the stream is corrupt, or if the output buffer would grow
+   * past the compressor's maximum output size (message_size), after
+   * which the compressor must be reset before being used again.
+   * 
+   * @param input The received bytes.
+   * @param output The buffer to append to.
+   * @param error Set when the stream cannot be decompressed.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool decompress(
+    boost::asio::const_buffer input,
+    StreamBuffer& output,
+    boost::system::error_code& error)
+  {
+    while (input.size()) {
+      if (!_record_nbytes_left) {
+        std::size_t nbytes = std::min(input.size(), sizeof(_header) - _header_nbytes);
+
+        std::memcpy(_header + _header_nbytes, input.data(), nbytes);
+        _header_nbytes += nbytes;
+        input += nbytes;
+
+        if (_header_nbytes < sizeof(_header)) {
+          break;
+        }
+
+        uint32_t header = (uint32_t(_header[0]) << 24) | (uint32_t(_header[1]) << 16) | (uint32_t(_header[2]) << 8) | uint32_t(_header[3]);
+
+        _header_nbytes = 0;
+        _is_record_compressed = (header & _compressed_flag) != 0;
+        _record_nbytes_left = header & ~_compressed_flag;
+        continue;
+      }
+
+      std::size_t nbytes = std::min(input.size(), _record_nbytes_left);
+      boost::asio::const_buffer part(input.data(), nbytes);
+      std::size_t max_output_nbytes = output.size() < _max_output_nbytes ? _max_output_nbytes - output.size() : 0;
+
+      if (!_is_record_compressed) {
+        if (nbytes > max_output_nbytes) {
+          error = boost::asio::error::message_size;
+          return false;
+        }
+
+        output.commit(boost::asio::buffer_copy(output.prepare(nbytes), part));
+      } else if (!_decompress(part, output, max_output_nbytes, error)) {
+        return false;
+      }
+
+      _record_nbytes_left -= nbytes;
+      input += nbytes;
+    }
+
+    return true;
+  }
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,338 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+#ifndef _EASYSOCKETS_CONNECTION_HPP_
+#define _EASYSOCKETS_CONNECTION_HPP_
+
+#include "Compression.hpp"
+#include "EasySockets.hpp"
+#include "HandlerAllocator.hpp"
+#include "RateLimiter.hpp"
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+namespace es {
+
+template <class, class, class, class> class Server;
+
+/**
+ * A single socket connection along with everything the server keeps
+ * about it: the read buffer, the queue of payloads waiting to be sent,
+ * the read timer, the read rate limit and an arbitrary piece of user
+ * data.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <class ProtocolTy>
+class Connection {
+  template <class, class, class, class> friend class Server;
+public:
+  typedef std::shared_ptr<Connection<ProtocolTy>> Pointer;
+  typedef typename ProtocolTy::socket Socket;
+
+  /**
+   * A payload queued for sending along with the id handed back to the
+   * caller of sendb()/sends(). When on_sent is set it is called once the
+   * payload has been written instead of a SEND_HANDLE event being queued.
+   * Transfers queued by sendfile() have no payload and name a range of
+   * an open file instead. Pooled payloads go back to the server's buffer
+   * pool once sent. Payloads bypassing compression are written as they
+   * are even when the connection is compressed. Descriptors are passed
+   * along with the payload over local sockets.
+   * */
+  struct Transfer {
+    uint64_t id;
+    StreamBufferP payload;
+    std::function<void(boost::system::error_code, std::size_t)> on_sent;
+    int file = -1;
+    uint64_t file_offset = 0;
+    std::size_t file_nbytes = 0;
+    bool is_pooled = false;
+    bool bypasses_compression = false;
+    std::vector<int> descriptors = std::vector<int>();
+  };
+protected:
+  HandlerMemory _read_memory;
+  HandlerMemory _send_memory;
+  HandlerMemory _timer_memory;
+  bool _is_sending;
+  bool _is_reading;
+  bool _is_closed;
+  bool _shutdown_pending;
+  bool _close_pending;
+  uint64_t _engine_op;
+  uint64_t _read_epoch;
+  std::size_t _nreads_in_epoch;
+  std::size_t _read_estimate;
+  bool _is_negotiating;
+  Compressor::Pointer _compressor;
+public:
+  ConnectionHandle handle;
+  Socket socket;
+  StreamBufferP read_buffer;
+  std::deque<Transfer> write_queue;
+  boost::asio::deadline_timer read_timer;
+  RateLimiter read_limiter;
+  std::deque<int> descriptors;
+  std::shared_ptr<void> user_data;
+
+  /**
+   * 
+   * @param context The io_service, or executor such as a strand, the socket and timer will run on.
+   * @param args Any further arguments of the socket's constructor, such as an SSL context.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class ContextTy, class... SocketArgTys>
+  explicit Connection(
+    ContextTy&& context,
+    SocketArgTys&&... args)
+    : _is_sending(false),
+      _is_reading(false),
+      _is_closed(false),
+      _shutdown_pending(false),
+      _close_pending(false),
+      _engine_op(0),
+      _read_epoch(0),
+      _nreads_in_epoch(0),
+      _read_estimate(0),
+      _is_negotiating(false),
+      handle(es::NULL_HANDLE),
+      socket(context, std::forward<SocketArgTys>(args)...),
+      read_buffer(std::make_shared<StreamBuffer>()),
+      read_timer(context)
+  {}
+
+  Connection(const Connection&) = delete;
+  Connection& operator = (const Connection&) = delete;
+
+  /**
+   * Returns true if a payload is currently being written to the socket.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool is_sending() const {
+    return _is_sending;
+  }
+
+  /**
+   * Returns true until the connection has been closed, either by the
+   * server or by the remote end.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool is_open() const {
+    return !_is_closed;
+  }
+
+  /**
+   * Returns true once the connection has negotiated compression, or
+   * has asked its peer for it.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool is_compressed() const {
+    return static_cast<bool>(_compressor);
+  }
+};
+
+/**
+ * Table of the connections of a server, addressed by generational
+ * handles. Connections live in a vector of slots indexed by handle, and
+ * freed slots are reused oldest first, which together with the handle's
+ * generation keeps stale handles from reaching a new connection.
+ * 
+ * Open connections and their handles are kept packed together in two
+ * parallel vectors, so walking every connection is one linear pass over
+ * entries actually in use. Those vectors are the hot part of the table.
+ * The slots are the cold part: each only holds the slot's current handle
+ * and the position of its connection in the packed vectors, and is only
+ * touched when a handle is looked up.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <class ConnectionTy>
+class ConnectionTable {
+public:
+  typedef std::shared_ptr<ConnectionTy> ConnectionP;
+protected:
+  struct _Slot {
+    ConnectionHandle handle;
+    uint32_t position;
+  };
+
+  std::vector<ConnectionHandle> _handles;
+  std::vector<ConnectionP> _packed;
+  std::vector<_Slot> _slots;
+  std::deque<uint32_t> _free;
+  const ConnectionP _none;
+public:
+  /**
+   * Stores the passed connection and returns its new handle, which is
+   * also written to the connection itself. Returns NULL_HANDLE, and does
+   * not store the connection, if the table already holds as many
+   * connections as a handle can address.
+   * 
+   * @param connection The connection to store.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  ConnectionHandle insert(
+    ConnectionP connection)
+  {
+    uint32_t slot;
+
+    if (_free.empty()) {
+      if (_slots.size() >= HANDLE_SLOT_MASK) {
+        return es::NULL_HANDLE;
+      }
+
+      slot = static_cast<uint32_t>(_slots.size());
+      _slots.push_back(_Slot { slot + 1, 0 });
+    } else {
+      slot = _free.front();
+      _free.pop_front();
+    }
+
+    _Slot& target = _slots[slot];
+
+    target.position = static_cast<uint32_t>(_handles.size());
+    connection->handle = target.handle;
+    _handles.push_back(target.handle);
+    _packed.push_back(std::move(connection));
+
+    return target.handle;
+  }
+
+  /**
+   * Removes the connection stored under the passed handle, if any, and
+   * moves its slot on to the next generation. A slot on its last
+   * generation is retired rather than freed, so that its handles are
+   * never handed out twice.
+   * 
+   * @param handle The handle of the connection to remove.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void erase(
+    ConnectionHandle handle)
+  {
+    if (!find(handle)) {
+      return;
+    }
+
+    uint32_t slot = es::slot_of(handle);
+    _Slot& target = _slots[slot];
+    ConnectionHandle last = _handles.back();
+
+    _handles[target.position] = last;
+    _packed[target.position] = std::move(_packed.back());
+    _slots[es::slot_of(last)].position = target.position;
+    _handles.pop_back();
+    _packed.pop_back();
+
+    if ((target.handle | HANDLE_SLOT_MASK) == ~ConnectionHandle(0)) {
+      target.handle = es::NULL_HANDLE;
+      return;
+    }
+
+    target.handle = ((target.handle & ~HANDLE_SLOT_MASK) + (ConnectionHandle(1) << HANDLE_SLOT_BITS)) | (slot + 1);
+    _free.push_back(slot);
+  }
+
+  /**
+   * Returns the connection stored under the passed handle, or a null
+   * pointer if there is none (e.g. it has since been closed, even if
+   * another connection took its slot.) The reference is only good until
+   * the next insert() or erase().
+   * 
+   * @param handle The handle of the connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  const ConnectionP& find(
+    ConnectionHandle handle) const
+  {
+    if (!(handle & HANDLE_SLOT_MASK) || es::slot_of(handle) >= _slots.size()) {
+      return _none;
+    }
+
+    const _Slot& slot = _slots[es::slot_of(handle)];
+
+    return slot.handle == handle ? _packed[slot.position] : _none;
+  }
+
+  /**
+   * Calls the passed function once for every stored connection. The
+   * function may erase the connection it is passed.
+   * 
+   * @param fn The function to call.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class FnTy>
+  void for_each(
+    FnTy fn) const
+  {
+    // Walked backwards, as erasing moves the last handle into the erased
+    // one's place.
+    for (std::size_t i = _packed.size(); i-- > 0; ) {
+      if (i < _packed.size()) {
+        ConnectionP connection = _packed[i];
+        fn(connection);
+      }
+    }
+  }
+
+  /**
+   * Returns the handles of every stored connection, packed together in
+   * no particular order. The vector changes as connections are inserted
+   * and erased.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  const std::vector<ConnectionHandle>& handles() const {
+    return _handles;
+  }
+
+  /**
+   * Returns the number of connections currently stored.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::size_t size() const {
+    return _handles.size();
+  }
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,202 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+
+#ifndef _EASYSOCKETS_DEFLATE_HPP_
+#define _EASYSOCKETS_DEFLATE_HPP_
+
+#include "Compression.hpp"
+
+#include <new>
+#include <string>
+
+#include <zlib.h>
+
+namespace es {
+
+/**
+ * Settings of a DeflateCompressor. Both ends of a connection must use
+ * the same dictionary. max_output_nbytes caps how large a connection's
+ * read buffer may grow through decompression, so that a small record
+ * cannot inflate into an arbitrary amount of memory; connections going
+ * past it fail with an ERROR_READ event.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+struct DeflateOptions {
+  int level = Z_DEFAULT_COMPRESSION;
+  int window_bits = 15;
+  int memory_level = 8;
+  std::size_t threshold_nbytes = 256;
+  std::size_t max_output_nbytes = Compressor::default_max_output_nbytes;
+  std::string dictionary;
+};
+
+/**
+ * Compressor using zlib's raw deflate format, optionally primed with a
+ * dictionary of content the payloads are expected to share (e.g. the
+ * keys of a JSON schema), which lets even the first payloads of a
+ * connection compress well. Requires linking with zlib.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class DeflateCompressor : public Compressor {
+protected:
+  static constexpr std::size_t _output_chunk_nbytes = 16 * 1024;
+
+  DeflateOptions _options;
+  z_stream _deflater;
+  z_stream _inflater;
+
+  void _set_dictionaries()
+  {
+    if (_options.dictionary.empty()) {
+      return;
+    }
+
+    const Bytef* dictionary = reinterpret_cast<const Bytef*>(_options.dictionary.data());
+    uInt nbytes = static_cast<uInt>(_options.dictionary.size());
+
+    deflateSetDictionary(&_deflater, dictionary, nbytes);
+    inflateSetDictionary(&_inflater, dictionary, nbytes);
+  }
+
+  void _reset() override
+  {
+    deflateReset(&_deflater);
+    inflateReset(&_inflater);
+    _set_dictionaries();
+  }
+
+  void _compress(
+    boost::asio::const_buffer input,
+    StreamBuffer& output) override
+  {
+    _deflater.next_in = const_cast<Bytef*>(static_cast<const Bytef*>(input.data()));
+    _deflater.avail_in = static_cast<uInt>(input.size());
+
+    do {
+      boost::asio::mutable_buffer space = output.prepare(deflateBound(&_deflater, _deflater.avail_in) + 16);
+
+      _deflater.next_out = static_cast<Bytef*>(space.data());
+      _deflater.avail_out = static_cast<uInt>(space.size());
+
+      deflate(&_deflater, Z_SYNC_FLUSH);
+      output.commit(space.size() - _deflater.avail_out);
+    } while (_deflater.avail_in || !_deflater.avail_out);
+  }
+
+  bool _decompress(
+    boost::asio::const_buffer input,
+    StreamBuffer& output,
+    std::size_t max_output_nbytes,
+    boost::system::error_code& error) override
+  {
+    std::size_t nbytes_output = 0;
+
+    _inflater.next_in = const_cast<Bytef*>(static_cast<const Bytef*>(input.data()));
+    _inflater.avail_in = static_cast<uInt>(input.size());
+
+    do {
+      // One byte more than allowed is offered, so that going past the
+      // limit can be told apart from reaching it exactly.
+      boost::asio::mutable_buffer space = output.prepare(std::min(_output_chunk_nbytes, max_output_nbytes - nbytes_output + 1));
+
+      _inflater.next_out = static_cast<Bytef*>(space.data());
+      _inflater.avail_out = static_cast<uInt>(space.size());
+
+      int result = inflate(&_inflater, Z_SYNC_FLUSH);
+      output.commit(space.size() - _inflater.avail_out);
+      nbytes_output += space.size() - _inflater.avail_out;
+
+      if (result != Z_OK && result != Z_BUF_ERROR) {
+        error = boost::asio::error::invalid_argument;
+        return false;
+      }
+
+      if (nbytes_output > max_output_nbytes) {
+        error = boost::asio::error::message_size;
+        return false;
+      }
+    } while (_inflater.avail_in || !_inflater.avail_out);
+
+    return true;
+  }
+public:
+  /**
+   * 
+   * @param options The compression level, dictionary, threshold and output limit.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  explicit DeflateCompressor(
+    const DeflateOptions& options = DeflateOptions())
+    : Compressor(options.threshold_nbytes, options.max_output_nbytes),
+      _options(options),
+      _deflater(),
+      _inflater()
+  {
+    if (deflateInit2(&_deflater, _options.level, Z_DEFLATED, -_options.window_bits, _options.memory_level, Z_DEFAULT_STRATEGY) != Z_OK) {
+      throw std::bad_alloc();
+    }
+
+    if (inflateInit2(&_inflater, -_options.window_bits) != Z_OK) {
+      deflateEnd(&_deflater);
+      throw std::bad_alloc();
+    }
+
+    _set_dictionaries();
+  }
+
+  ~DeflateCompressor()
+  {
+    deflateEnd(&_deflater);
+    inflateEnd(&_inflater);
+  }
+
+  /**
+   * Returns a factory making compressors with the passed options, to be
+   * handed to a server's set_compression().
+   * 
+   * @param options The compression level, dictionary and threshold.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static Factory factory(
+    const DeflateOptions& options = DeflateOptions())
+  {
+    return [options]() {
+      return Pointer(new DeflateCompressor(options));
+    };
+  }
+};
+
+}
+
+#endif
\ No newline at end of file
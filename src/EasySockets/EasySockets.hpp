@@ -29,42 +29,95 @@
 #ifndef _EASYSOCKETS_HPP_
 #define _EASYSOCKETS_HPP_
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <utility>
 
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace es {
 
 enum {
   TCP = 1,
   UDP = 2,
+  LOCAL = 3,
+  SHM = 4,
+
+  ERROR_NONE    = 0x00,
+  ERROR_ACCEPT  = 0x1A,
+  ERROR_READ    = 0x2A,
+  ERROR_SEND    = 0x3A,
+  ERROR_CONNECT = 0x4A,
+
+  READ_SOME      = 0x1B,
+  READ_UNTIL     = 0x2B,
+  READ_AVAILABLE = 0x3B,
 
-  ERROR_NONE   = 0x00,
-  ERROR_ACCEPT = 0x1A,
-  ERROR_READ   = 0x2A,
-  ERROR_SEND   = 0x3A,
-
-  READ_SOME  = 0x1B,
-  READ_UNTIL = 0x2B,
-
-  ACCEPT = 0x01,
-  CLOSE  = 0x02,
-  READ   = 0x03,
-  SEND   = 0x04,
-  BEGIN  = 0x10,
-  END    = 0x20,
-  HANDLE = 0x30,
+  ENGINE_EPOLL    = 0x1C,
+  ENGINE_IO_URING = 0x2C,
+
+  ACCEPT  = 0x01,
+  CLOSE   = 0x02,
+  READ    = 0x03,
+  SEND    = 0x04,
+  ERROR   = 0x05,
+  CONNECT = 0x06,
+  BEGIN   = 0x10,
+  END     = 0x20,
+  HANDLE  = 0x30,
+  TIMEOUT = 0x40,
   
-  ACCEPT_BEGIN  = ACCEPT | BEGIN,
-  ACCEPT_HANDLE = ACCEPT | HANDLE,
-  READ_BEGIN    = READ | BEGIN,
-  READ_HANDLE   = READ | HANDLE,
-  SEND_BEGIN    = SEND | BEGIN,
-  SEND_HANDLE   = SEND | HANDLE,
-  CLOSE_HANDLE  = CLOSE | HANDLE
+  ACCEPT_BEGIN   = ACCEPT | BEGIN,
+  ACCEPT_HANDLE  = ACCEPT | HANDLE,
+  CONNECT_BEGIN  = CONNECT | BEGIN,
+  CONNECT_HANDLE = CONNECT | HANDLE,
+  READ_BEGIN     = READ | BEGIN,
+  READ_HANDLE    = READ | HANDLE,
+  SEND_BEGIN     = SEND | BEGIN,
+  SEND_HANDLE    = SEND | HANDLE,
+  CLOSE_HANDLE   = CLOSE | HANDLE,
+  ERROR_HANDLE   = ERROR | HANDLE,
+  READ_TIMEOUT   = READ | TIMEOUT
 };
 
+/**
+ * Compact reference to a connection owned by a server. The low 24 bits
+ * of a handle are the connection's slot in the server's connection table
+ * plus one, so a value of zero never refers to a connection, and a table
+ * holds at most HANDLE_SLOT_MASK connections at once. The high 40 bits
+ * are the slot's generation, which changes every time the slot is freed,
+ * so the handle of a closed connection does not refer to the connection
+ * that later takes its slot. A slot whose generation is about to wrap is
+ * retired instead of reused.
+ * */
+typedef uint64_t ConnectionHandle;
+
+static const ConnectionHandle NULL_HANDLE = 0;
+static const unsigned HANDLE_SLOT_BITS = 24;
+static const ConnectionHandle HANDLE_SLOT_MASK = (ConnectionHandle(1) << HANDLE_SLOT_BITS) - 1;
+
+/**
+ * Returns the slot of the passed handle, which stays below the number of
+ * connections a server has ever had open at once. Handy for indexing
+ * per-connection state kept in a plain vector, next to the handle it
+ * belongs to.
+ * 
+ * @param handle The handle of the connection. Must not be NULL_HANDLE.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+inline uint32_t slot_of(
+  ConnectionHandle handle)
+{
+  return static_cast<uint32_t>(handle & HANDLE_SLOT_MASK) - 1;
+}
+
 typedef boost::asio::streambuf StreamBuffer;
 typedef boost::asio::buffers_iterator<boost::asio::const_buffers_1, char> BufferIterator;
 
@@ -80,14 +133,65 @@ typedef std::shared_ptr<boost::asio::io_service> IOServiceP;
 
 /**
  * Returns a new id guaranteed to be unique relative to all previous
- * calls to this function.
+ * calls to this function, from any thread.
  * 
  * @author Tyler O'Brien <contact@tylerobrien.com>
  * */
 inline uint64_t make_uid()
 {
-  static uint64_t uid = 0;
-  return uid++;
+  static std::atomic<uint64_t> uid(0);
+  return uid.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * Returns true if the passed local socket path names a socket in Linux's
+ * abstract namespace, which it does when it starts with '@'.
+ * 
+ * @param path The socket path.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+inline bool is_abstract_path(
+  const std::string& path)
+{
+  return !path.empty() && path[0] == '@';
+}
+
+/**
+ * Removes the socket at the passed local socket path, such as one left
+ * behind by a process that did not stop cleanly. Anything else found at
+ * the path, e.g. a regular file, is left alone.
+ * 
+ * @param path The socket path. Abstract names are ignored.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+inline void remove_socket_file(
+  const std::string& path)
+{
+  struct stat status;
+
+  if (!is_abstract_path(path) && !::lstat(path.c_str(), &status) && S_ISSOCK(status.st_mode)) {
+    ::unlink(path.c_str());
+  }
+}
+
+/**
+ * Returns the endpoint of the passed local socket path, with the leading
+ * '@' of abstract names replaced by the null byte the kernel expects.
+ * 
+ * @param path The socket path.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+inline boost::asio::local::stream_protocol::endpoint local_endpoint_of(
+  const std::string& path)
+{
+  if (is_abstract_path(path)) {
+    return boost::asio::local::stream_protocol::endpoint(std::string(1, '\0') + path.substr(1));
+  }
+
+  return boost::asio::local::stream_protocol::endpoint(path);
 }
 
 }
@@ -29,6 +29,8 @@
 #ifndef _EASYSOCKETS_ERROR_HPP_
 #define _EASYSOCKETS_ERROR_HPP_
 
+#include "EasySockets.hpp"
+
 #include <boost/system/error_code.hpp>
 
 namespace es {
@@ -64,6 +66,61 @@ public:
   Error(int16_t state, boost::system::error_code code)
     : state(state), code(code)
   {}
+
+  /**
+   * Returns the error state matching the passed event type, i.e.
+   * ERROR_ACCEPT for ACCEPT_* events and so on.
+   * 
+   * @param type The event type.
+   * */
+  static int16_t state_of(int type) {
+    switch (type & 0x0F) {
+    case es::ACCEPT:
+      return es::ERROR_ACCEPT;
+    case es::READ:
+      return es::ERROR_READ;
+    case es::SEND:
+      return es::ERROR_SEND;
+    case es::CONNECT:
+      return es::ERROR_CONNECT;
+    }
+
+    return es::ERROR_NONE;
+  }
+
+  /**
+   * Returns true if the operation was cancelled by the server itself,
+   * e.g. because the connection was closed or a timeout expired.
+   * */
+  bool is_cancelled() const {
+    return code == boost::asio::error::operation_aborted;
+  }
+
+  /**
+   * Returns true if the error means the remote end went away. These are
+   * part of the normal life of a connection.
+   * */
+  bool is_disconnect() const {
+    return code == boost::asio::error::eof
+        || code == boost::asio::error::connection_reset
+        || code == boost::asio::error::connection_aborted
+        || code == boost::asio::error::broken_pipe
+        || code == boost::asio::error::not_connected
+        || code == boost::asio::error::shut_down
+        || code == boost::asio::error::timed_out;
+  }
+
+  /**
+   * Returns true if the error is caused by the process or system running
+   * out of a resource (file descriptors, buffer space, memory.) Retrying
+   * right away is pointless; the operation should be retried later.
+   * */
+  bool is_resource_exhausted() const {
+    return code == boost::asio::error::no_descriptors
+        || code == boost::asio::error::no_buffer_space
+        || code == boost::asio::error::no_memory
+        || code == boost::system::errc::too_many_files_open_in_system;
+  }
 };
 
 }
@@ -38,9 +38,8 @@ namespace es {
 
 class Event
 {
-protected:
-  std::shared_ptr<void> _target;
 public:
+  ConnectionHandle connection;
   int type;
   int8_t protocol;
   uint64_t uid;
@@ -68,7 +67,8 @@ public:
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
   Event()
-    : type(0),
+    : connection(es::NULL_HANDLE),
+      type(0),
       protocol(0),
       uid(es::make_uid()),
       when(std::chrono::system_clock::now())
@@ -83,12 +83,11 @@ public:
    * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  template <class SocketPTy>
   Event(
-    SocketPTy target,
+    ConnectionHandle connection,
     int type,
     int8_t protocol)
-    : _target(std::static_pointer_cast<void>(target)),
+    : connection(connection),
       type(type),
       protocol(protocol),
       uid(es::make_uid()),
@@ -105,13 +104,12 @@ public:
    * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  template <class SocketPTy>
   Event(
-    SocketPTy target,
+    ConnectionHandle connection,
     int type,
     int8_t protocol,
     uint64_t unique_id)
-    : _target(std::static_pointer_cast<void>(target)),
+    : connection(connection),
       type(type),
       protocol(protocol),
       uid(unique_id),
@@ -128,16 +126,16 @@ public:
    * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  template <class SocketPTy>
   Event(
-    SocketPTy target,
+    ConnectionHandle connection,
     int type,
     int8_t protocol,
     boost::system::error_code error)
-    : _target(std::static_pointer_cast<void>(target)),
+    : connection(connection),
       type(type),
       protocol(protocol),
       uid(es::make_uid()),
+      error(error ? Error::state_of(type) : int16_t(es::ERROR_NONE), error),
       when(std::chrono::system_clock::now())
   {}
 
@@ -152,29 +150,42 @@ public:
    * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  template <class SocketPTy>
   Event(
-    SocketPTy target,
+    ConnectionHandle connection,
     int type,
     int8_t protocol,
     uint64_t unique_id,
     boost::system::error_code error)
-    : _target(std::static_pointer_cast<void>(target)),
+    : connection(connection),
       type(type),
       protocol(protocol),
       uid(unique_id),
+      error(error ? Error::state_of(type) : int16_t(es::ERROR_NONE), error),
       when(std::chrono::system_clock::now())
   {}
 
   /**
    * 
    * 
+   * @param
+   * @param
+   * @param
+   * @param
+   * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  template <class SocketTy>
-  std::shared_ptr<SocketTy> socket() const {
-    return std::static_pointer_cast<SocketTy>(_target);
-  }
+  Event(
+    ConnectionHandle connection,
+    int type,
+    int8_t protocol,
+    const Error& error)
+    : connection(connection),
+      type(type),
+      protocol(protocol),
+      uid(es::make_uid()),
+      error(error),
+      when(std::chrono::system_clock::now())
+  {}
 };
 
 class ReadEvent : public Event {
@@ -216,15 +227,14 @@ public:
    * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  template <class SocketPTy>
   ReadEvent(
     StreamBufferP buffer,
     std::size_t nbytes_transferred,
-    SocketPTy target,
+    ConnectionHandle connection,
     int type,
     int8_t protocol,
     boost::system::error_code error)
-    : Event(target, type, protocol, error),
+    : Event(connection, type, protocol, error),
       buffer(buffer),
       nbytes_transferred(nbytes_transferred)
   {}
@@ -241,16 +251,15 @@ public:
    * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  template <class SocketPTy>
   ReadEvent(
     StreamBufferP buffer,
     std::size_t nbytes_transferred,
-    SocketPTy target,
+    ConnectionHandle connection,
     int type,
     int8_t protocol,
     uint64_t unique_id,
     boost::system::error_code error)
-    : Event(target, type, protocol, unique_id, error),
+    : Event(connection, type, protocol, unique_id, error),
       buffer(buffer),
       nbytes_transferred(nbytes_transferred)
   {}
@@ -260,6 +269,9 @@ class SendEvent : public Event {
 public:
   uint64_t transfer_id;
   std::size_t nbytes_transferred;
+  // Set on the SEND_HANDLE events reporting the progress of a file
+  // transfer, which a final SEND_HANDLE without it concludes.
+  bool is_partial;
 
   /**
    * 
@@ -268,7 +280,8 @@ public:
   SendEvent()
     : Event(),
       transfer_id(0),
-      nbytes_transferred(0)
+      nbytes_transferred(0),
+      is_partial(false)
   {}
 
   /**
@@ -284,7 +297,8 @@ public:
     std::size_t nbytes_transferred)
     : Event(),
       transfer_id(transfer_id),
-      nbytes_transferred(nbytes_transferred)
+      nbytes_transferred(nbytes_transferred),
+      is_partial(false)
   {}
 
   /**
@@ -298,16 +312,16 @@ public:
    * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  template <class SocketPTy>
   SendEvent(
     uint64_t transfer_id,
     std::size_t nbytes_transferred,
-    SocketPTy target,
+    ConnectionHandle connection,
     int type,
     int8_t protocol)
-    : Event(target, type, protocol),
+    : Event(connection, type, protocol),
       transfer_id(transfer_id),
-      nbytes_transferred(nbytes_transferred)
+      nbytes_transferred(nbytes_transferred),
+      is_partial(false)
   {}
 
   /**
@@ -319,20 +333,60 @@ public:
    * @param
    * @param
    * @param
+   * @param is_partial True for the progress of a file transfer.
    * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  template <class SocketPTy>
   SendEvent(
     uint64_t transfer_id,
     std::size_t nbytes_transferred,
-    SocketPTy target,
+    ConnectionHandle connection,
     int type,
     int8_t protocol,
-    boost::system::error_code error)
-    : Event(target, type, protocol, error),
+    boost::system::error_code error,
+    bool is_partial = false)
+    : Event(connection, type, protocol, error),
       transfer_id(transfer_id),
-      nbytes_transferred(nbytes_transferred)
+      nbytes_transferred(nbytes_transferred),
+      is_partial(is_partial)
+  {}
+};
+
+/**
+ * READ_HANDLE event of a server with a codec: the received frame along
+ * with the message the codec decoded from it.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <class MessageTy>
+class MessageEvent : public ReadEvent {
+public:
+  MessageTy message;
+
+  /**
+   * 
+   * @param message The decoded message.
+   * @param buffer The frame the message was decoded from.
+   * @param nbytes_transferred The size of the frame.
+   * @param connection
+   * @param type
+   * @param protocol
+   * @param unique_id
+   * @param error
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  MessageEvent(
+    MessageTy message,
+    StreamBufferP buffer,
+    std::size_t nbytes_transferred,
+    ConnectionHandle connection,
+    int type,
+    int8_t protocol,
+    uint64_t unique_id,
+    boost::system::error_code error)
+    : ReadEvent(std::move(buffer), nbytes_transferred, connection, type, protocol, unique_id, error),
+      message(std::move(message))
   {}
 };
 
@@ -340,6 +394,9 @@ typedef std::shared_ptr<Event> EventP;
 typedef std::shared_ptr<ReadEvent> ReadEventP;
 typedef std::shared_ptr<SendEvent> SendEventP;
 
+template <class MessageTy>
+using MessageEventP = std::shared_ptr<MessageEvent<MessageTy>>;
+
 }
 
 #endif
\ No newline at end of file
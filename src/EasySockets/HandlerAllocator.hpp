@@ -0,0 +1,188 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+#ifndef _EASYSOCKETS_HANDLERALLOCATOR_HPP_
+#define _EASYSOCKETS_HANDLERALLOCATOR_HPP_
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace es {
+
+/**
+ * Small block of memory recycled between consecutive asynchronous
+ * operations. Only one allocation may use the block at a time; any
+ * request made while it is in use, or that is too large to fit, falls
+ * back to the global heap.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class HandlerMemory {
+protected:
+  typename std::aligned_storage<1024>::type _storage;
+  bool _in_use;
+public:
+  HandlerMemory() : _in_use(false) {}
+
+  HandlerMemory(const HandlerMemory&) = delete;
+  HandlerMemory& operator = (const HandlerMemory&) = delete;
+
+  /**
+   * 
+   * @param nbytes The number of bytes requested.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void* allocate(
+    std::size_t nbytes)
+  {
+    if (!_in_use && nbytes <= sizeof(_storage)) {
+      _in_use = true;
+      return &_storage;
+    }
+
+    return ::operator new(nbytes);
+  }
+
+  /**
+   * 
+   * @param pointer The memory previously returned by allocate().
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void deallocate(
+    void* pointer)
+  {
+    if (pointer == &_storage) {
+      _in_use = false;
+    } else {
+      ::operator delete(pointer);
+    }
+  }
+};
+
+/**
+ * Minimal allocator that hands out memory from a HandlerMemory block.
+ * This is what asio picks up as the associated allocator of a handler.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <class T>
+class HandlerAllocator {
+  template <class> friend class HandlerAllocator;
+protected:
+  HandlerMemory& _memory;
+public:
+  typedef T value_type;
+
+  explicit HandlerAllocator(
+    HandlerMemory& memory)
+    : _memory(memory)
+  {}
+
+  template <class U>
+  HandlerAllocator(
+    const HandlerAllocator<U>& other) noexcept
+    : _memory(other._memory)
+  {}
+
+  T* allocate(
+    std::size_t n) const
+  {
+    return static_cast<T*>(_memory.allocate(sizeof(T) * n));
+  }
+
+  void deallocate(
+    T* pointer,
+    std::size_t) const
+  {
+    _memory.deallocate(pointer);
+  }
+
+  bool operator == (const HandlerAllocator& other) const noexcept {
+    return &_memory == &other._memory;
+  }
+
+  bool operator != (const HandlerAllocator& other) const noexcept {
+    return &_memory != &other._memory;
+  }
+};
+
+/**
+ * Wraps a completion handler so that asio allocates its operation state
+ * from the passed HandlerMemory rather than from the heap.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <class HandlerTy>
+class CustomAllocHandler {
+protected:
+  HandlerMemory& _memory;
+  HandlerTy _handler;
+public:
+  typedef HandlerAllocator<HandlerTy> allocator_type;
+
+  CustomAllocHandler(
+    HandlerMemory& memory,
+    HandlerTy handler)
+    : _memory(memory),
+      _handler(std::move(handler))
+  {}
+
+  allocator_type get_allocator() const noexcept {
+    return allocator_type(_memory);
+  }
+
+  template <class... ArgTys>
+  void operator () (ArgTys&&... args) {
+    _handler(std::forward<ArgTys>(args)...);
+  }
+};
+
+/**
+ * 
+ * @param memory The memory block to allocate from.
+ * @param handler The completion handler.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <class HandlerTy>
+inline CustomAllocHandler<typename std::decay<HandlerTy>::type> make_custom_alloc_handler(
+  HandlerMemory& memory,
+  HandlerTy&& handler)
+{
+  return CustomAllocHandler<typename std::decay<HandlerTy>::type>(
+    memory, std::forward<HandlerTy>(handler)
+  );
+}
+
+}
+
+#endif
\ No newline at end of file
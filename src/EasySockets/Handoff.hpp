@@ -0,0 +1,370 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+
+#ifndef _EASYSOCKETS_HANDOFF_HPP_
+#define _EASYSOCKETS_HANDOFF_HPP_
+
+#include "EasySockets.hpp"
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace es {
+
+/**
+ * A connection being handed over to another process: its socket and the
+ * bytes it had received that were not part of a delivered frame yet.
+ * */
+struct HandoffConnection {
+  int descriptor;
+  std::string buffered;
+};
+
+/**
+ * Listening socket, and optionally live connections, handed over by a
+ * server in a process being replaced (see BasicTCPServer::listen_for_handoff)
+ * to its successor, over a local socket.
+ * 
+ * The successor calls receive(), passes the handoff to the server's
+ * adopting constructor, which acknowledges it; the old process only
+ * lets go of the sockets once acknowledged, and takes them back if the
+ * successor fails before that. Descriptors that are never adopted are
+ * closed along with the handoff.
+ * 
+ * On the wire, a handoff is a 16 byte header (magic, number of
+ * connections, total size) followed by each connection's buffered
+ * bytes, prefixed by their size. The descriptors, listener first, ride
+ * along with the first bytes in batches the kernel accepts.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class Handoff {
+protected:
+  static constexpr uint32_t _magic = 0x4553484F;
+  static constexpr std::size_t _max_descriptors_per_message = 250;
+  static constexpr char _acknowledgement = 'A';
+
+  int _socket;
+
+  static void _put(
+    std::string& bytes,
+    uint64_t value,
+    std::size_t nbytes)
+  {
+    bytes.append(reinterpret_cast<const char*>(&value), nbytes);
+  }
+
+  static uint64_t _get(
+    const std::string& bytes,
+    std::size_t offset,
+    std::size_t nbytes)
+  {
+    uint64_t value = 0;
+    std::memcpy(&value, bytes.data() + offset, nbytes);
+    return value;
+  }
+
+  /**
+   * Reads from the local socket until the passed buffer holds the passed
+   * number of bytes, appending any descriptors received to the passed
+   * list.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool _receive_until(
+    std::string& bytes,
+    std::size_t nbytes,
+    std::vector<int>& descriptors,
+    boost::system::error_code& error)
+  {
+    union {
+      cmsghdr header;
+      char bytes[CMSG_SPACE(sizeof(int) * 253)];
+    } control;
+
+    while (bytes.size() < nbytes) {
+      char chunk[64 * 1024];
+      iovec vector { chunk, std::min(sizeof(chunk), nbytes - bytes.size()) };
+      msghdr message {};
+      int flags = 0;
+
+#if defined(MSG_CMSG_CLOEXEC)
+      flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+      message.msg_iov = &vector;
+      message.msg_iovlen = 1;
+      message.msg_control = control.bytes;
+      message.msg_controllen = sizeof(control.bytes);
+
+      ssize_t result = ::recvmsg(_socket, &message, flags);
+
+      if (result < 0 && errno == EINTR) {
+        continue;
+      }
+
+      for (cmsghdr* header = CMSG_FIRSTHDR(&message); result >= 0 && header; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+          std::size_t ndescriptors = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+          for (std::size_t i = 0; i < ndescriptors; i++) {
+            int descriptor;
+            std::memcpy(&descriptor, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            descriptors.push_back(descriptor);
+          }
+        }
+      }
+
+      if (result <= 0) {
+        error = result ? boost::system::error_code(errno, boost::system::system_category()) : boost::asio::error::eof;
+        return false;
+      }
+
+      bytes.append(chunk, result);
+    }
+
+    return true;
+  }
+public:
+  int listener;
+  std::vector<HandoffConnection> connections;
+
+  Handoff()
+    : _socket(-1),
+      listener(-1)
+  {}
+
+  Handoff(const Handoff&) = delete;
+  Handoff& operator = (const Handoff&) = delete;
+
+  ~Handoff()
+  {
+    if (listener >= 0) {
+      ::close(listener);
+    }
+
+    for (HandoffConnection& connection : connections) {
+      if (connection.descriptor >= 0) {
+        ::close(connection.descriptor);
+      }
+    }
+
+    if (_socket >= 0) {
+      ::close(_socket);
+    }
+  }
+
+  /**
+   * Connects to the server being replaced and receives its sockets. Fails
+   * with connection_refused or not_found if no server waits for a
+   * successor at the passed path, in which case the caller usually binds
+   * a new listening socket instead.
+   * 
+   * @param path The handoff path passed to listen_for_handoff(), or '@' followed by an abstract name.
+   * @param error Set on failure.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool receive(
+    const std::string& path,
+    boost::system::error_code& error)
+  {
+    boost::asio::local::stream_protocol::endpoint endpoint = es::local_endpoint_of(path);
+
+    _socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (_socket < 0 || ::connect(_socket, endpoint.data(), static_cast<socklen_t>(endpoint.size())) < 0) {
+      error = boost::system::error_code(errno, boost::system::system_category());
+      return false;
+    }
+
+    std::string bytes;
+    std::vector<int> descriptors;
+
+    bool is_received = _receive_until(bytes, 16, descriptors, error)
+      && _get(bytes, 0, 4) == _magic
+      && _receive_until(bytes, _get(bytes, 8, 8), descriptors, error);
+
+    std::size_t nconnections = bytes.size() >= 16 ? _get(bytes, 4, 4) : 0;
+
+    if (is_received && descriptors.size() != nconnections + 1) {
+      error = boost::asio::error::invalid_argument;
+      is_received = false;
+    } else if (!is_received && !error) {
+      error = boost::asio::error::invalid_argument;
+    }
+
+    if (!is_received) {
+      for (int descriptor : descriptors) {
+        ::close(descriptor);
+      }
+      return false;
+    }
+
+    std::size_t offset = 16;
+
+    listener = descriptors[0];
+
+    for (std::size_t i = 0; i < nconnections; i++) {
+      std::size_t nbytes = _get(bytes, offset, 4);
+
+      connections.push_back(HandoffConnection { descriptors[i + 1], bytes.substr(offset + 4, nbytes) });
+      offset += 4 + nbytes;
+    }
+
+    return true;
+  }
+
+  /**
+   * Tells the old process its sockets have been adopted, so it can let
+   * go of them.
+   * 
+   * @param error Set on failure.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool acknowledge(
+    boost::system::error_code& error)
+  {
+    ssize_t result;
+
+    do {
+      result = ::send(_socket, &_acknowledgement, 1, MSG_NOSIGNAL);
+    } while (result < 0 && errno == EINTR);
+
+    if (result != 1) {
+      error = boost::system::error_code(errno, boost::system::system_category());
+      return false;
+    }
+
+    return true;
+  }
+
+  /**
+   * Sends the passed listening socket and connections to the successor
+   * connected to the passed local socket, blocking until done.
+   * 
+   * @param socket The connected local socket, in blocking mode.
+   * @param listener The listening socket.
+   * @param connections The connections.
+   * @param error Set on failure.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static bool send(
+    int socket,
+    int listener,
+    const std::vector<HandoffConnection>& connections,
+    boost::system::error_code& error)
+  {
+    std::string bytes;
+    std::vector<int> descriptors { listener };
+
+    _put(bytes, _magic, 4);
+    _put(bytes, connections.size(), 4);
+    _put(bytes, 0, 8);
+
+    for (const HandoffConnection& connection : connections) {
+      descriptors.push_back(connection.descriptor);
+      _put(bytes, connection.buffered.size(), 4);
+      bytes.append(connection.buffered);
+    }
+
+    uint64_t nbytes = bytes.size();
+    std::memcpy(&bytes[8], &nbytes, 8);
+
+    std::size_t nsent = 0;
+    std::size_t nbatches = (descriptors.size() + _max_descriptors_per_message - 1) / _max_descriptors_per_message;
+
+    for (std::size_t batch = 0; nsent < bytes.size(); batch++) {
+      std::size_t first = batch * _max_descriptors_per_message;
+      std::size_t ndescriptors = batch < nbatches ? std::min(_max_descriptors_per_message, descriptors.size() - first) : 0;
+      std::vector<char> control(ndescriptors ? CMSG_SPACE(sizeof(int) * ndescriptors) : 0);
+
+      // Every batch of descriptors but the last rides on a single byte.
+      iovec vector { &bytes[nsent], batch + 1 < nbatches ? 1 : bytes.size() - nsent };
+      msghdr message {};
+
+      message.msg_iov = &vector;
+      message.msg_iovlen = 1;
+
+      if (ndescriptors) {
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * ndescriptors);
+        std::memcpy(CMSG_DATA(header), &descriptors[first], sizeof(int) * ndescriptors);
+      }
+
+      ssize_t result;
+
+      do {
+        result = ::sendmsg(socket, &message, MSG_NOSIGNAL);
+      } while (result < 0 && errno == EINTR);
+
+      if (result <= 0) {
+        error = boost::system::error_code(errno, boost::system::system_category());
+        return false;
+      }
+
+      nsent += result;
+    }
+
+    return true;
+  }
+
+  /**
+   * Returns true if the passed byte is the successor's acknowledgement.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static bool is_acknowledgement(
+    char byte)
+  {
+    return byte == _acknowledgement;
+  }
+};
+
+}
+
+#endif
+
+#endif
\ No newline at end of file
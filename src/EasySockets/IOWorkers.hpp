@@ -0,0 +1,364 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+#ifndef _EASYSOCKETS_IOWORKERS_HPP_
+#define _EASYSOCKETS_IOWORKERS_HPP_
+
+#include "EasySockets.hpp"
+#include "Event.hpp"
+#include "SocketOptions.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace es {
+
+/**
+ * Runs one server per io thread, each thread pinned to its own core.
+ * Every worker constructs its server on its own thread after pinning
+ * it, with memory allocations preferring the core's NUMA node, so the
+ * server's event queue, buffers and connection table are allocated on
+ * the node that uses them. TCP servers share the port through
+ * SO_REUSEPORT, and each listener is marked with SO_INCOMING_CPU so the
+ * kernel hands every connection to the worker on the CPU that received
+ * it.
+ * 
+ * Events are handled on the worker's own thread.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <class ServerTy>
+class IOWorkers {
+public:
+  /**
+   * Placement of a worker, as passed to the server factory.
+   * */
+  struct Placement {
+    std::size_t index;
+    int cpu;
+    int numa_node;
+    SocketOptions socket_options;
+  };
+
+  typedef std::function<std::unique_ptr<ServerTy>(const Placement&)> Factory;
+  typedef std::function<void(ServerTy&, EventP)> Handler;
+protected:
+  struct _Worker {
+    Placement placement;
+    std::thread thread;
+    std::unique_ptr<ServerTy> server;
+    std::atomic<bool> is_stopping;
+
+    _Worker() : is_stopping(false) {}
+  };
+
+  std::vector<int> _cpus;
+  SocketOptions _socket_options;
+  std::vector<std::unique_ptr<_Worker>> _workers;
+
+  /**
+   * Body of a worker thread: pins itself, builds its server, then keeps
+   * updating it and handing its events to the passed handler until the
+   * server has stopped.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static void _run(
+    _Worker& worker,
+    const Factory& factory,
+    const Handler& handler,
+    std::promise<void>& ready)
+  {
+    try {
+      pin_current_thread(worker.placement.cpu);
+      prefer_numa_node(worker.placement.numa_node);
+      worker.server = factory(worker.placement);
+    } catch (...) {
+      ready.set_exception(std::current_exception());
+      return;
+    }
+
+    ready.set_value();
+
+    ServerTy& server = *worker.server;
+
+    while (!worker.is_stopping || !server.is_stopped()) {
+      server.update();
+
+      while (EventP event = server.poll()) {
+        handler(server, std::move(event));
+      }
+    }
+  }
+public:
+  /**
+   * 
+   * @param cpus The CPU of each worker; one worker is started per entry.
+   * @param socket_options The options of each worker's server, which get reuse_port and incoming_cpu set.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  explicit IOWorkers(
+    std::vector<int> cpus,
+    const SocketOptions& socket_options = SocketOptions())
+    : _cpus(std::move(cpus)),
+      _socket_options(socket_options)
+  {}
+
+  /**
+   * Same as above, with one worker per online CPU.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  IOWorkers()
+    : IOWorkers(std::vector<int>())
+  {
+    for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) {
+      _cpus.push_back(static_cast<int>(cpu));
+    }
+  }
+
+  ~IOWorkers()
+  {
+    stop(std::chrono::milliseconds(0));
+  }
+
+  IOWorkers(const IOWorkers&) = delete;
+  IOWorkers& operator = (const IOWorkers&) = delete;
+
+  /**
+   * Pins the calling thread to the passed CPU. Returns false if that is
+   * not possible.
+   * 
+   * @param cpu The CPU, or -1 to leave the thread where it is.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static bool pin_current_thread(
+    int cpu)
+  {
+#if defined(__linux__)
+    if (cpu < 0) {
+      return false;
+    }
+
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return !pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * Makes memory the calling thread touches first come from the passed
+   * NUMA node when it has any free. Returns false if that is not
+   * possible.
+   * 
+   * @param node The NUMA node, or -1 for the system's default policy.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static bool prefer_numa_node(
+    int node)
+  {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    if (node < 0 || node >= static_cast<int>(sizeof(unsigned long) * 8)) {
+      return false;
+    }
+
+    unsigned long mask = 1ul << node;
+
+    return !::syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8);
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * Returns the NUMA node the passed CPU belongs to, or -1 if unknown.
+   * 
+   * @param cpu The CPU.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static int numa_node_of(
+    int cpu)
+  {
+#if defined(__linux__)
+    for (int node = 0; node < 64; node++) {
+      std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/node" + std::to_string(node) + "/cpulist");
+
+      if (file) {
+        return node;
+      }
+    }
+#endif
+
+    return -1;
+  }
+
+  /**
+   * Starts every worker, each building its server through the passed
+   * factory. Returns once all servers have been built; if any factory
+   * throws, the workers already started are stopped and the exception
+   * is rethrown.
+   * 
+   * @param factory Builds a worker's server from its placement.
+   * @param handler Called on the worker's thread for each of its server's events.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void start(
+    Factory factory,
+    Handler handler)
+  {
+    std::vector<std::promise<void>> ready(_cpus.size());
+    std::shared_ptr<Factory> shared_factory = std::make_shared<Factory>(std::move(factory));
+    std::shared_ptr<Handler> shared_handler = std::make_shared<Handler>(std::move(handler));
+
+    for (std::size_t i = 0; i < _cpus.size(); i++) {
+      std::unique_ptr<_Worker> worker(new _Worker());
+      _Worker& target = *worker;
+
+      target.placement.index = i;
+      target.placement.cpu = _cpus[i];
+      target.placement.numa_node = numa_node_of(_cpus[i]);
+      target.placement.socket_options = _socket_options;
+      target.placement.socket_options.reuse_port = true;
+      target.placement.socket_options.incoming_cpu = _cpus[i];
+
+      std::promise<void>& promise = ready[i];
+
+      target.thread = std::thread([&target, shared_factory, shared_handler, &promise]() {
+        _run(target, *shared_factory, *shared_handler, promise);
+      });
+
+      _workers.push_back(std::move(worker));
+    }
+
+    for (std::size_t i = 0; i < ready.size(); i++) {
+      try {
+        ready[i].get_future().get();
+      } catch (...) {
+        for (std::size_t j = i + 1; j < ready.size(); j++) {
+          ready[j].get_future().wait();
+        }
+
+        stop(std::chrono::milliseconds(0));
+        throw;
+      }
+    }
+  }
+
+  /**
+   * Stops every worker's server as described by its stop() and waits for
+   * the worker threads to exit.
+   * 
+   * @param drain_timeout How long connections get to close on their own.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void stop(
+    std::chrono::milliseconds drain_timeout)
+  {
+    for (std::unique_ptr<_Worker>& worker : _workers) {
+      if (worker->server) {
+        ServerTy* server = worker->server.get();
+        _Worker* target = worker.get();
+
+        server->io_service()->post([server, target, drain_timeout]() {
+          server->stop(drain_timeout);
+          target->is_stopping = true;
+        });
+      }
+    }
+
+    for (std::unique_ptr<_Worker>& worker : _workers) {
+      if (worker->thread.joinable()) {
+        worker->thread.join();
+      }
+    }
+
+    _workers.clear();
+  }
+
+  /**
+   * Returns the number of workers.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::size_t size() const {
+    return _workers.size();
+  }
+
+  /**
+   * Returns the placement of the worker at the passed index.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  const Placement& placement(
+    std::size_t index) const
+  {
+    return _workers[index]->placement;
+  }
+
+  /**
+   * Returns the server of the worker at the passed index. It must only
+   * be used from that worker's thread, e.g. through its io_service.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  ServerTy& server(
+    std::size_t index)
+  {
+    return *_workers[index]->server;
+  }
+};
+
+}
+
+#endif
\ No newline at end of file
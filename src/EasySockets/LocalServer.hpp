@@ -0,0 +1,297 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+
+#ifndef _EASYSOCKETS_LOCALSERVER_HPP_
+#define _EASYSOCKETS_LOCALSERVER_HPP_
+
+#include "Server.hpp"
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+#include <vector>
+
+namespace es {
+
+/**
+ * Server listening on a Unix domain stream socket, for peers on the same
+ * host. It queues the same events and supports the same read modes as
+ * the TCP server, without the cost of the TCP loopback stack. A path
+ * starting with '@' names a socket in Linux's abstract namespace, which
+ * has no file and disappears with its last reference.
+ * 
+ * Descriptors (files, sockets, memfds...) can be passed along with the
+ * bytes sent on a connection, and descriptors sent by the peer are
+ * queued on the connection until taken.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <
+  class CodecTy = RawCodec,
+  class PoliciesTy = RuntimePolicies,
+  class LoggerTy = Logger>
+class BasicLocalServer : public Server<boost::asio::local::stream_protocol, LoggerTy, CodecTy, PoliciesTy> {
+public:
+  typedef std::shared_ptr<BasicLocalServer> Pointer;
+  typedef Server<boost::asio::local::stream_protocol, LoggerTy, CodecTy, PoliciesTy> Base;
+  typedef typename Base::ConnectionTy ConnectionTy;
+  typedef typename Base::ConnectionP ConnectionP;
+  typedef typename Base::Transfer Transfer;
+protected:
+  using Base::_accept_backoff;
+  using Base::_accept_timer;
+  using Base::_begin_read;
+  using Base::_connections;
+  using Base::_handle_accept_error;
+  using Base::_handle_error;
+  using Base::_insert;
+  using Base::_is_auto_read;
+  using Base::_executor;
+  using Base::_protocol;
+  using Base::_queue_send;
+private:
+  bool __is_started;
+protected:
+  std::string _path;
+  boost::asio::local::stream_protocol::acceptor _acceptor;
+  HandlerMemory _accept_memory;
+
+  /**
+   * Starts waiting for the next incoming connection. The connection only
+   * gets a handle once it has been accepted, so ACCEPT_BEGIN events carry
+   * NULL_HANDLE.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _begin_accept() {
+    ConnectionP connection = std::make_shared<ConnectionTy>(_executor);
+    typename ConnectionTy::Socket& socket = connection->socket;
+
+    this->template _push_begin_event<Event>(
+      es::NULL_HANDLE, es::ACCEPT_BEGIN, _protocol
+    );
+
+    _acceptor.async_accept(socket,
+      es::make_custom_alloc_handler(_accept_memory,
+        [this, connection = std::move(connection)](
+          boost::system::error_code error) mutable
+        {
+          _handle_accept(std::move(connection), error);
+        }
+      )
+    );
+  }
+
+  /**
+   * Registers the accepted connection, or reports the failure and tries
+   * again as described by Server::_handle_accept_error().
+   * 
+   * @param connection The accepted connection.
+   * @param error The accept error, if any.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _handle_accept(
+    ConnectionP connection,
+    boost::system::error_code error)
+  {
+    if (error) {
+      _handle_accept_error(Error(es::ERROR_ACCEPT, error), [this]() { _begin_accept(); });
+      return;
+    }
+
+    _accept_backoff = boost::posix_time::time_duration();
+
+    if (!_insert(connection)) {
+      _begin_accept();
+      return;
+    }
+
+    this->template _push_event<Event>(
+      connection->handle, es::ACCEPT_HANDLE, _protocol
+    );
+
+    if (_is_auto_read()) {
+      _begin_read(std::move(connection));
+    }
+
+    _begin_accept();
+  }
+public:
+  /**
+   * Binds to the passed path. A socket file left behind at the path by a
+   * previous run is removed first; anything else there is left alone, and
+   * binding then fails.
+   * 
+   * @param path The socket path, or '@' followed by an abstract name.
+   * @param options The socket options of every accepted connection. TCP specific options must be left unset.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  explicit BasicLocalServer(
+    const std::string& path,
+    const SocketOptions& options = SocketOptions())
+  : Base(es::LOCAL, path, 0),
+    __is_started(false),
+    _path(path),
+    _acceptor(_executor)
+  {
+    boost::system::error_code error;
+
+    es::remove_socket_file(path);
+
+    this->_socket_options = options;
+    _acceptor.open(boost::asio::local::stream_protocol(), error);
+
+    if (!error) {
+      _acceptor.bind(es::local_endpoint_of(path), error);
+    }
+
+    if (!error) {
+      _acceptor.listen(options.listen_backlog, error);
+    }
+
+    if (error) {
+      _handle_error(es::NULL_HANDLE, Error(es::ERROR_ACCEPT, error));
+    }
+  }
+
+  /**
+   * Returns the path the server is bound to.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  const std::string& path() const {
+    return _path;
+  }
+
+  /**
+   * Same as sendb(), passing the passed descriptors to the peer along
+   * with the payload, which must not be empty. The descriptors are
+   * duplicated into the peer; the caller keeps its own and may close
+   * them once the SEND_HANDLE event arrives.
+   * 
+   * @param handle The handle of the connection.
+   * @param descriptors The descriptors to pass.
+   * @param payload The bytes to send along with them.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t sendfds(
+    ConnectionHandle handle,
+    std::vector<int> descriptors,
+    StreamBufferP payload)
+  {
+    uint64_t event_id = es::make_uid();
+    Transfer transfer;
+
+    transfer.id = event_id;
+    transfer.payload = std::move(payload);
+    transfer.descriptors = std::move(descriptors);
+
+    this->template _push_begin_event<SendEvent>(
+      event_id, 0, handle, es::SEND_BEGIN, _protocol
+    );
+
+    _queue_send(handle, std::move(transfer));
+
+    return event_id;
+  }
+
+  /**
+   * Returns the descriptors received on the passed connection so far,
+   * in the order they arrived, and hands their ownership to the caller.
+   * Descriptors arrive with the bytes they were sent with, so they have
+   * been received by the time the READ_HANDLE event of the frame holding
+   * those bytes is polled. Descriptors never taken are closed along with
+   * the connection.
+   * 
+   * @param handle The handle of the connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::vector<int> take_descriptors(
+    ConnectionHandle handle)
+  {
+    std::vector<int> descriptors;
+
+    if (const ConnectionP& connection = _connections.find(handle)) {
+      descriptors.assign(connection->descriptors.begin(), connection->descriptors.end());
+      connection->descriptors.clear();
+    }
+
+    return descriptors;
+  }
+
+  /**
+   * 
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  UpdateResult update()
+  {
+    if (!__is_started) {
+      _begin_accept();
+      __is_started = true;
+    }
+
+    return Base::update();
+  }
+
+  /**
+   * Stops accepting new connections and removes the socket file, then
+   * drains and closes the open connections as described by
+   * Server::stop().
+   * 
+   * @param drain_timeout How long to wait for connections to close on their own.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void stop(
+    std::chrono::milliseconds drain_timeout)
+  {
+    boost::system::error_code ignored;
+
+    _acceptor.close(ignored);
+    _accept_timer.cancel(ignored);
+    __is_started = true;
+
+    es::remove_socket_file(_path);
+
+    Base::stop(drain_timeout);
+  }
+};
+
+typedef BasicLocalServer<> LocalServer;
+
+}
+
+#endif
+
+#endif
\ No newline at end of file
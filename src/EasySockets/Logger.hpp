@@ -49,6 +49,20 @@ public:
   }
 };
 
+/**
+ * Logging policy of servers that log nothing. Unlike Logger it holds no
+ * stream and its log() is not virtual, so calls to it compile away.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class NullLogger {
+public:
+  void log(
+    const std::string&,
+    const std::chrono::system_clock::time_point&)
+  {}
+};
+
 }
 
 #endif
\ No newline at end of file
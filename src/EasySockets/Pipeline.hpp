@@ -0,0 +1,684 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+
+#ifndef _EASYSOCKETS_PIPELINE_HPP_
+#define _EASYSOCKETS_PIPELINE_HPP_
+
+#include "Event.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace es {
+
+/**
+ * Id tying a response to the request it answers. Zero is never used.
+ * */
+typedef uint64_t CorrelationId;
+
+/**
+ * Flat, open-addressed table of values keyed by correlation id. Slots
+ * live in a single power of two sized array probed linearly, and erasing
+ * shifts the following entries back instead of leaving tombstones, so
+ * lookups never scan further than the entries that collided. The table
+ * grows once half full.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <class ValueTy>
+class InFlightTable {
+protected:
+  struct _Slot {
+    CorrelationId id;
+    ValueTy value;
+  };
+
+  std::vector<_Slot> _slots;
+  std::size_t _size;
+  unsigned _shift;
+
+  std::size_t _home_of(
+    CorrelationId id) const
+  {
+    return static_cast<std::size_t>((id * 0x9E3779B97F4A7C15ull) >> _shift);
+  }
+
+  std::size_t _index_of(
+    CorrelationId id) const
+  {
+    std::size_t mask = _slots.size() - 1;
+
+    for (std::size_t i = _home_of(id); ; i = (i + 1) & mask) {
+      if (_slots[i].id == id || !_slots[i].id) {
+        return i;
+      }
+    }
+  }
+
+  void _grow()
+  {
+    std::vector<_Slot> slots(_slots.size() * 2);
+
+    slots.swap(_slots);
+    _shift--;
+
+    for (_Slot& slot : slots) {
+      if (slot.id) {
+        _slots[_index_of(slot.id)] = std::move(slot);
+      }
+    }
+  }
+public:
+  /**
+   * 
+   * @param nslots The initial number of slots. Rounded up to a power of two.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  explicit InFlightTable(
+    std::size_t nslots = 64)
+    : _size(0),
+      _shift(64)
+  {
+    std::size_t n = 2;
+
+    while (n < nslots) {
+      n *= 2;
+    }
+
+    _slots.resize(n);
+
+    while (n > 1) {
+      n /= 2;
+      _shift--;
+    }
+  }
+
+  /**
+   * Returns the value stored for the passed id, or null if there is none.
+   * 
+   * @param id The correlation id.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  ValueTy* find(
+    CorrelationId id)
+  {
+    _Slot& slot = _slots[_index_of(id)];
+    return slot.id ? &slot.value : nullptr;
+  }
+
+  /**
+   * Stores the passed value for the passed id, replacing any value
+   * already stored for it.
+   * 
+   * @param id The correlation id. Must not be zero.
+   * @param value The value.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void insert(
+    CorrelationId id,
+    ValueTy value)
+  {
+    if ((_size + 1) * 2 > _slots.size()) {
+      _grow();
+    }
+
+    _Slot& slot = _slots[_index_of(id)];
+
+    if (!slot.id) {
+      slot.id = id;
+      _size++;
+    }
+
+    slot.value = std::move(value);
+  }
+
+  /**
+   * Moves the value stored for the passed id out of the table. Returns
+   * false if there is none.
+   * 
+   * @param id The correlation id.
+   * @param value Set to the value.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool take(
+    CorrelationId id,
+    ValueTy& value)
+  {
+    std::size_t mask = _slots.size() - 1;
+    std::size_t i = _index_of(id);
+
+    if (!_slots[i].id) {
+      return false;
+    }
+
+    value = std::move(_slots[i].value);
+
+    // Shift back every following entry that would otherwise no longer be
+    // reachable from its home slot.
+    for (std::size_t j = (i + 1) & mask; _slots[j].id; j = (j + 1) & mask) {
+      std::size_t home = _home_of(_slots[j].id);
+
+      if (((j - home) & mask) >= ((j - i) & mask)) {
+        _slots[i] = std::move(_slots[j]);
+        i = j;
+      }
+    }
+
+    _slots[i].id = 0;
+    _slots[i].value = ValueTy();
+    _size--;
+
+    return true;
+  }
+
+  /**
+   * Calls the passed function with the id and value of every entry. The
+   * table must not be changed meanwhile.
+   * 
+   * @param fn The function.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class FnTy>
+  void for_each(
+    FnTy&& fn)
+  {
+    for (_Slot& slot : _slots) {
+      if (slot.id) {
+        fn(slot.id, slot.value);
+      }
+    }
+  }
+
+  std::size_t size() const {
+    return _size;
+  }
+};
+
+/**
+ * Request/response layer on top of a server or client whose connections
+ * carry correlated records. Requests get a correlation id, at most a set
+ * number of them are in flight per connection at once and the others
+ * wait their turn, and each response completes the callback or future
+ * of the request it answers. On the other side, requests are handed to
+ * a request handler that answers them with respond(), in any order.
+ * 
+ * The pipeline sees the endpoint's events through handle(), so it runs
+ * wherever they are polled or handled: on the io thread when they come
+ * from update() or an event handler. Callbacks run there too, so waiting
+ * on a future from that thread never completes.
+ * 
+ * Records are a 12 byte header followed by the payload. The header is
+ * the payload's size, with the top bit set for responses, and the
+ * correlation id, both big-endian. The pipeline switches the endpoint to
+ * READ_AVAILABLE, since records carry their own size.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <class EndpointTy>
+class Pipeline {
+  static_assert(
+    !EndpointTy::ReadPolicy::is_fixed || EndpointTy::ReadPolicy::mode == es::READ_AVAILABLE,
+    "Pipeline reads with READ_AVAILABLE"
+  );
+public:
+  typedef std::function<void(const boost::system::error_code&, StreamBufferP)> Callback;
+  typedef std::function<void(ConnectionHandle, CorrelationId, StreamBufferP)> RequestHandler;
+protected:
+  static constexpr uint32_t _response_bit = 0x80000000;
+  static constexpr std::size_t _header_nbytes = 12;
+
+  struct _Request {
+    ConnectionHandle connection;
+    Callback callback;
+  };
+
+  struct _Waiting {
+    CorrelationId id;
+    StreamBufferP record;
+  };
+
+  struct _State {
+    ConnectionHandle handle = es::NULL_HANDLE;
+    StreamBuffer received;
+    std::size_t nin_flight = 0;
+    std::deque<_Waiting> waiting;
+  };
+
+  EndpointTy& _endpoint;
+  std::size_t _max_in_flight;
+  std::size_t _max_message_nbytes;
+  CorrelationId _next_id;
+  InFlightTable<_Request> _in_flight;
+  std::vector<std::unique_ptr<_State>> _states;
+  RequestHandler _request_handler;
+
+  /**
+   * Returns the state of the passed connection, creating it if needed.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  _State& _state_of(
+    ConnectionHandle handle)
+  {
+    if (_states.size() <= es::slot_of(handle)) {
+      _states.resize(es::slot_of(handle) + 1);
+    }
+
+    std::unique_ptr<_State>& state = _states[es::slot_of(handle)];
+
+    // The slot may still hold the state of a closed connection whose
+    // CLOSE_HANDLE was never passed to handle().
+    if (!state || state->handle != handle) {
+      state.reset(new _State());
+      state->handle = handle;
+    }
+
+    return *state;
+  }
+
+  /**
+   * Returns the state of the passed connection, or null if it has none.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  _State* _find_state(
+    ConnectionHandle handle)
+  {
+    if (handle == es::NULL_HANDLE || es::slot_of(handle) >= _states.size()) {
+      return nullptr;
+    }
+
+    _State* state = _states[es::slot_of(handle)].get();
+
+    return state && state->handle == handle ? state : nullptr;
+  }
+
+  /**
+   * Returns a record with the passed header fields and payload.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static StreamBufferP _encode(
+    uint32_t nbytes_and_type,
+    CorrelationId id,
+    boost::asio::const_buffer payload)
+  {
+    StreamBufferP record = std::make_shared<StreamBuffer>();
+    unsigned char* header = static_cast<unsigned char*>(record->prepare(_header_nbytes + payload.size()).data());
+
+    for (int i = 0; i < 4; i++) {
+      header[i] = static_cast<unsigned char>(nbytes_and_type >> (24 - i * 8));
+    }
+
+    for (int i = 0; i < 8; i++) {
+      header[4 + i] = static_cast<unsigned char>(id >> (56 - i * 8));
+    }
+
+    std::memcpy(header + _header_nbytes, payload.data(), payload.size());
+    record->commit(_header_nbytes + payload.size());
+
+    return record;
+  }
+
+  /**
+   * Sends the requests waiting on the passed connection until it has as
+   * many in flight as allowed.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _send_waiting(
+    ConnectionHandle handle,
+    _State& state)
+  {
+    while (!state.waiting.empty() && state.nin_flight < _max_in_flight) {
+      _Waiting waiting = std::move(state.waiting.front());
+
+      state.waiting.pop_front();
+
+      if (_in_flight.find(waiting.id)) {
+        state.nin_flight++;
+        _endpoint.sendb(handle, std::move(waiting.record));
+      }
+    }
+  }
+
+  /**
+   * Parses the complete records buffered for the passed connection. A
+   * record too large closes the connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _parse(
+    ConnectionHandle handle,
+    _State& state)
+  {
+    while (state.received.size() >= _header_nbytes) {
+      unsigned char header[_header_nbytes];
+      uint32_t nbytes_and_type = 0;
+      CorrelationId id = 0;
+
+      boost::asio::buffer_copy(boost::asio::buffer(header), state.received.data());
+
+      for (int i = 0; i < 4; i++) {
+        nbytes_and_type = (nbytes_and_type << 8) | header[i];
+      }
+
+      for (int i = 0; i < 8; i++) {
+        id = (id << 8) | header[4 + i];
+      }
+
+      std::size_t nbytes = nbytes_and_type & ~_response_bit;
+
+      if (nbytes > _max_message_nbytes) {
+        _endpoint.close(handle);
+        return;
+      }
+
+      if (state.received.size() < _header_nbytes + nbytes) {
+        return;
+      }
+
+      StreamBufferP payload = std::make_shared<StreamBuffer>();
+
+      state.received.consume(_header_nbytes);
+      payload->commit(boost::asio::buffer_copy(payload->prepare(nbytes), state.received.data(), nbytes));
+      state.received.consume(nbytes);
+
+      if (nbytes_and_type & _response_bit) {
+        _Request* found = _in_flight.find(id);
+        _Request request;
+
+        // Responses to requests the pipeline no longer knows of, e.g.
+        // cancelled ones, are dropped.
+        if (found && found->connection == handle && _in_flight.take(id, request)) {
+          state.nin_flight--;
+          request.callback(boost::system::error_code(), std::move(payload));
+          _send_waiting(handle, state);
+        }
+      } else if (_request_handler) {
+        _request_handler(handle, id, std::move(payload));
+      }
+    }
+  }
+
+  /**
+   * Fails every request of the passed connection and forgets its state.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _fail_all(
+    ConnectionHandle handle)
+  {
+    std::vector<CorrelationId> ids;
+
+    _in_flight.for_each([handle, &ids](CorrelationId id, _Request& request) {
+      if (request.connection == handle) {
+        ids.push_back(id);
+      }
+    });
+
+    if (_find_state(handle)) {
+      _states[es::slot_of(handle)].reset();
+    }
+
+    for (CorrelationId id : ids) {
+      _Request request;
+
+      if (_in_flight.take(id, request)) {
+        request.callback(boost::asio::error::connection_aborted, StreamBufferP());
+      }
+    }
+  }
+
+  void _use_read_available(
+    std::false_type)
+  {
+    _endpoint.set_read_mode(es::READ_AVAILABLE);
+  }
+
+  void _use_read_available(
+    std::true_type)
+  {}
+public:
+  /**
+   * 
+   * @param endpoint The server or client whose connections carry the records.
+   * @param max_in_flight How many requests may await a response on a connection at once.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  explicit Pipeline(
+    EndpointTy& endpoint,
+    std::size_t max_in_flight = 64)
+    : _endpoint(endpoint),
+      _max_in_flight(max_in_flight ? max_in_flight : 1),
+      _max_message_nbytes(16 * 1024 * 1024),
+      _next_id(1)
+  {
+    _use_read_available(std::integral_constant<bool, EndpointTy::ReadPolicy::is_fixed>());
+  }
+
+  /**
+   * Consumes the passed event if it belongs to the pipeline, returning
+   * true if so. READ_HANDLE events are consumed; CLOSE_HANDLE events
+   * fail the connection's outstanding requests with connection_aborted
+   * but are left for the caller as well.
+   * 
+   * @param event The event.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool handle(
+    const EventP& event)
+  {
+    if (event->type == es::CLOSE_HANDLE) {
+      _fail_all(event->connection);
+      return false;
+    }
+
+    if (event->type != es::READ_HANDLE || event->connection == es::NULL_HANDLE) {
+      return false;
+    }
+
+    const StreamBufferP& frame = static_cast<const ReadEvent&>(*event).buffer;
+    _State& state = _state_of(event->connection);
+
+    if (frame) {
+      state.received.commit(boost::asio::buffer_copy(state.received.prepare(frame->size()), frame->data()));
+      _parse(event->connection, state);
+    }
+
+    return true;
+  }
+
+  /**
+   * Sends a request on the passed connection, or queues it if the
+   * connection already has as many requests in flight as allowed.
+   * Returns its correlation id, or zero without calling the callback if
+   * there is no such connection.
+   * 
+   * @param handle The handle of the connection.
+   * @param payload The request.
+   * @param callback Called with the response, or with connection_aborted if the connection closes first.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  CorrelationId request(
+    ConnectionHandle handle,
+    boost::asio::const_buffer payload,
+    Callback callback)
+  {
+    if (handle == es::NULL_HANDLE || !_endpoint.connection(handle)) {
+      return 0;
+    }
+
+    CorrelationId id = _next_id++;
+    _State& state = _state_of(handle);
+
+    _in_flight.insert(id, _Request { handle, std::move(callback) });
+    state.waiting.push_back(_Waiting { id, _encode(static_cast<uint32_t>(payload.size()), id, payload) });
+    _send_waiting(handle, state);
+
+    return id;
+  }
+
+  /**
+   * Same as above, returning a future of the response instead. The future
+   * holds a boost::system::system_error if the request fails.
+   * 
+   * @param handle The handle of the connection.
+   * @param payload The request.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::future<StreamBufferP> request(
+    ConnectionHandle handle,
+    boost::asio::const_buffer payload)
+  {
+    std::shared_ptr<std::promise<StreamBufferP>> promise = std::make_shared<std::promise<StreamBufferP>>();
+    std::future<StreamBufferP> future = promise->get_future();
+
+    CorrelationId id = request(handle, payload,
+      [promise](const boost::system::error_code& error, StreamBufferP response) {
+        if (error) {
+          promise->set_exception(std::make_exception_ptr(boost::system::system_error(error)));
+        } else {
+          promise->set_value(std::move(response));
+        }
+      }
+    );
+
+    if (!id) {
+      promise->set_exception(std::make_exception_ptr(boost::system::system_error(boost::asio::error::not_connected)));
+    }
+
+    return future;
+  }
+
+  /**
+   * Answers the request with the passed correlation id, received on the
+   * passed connection.
+   * 
+   * @param handle The handle of the connection.
+   * @param id The correlation id the request handler was given.
+   * @param payload The response.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t respond(
+    ConnectionHandle handle,
+    CorrelationId id,
+    boost::asio::const_buffer payload)
+  {
+    return _endpoint.sendb(handle, _encode(static_cast<uint32_t>(payload.size()) | _response_bit, id, payload));
+  }
+
+  /**
+   * Forgets the request with the passed correlation id; its callback is
+   * never called. A response that arrives anyway is dropped.
+   * 
+   * @param id The correlation id.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void cancel(
+    CorrelationId id)
+  {
+    _Request request;
+
+    _State* state = _in_flight.take(id, request) ? _find_state(request.connection) : nullptr;
+
+    if (state) {
+      bool is_waiting = false;
+
+      for (const _Waiting& waiting : state->waiting) {
+        is_waiting = is_waiting || waiting.id == id;
+      }
+
+      // A request still waiting was never sent, and _send_waiting() skips
+      // it once it reaches the front.
+      if (!is_waiting) {
+        state->nin_flight--;
+        _send_waiting(request.connection, *state);
+      }
+    }
+  }
+
+  /**
+   * Sets the function requests received from peers are handed to.
+   * 
+   * @param handler The request handler.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_request_handler(
+    RequestHandler handler)
+  {
+    _request_handler = std::move(handler);
+  }
+
+  /**
+   * Sets the largest payload accepted from peers. Connections sending a
+   * larger record are closed. Defaults to 16MB.
+   * 
+   * @param nbytes The largest payload, in bytes.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_max_message_nbytes(
+    std::size_t nbytes)
+  {
+    _max_message_nbytes = std::min<std::size_t>(nbytes, ~_response_bit);
+  }
+
+  /**
+   * Returns the number of requests awaiting a response or their turn.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::size_t size() const {
+    return _in_flight.size();
+  }
+};
+
+}
+
+#endif
\ No newline at end of file
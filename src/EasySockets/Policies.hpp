@@ -0,0 +1,198 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+
+#ifndef _EASYSOCKETS_POLICIES_HPP_
+#define _EASYSOCKETS_POLICIES_HPP_
+
+#include "EasySockets.hpp"
+
+namespace es {
+
+/**
+ * Read policy of a server whose read mode is set with set_read_mode()
+ * and which starts reading every connection as soon as it is
+ * established. This is how servers have always read.
+ * 
+ * A read policy is a class with the three constants below. When
+ * is_fixed is true, the mode and auto_read constants replace the
+ * server's settings, so the checks on them fold away at compile time.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class RuntimeRead {
+public:
+  static constexpr bool is_fixed = false;
+  static constexpr int8_t mode = es::READ_SOME;
+  static constexpr bool auto_read = true;
+};
+
+/**
+ * Read policy fixing the read mode at compile time. Without auto_read,
+ * connections are only read through _begin_read().
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <int8_t ModeV, bool AutoReadV = true>
+class FixedRead {
+  static_assert(
+    ModeV == es::READ_SOME || ModeV == es::READ_UNTIL || ModeV == es::READ_AVAILABLE,
+    "FixedRead takes READ_SOME, READ_UNTIL or READ_AVAILABLE"
+  );
+public:
+  static constexpr bool is_fixed = true;
+  static constexpr int8_t mode = ModeV;
+  static constexpr bool auto_read = AutoReadV;
+};
+
+/**
+ * Dispatch policy queuing every event, BEGIN events included, for
+ * either poll() or the function passed to set_event_handler().
+ * 
+ * A dispatch policy is a class with the two constants below.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class RuntimeDispatch {
+public:
+  static constexpr bool has_begin_events = true;
+  static constexpr bool has_event_handler = true;
+};
+
+/**
+ * Dispatch policy for servers whose events are only ever taken with
+ * poll(). The event handler checks on every queued event compile away,
+ * and so, by default, do ACCEPT_BEGIN, CONNECT_BEGIN, READ_BEGIN and
+ * SEND_BEGIN events, which most applications drop unread.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <bool HasBeginEventsV = false>
+class PollDispatch {
+public:
+  static constexpr bool has_begin_events = HasBeginEventsV;
+  static constexpr bool has_event_handler = false;
+};
+
+/**
+ * Threading policy running a server's handlers directly on an io_service
+ * of its own, and on a strand when the io_service is passed in, since
+ * other threads may be running it.
+ * 
+ * A threading policy is a class with an Executor type and the function
+ * below, which the server's constructors call.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class RuntimeThreading {
+public:
+  typedef boost::asio::any_io_executor Executor;
+
+  /**
+   * 
+   * @param io_service The io_service the server runs on.
+   * @param is_shared True when the io_service was passed to the server.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static Executor executor_of(
+    boost::asio::io_service& io_service,
+    bool is_shared)
+  {
+    if (is_shared) {
+      return Executor(boost::asio::make_strand(io_service));
+    }
+
+    return Executor(io_service.get_executor());
+  }
+};
+
+/**
+ * Threading policy for servers whose io_service is only ever run by one
+ * thread at a time, whether update() or the application's own. Handlers
+ * run on the io_service's executor itself, with no strand and no type
+ * erased executor in between.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class SingleThreaded {
+public:
+  typedef boost::asio::io_service::executor_type Executor;
+
+  static Executor executor_of(
+    boost::asio::io_service& io_service,
+    bool)
+  {
+    return io_service.get_executor();
+  }
+};
+
+/**
+ * Threading policy always running a server's handlers on a strand, for
+ * servers whose io_service is run by several threads.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class Stranded {
+public:
+  typedef boost::asio::strand<boost::asio::io_service::executor_type> Executor;
+
+  static Executor executor_of(
+    boost::asio::io_service& io_service,
+    bool)
+  {
+    return boost::asio::make_strand(io_service);
+  }
+};
+
+/**
+ * The policies a server is compiled with. Logging is chosen by the
+ * server's logger type, see NullLogger.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <
+  class ReadTy = RuntimeRead,
+  class DispatchTy = RuntimeDispatch,
+  class ThreadingTy = RuntimeThreading>
+class Policies {
+public:
+  typedef ReadTy Read;
+  typedef DispatchTy Dispatch;
+  typedef ThreadingTy Threading;
+};
+
+/**
+ * The default policies, under which everything is configured at runtime.
+ * */
+typedef Policies<> RuntimePolicies;
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,179 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+#ifndef _EASYSOCKETS_RATELIMITER_HPP_
+#define _EASYSOCKETS_RATELIMITER_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace es {
+
+/**
+ * Token bucket refilled at a fixed rate up to a burst size. Tokens are
+ * taken after the fact, once it is known how much was actually used,
+ * so the bucket may go into debt; delay() then tells how long to wait
+ * before it is out of debt again. A bucket with a rate of zero never
+ * limits anything.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class TokenBucket {
+public:
+  typedef std::chrono::steady_clock Clock;
+protected:
+  double _rate;
+  double _burst;
+  double _tokens;
+  Clock::time_point _when;
+
+  void _refill(
+    Clock::time_point now)
+  {
+    std::chrono::duration<double> elapsed = now - _when;
+
+    _tokens = std::min(_burst, _tokens + elapsed.count() * _rate);
+    _when = now;
+  }
+public:
+  TokenBucket()
+    : _rate(0),
+      _burst(0),
+      _tokens(0)
+  {}
+
+  /**
+   * 
+   * @param rate The number of tokens added per second, or zero for no limit.
+   * @param burst The most tokens the bucket can hold.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_rate(
+    double rate,
+    double burst)
+  {
+    _rate = rate;
+    _burst = burst;
+    _tokens = burst;
+    _when = Clock::now();
+  }
+
+  /**
+   * Takes the passed number of tokens.
+   * 
+   * @param ntokens The number of tokens used.
+   * @param now The current time.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void consume(
+    double ntokens,
+    Clock::time_point now)
+  {
+    if (_rate > 0) {
+      _refill(now);
+      _tokens -= ntokens;
+    }
+  }
+
+  /**
+   * Returns how long it will take for the bucket to be out of debt.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::chrono::microseconds delay() const
+  {
+    if (_rate <= 0 || _tokens >= 0) {
+      return std::chrono::microseconds(0);
+    }
+
+    return std::chrono::microseconds(static_cast<int64_t>(-_tokens / _rate * 1e6) + 1);
+  }
+
+  bool is_limited() const {
+    return _rate > 0;
+  }
+};
+
+/**
+ * Pair of token buckets limiting both the bytes and the messages going
+ * through something per second. Each bucket allows a burst of one
+ * second's worth.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class RateLimiter {
+public:
+  TokenBucket bytes;
+  TokenBucket messages;
+
+  /**
+   * 
+   * @param bytes_per_second The byte limit, or zero for none.
+   * @param messages_per_second The message limit, or zero for none.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_limits(
+    double bytes_per_second,
+    double messages_per_second)
+  {
+    bytes.set_rate(bytes_per_second, bytes_per_second);
+    messages.set_rate(messages_per_second, messages_per_second);
+  }
+
+  /**
+   * Accounts for one message of the passed size, and returns how long to
+   * wait before the next one is allowed.
+   * 
+   * @param nbytes The size of the message.
+   * @param now The current time.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::chrono::microseconds consume(
+    std::size_t nbytes,
+    TokenBucket::Clock::time_point now)
+  {
+    bytes.consume(static_cast<double>(nbytes), now);
+    messages.consume(1, now);
+
+    return std::max(bytes.delay(), messages.delay());
+  }
+
+  bool is_limited() const {
+    return bytes.is_limited() || messages.is_limited();
+  }
+};
+
+}
+
+#endif
\ No newline at end of file
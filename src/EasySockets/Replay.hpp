@@ -0,0 +1,487 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+
+
+#ifndef _EASYSOCKETS_REPLAY_HPP_
+#define _EASYSOCKETS_REPLAY_HPP_
+
+#include "Capture.hpp"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace es {
+
+/**
+ * Feeds a capture back into a TCP server. Every captured connection is
+ * recreated as a loopback connection the server adopts, and the bytes
+ * it received are written to it again, in the captured order, on a
+ * virtual clock that follows the capture's timestamps. At speed zero the
+ * clock jumps straight to the next record, so hours of traffic replay as
+ * fast as the server takes them; otherwise it runs at the passed multiple
+ * of real time. Either way the clock only moves past a connection's next
+ * record once the server has sent that connection as many bytes as it
+ * did by then in the capture, so a client that waited for a response
+ * waits for it again. A server that falls short for longer than the
+ * stall timeout is moved past anyway, and the stall is counted.
+ *
+ * The replay runs on the server's executor, alongside the server's own
+ * handlers, so update() (or the application's threads) drives both. Like
+ * the server, it must outlive the handlers it started. Captures hold the
+ * bytes the application saw, so they replay faithfully into servers
+ * without compression.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <class ServerTy>
+class Replay {
+  static_assert(
+    std::is_same<typename ServerTy::ConnectionTy::Socket, boost::asio::ip::tcp::socket>::value,
+    "Replay recreates connections over TCP"
+  );
+protected:
+  typedef std::chrono::steady_clock _Clock;
+
+  struct _Peer {
+    boost::asio::ip::tcp::socket socket;
+    ConnectionHandle handle;
+    std::deque<std::string> writes;
+    uint64_t nbytes_expected;
+    uint64_t nbytes_received;
+    bool is_closing;
+
+    _Peer(const boost::asio::any_io_executor& executor)
+      : socket(executor),
+        handle(es::NULL_HANDLE),
+        nbytes_expected(0),
+        nbytes_received(0),
+        is_closing(false)
+    {}
+  };
+
+  typedef std::shared_ptr<_Peer> _PeerP;
+
+  ServerTy& _server;
+  CaptureReader _reader;
+  double _speed;
+  std::chrono::milliseconds _stall_timeout;
+  boost::asio::ip::tcp::acceptor _acceptor;
+  boost::asio::steady_timer _timer;
+  std::unordered_map<ConnectionHandle, _PeerP> _peers;
+  _PeerP _waiting;
+  std::vector<char> _discard;
+  CaptureRecord _record;
+  bool _has_record;
+  std::chrono::nanoseconds _first;
+  std::chrono::nanoseconds _virtual_now;
+  _Clock::time_point _began;
+  _Clock::time_point _stalled_since;
+  std::size_t _nwriting;
+  std::size_t _nstalls;
+  uint64_t _step_generation;
+  uint64_t _nbytes_expected;
+  uint64_t _nbytes_received;
+
+  void _begin_discard(
+    _PeerP peer)
+  {
+    _Peer& target = *peer;
+
+    target.socket.async_read_some(boost::asio::buffer(_discard),
+      [this, peer = std::move(peer)](
+        boost::system::error_code error,
+        std::size_t nbytes_received) mutable
+      {
+        _nbytes_received += nbytes_received;
+        peer->nbytes_received += nbytes_received;
+
+        if (_waiting == peer) {
+          _waiting.reset();
+          _timer.cancel();
+          _step_generation++;
+          _step();
+        }
+
+        if (!error) {
+          _begin_discard(std::move(peer));
+        }
+      }
+    );
+  }
+
+  void _begin_write(
+    _PeerP peer)
+  {
+    _Peer& target = *peer;
+
+    if (target.writes.empty()) {
+      if (target.is_closing) {
+        boost::system::error_code ignored;
+        target.socket.shutdown(boost::asio::socket_base::shutdown_send, ignored);
+      }
+      return;
+    }
+
+    _nwriting++;
+
+    boost::asio::async_write(target.socket, boost::asio::buffer(target.writes.front()),
+      [this, peer = std::move(peer)](
+        boost::system::error_code error,
+        std::size_t) mutable
+      {
+        _nwriting--;
+        peer->writes.pop_front();
+
+        if (error) {
+          peer->writes.clear();
+        }
+
+        _begin_write(std::move(peer));
+      }
+    );
+  }
+
+  void _open(
+    ConnectionHandle captured)
+  {
+    boost::system::error_code error;
+    _PeerP peer = std::make_shared<_Peer>(_server.executor());
+    boost::asio::ip::tcp::socket accepted(_server.executor());
+
+    // Connecting to a listening loopback socket completes without the
+    // accept, so neither call waits.
+    peer->socket.connect(_acceptor.local_endpoint(), error);
+
+    if (!error) {
+      _acceptor.accept(accepted, error);
+    }
+
+    if (error) {
+      return;
+    }
+
+    peer->handle = _server.adopt(accepted);
+    _peers[captured] = peer;
+    _begin_discard(std::move(peer));
+  }
+
+  void _apply(
+    const CaptureRecord& record)
+  {
+    _virtual_now = record.when - _first;
+
+    if (record.kind == es::CAPTURE_OPEN) {
+      _open(record.handle);
+      return;
+    }
+
+    auto found = _peers.find(record.handle);
+
+    if (record.kind == es::CAPTURE_SEND) {
+      _nbytes_expected += record.nbytes;
+      if (found != _peers.end()) {
+        found->second->nbytes_expected += record.nbytes;
+      }
+      return;
+    }
+
+    if (found == _peers.end()) {
+      return;
+    }
+
+    _PeerP peer = found->second;
+
+    if (record.kind == es::CAPTURE_CLOSE) {
+      _peers.erase(found);
+      peer->is_closing = true;
+    } else {
+      peer->writes.emplace_back(record.data, record.nbytes);
+    }
+
+    if (peer->writes.size() == 1 || (peer->writes.empty() && peer->is_closing)) {
+      _begin_write(std::move(peer));
+    }
+  }
+
+  /**
+   * Returns true if the connection of the pending record still waits for
+   * bytes from the server, and the stall timeout has not passed yet.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool _is_behind()
+  {
+    if (_record.kind != es::CAPTURE_READ && _record.kind != es::CAPTURE_CLOSE) {
+      return false;
+    }
+
+    auto found = _peers.find(_record.handle);
+
+    if (found == _peers.end() || found->second->nbytes_received >= found->second->nbytes_expected) {
+      _stalled_since = _Clock::time_point();
+      return false;
+    }
+
+    _Clock::time_point now = _Clock::now();
+
+    if (_stalled_since == _Clock::time_point()) {
+      _stalled_since = now;
+    }
+
+    // Moving on forgives the shortfall, so one divergence does not stall
+    // every later record of the connection.
+    if (now - _stalled_since >= _stall_timeout) {
+      found->second->nbytes_expected = found->second->nbytes_received;
+      _stalled_since = _Clock::time_point();
+      _nstalls++;
+      return false;
+    }
+
+    _waiting = found->second;
+
+    return true;
+  }
+
+  /**
+   * Posts the next _step() of the current chain. Steps are chained
+   * through the timer and posts, and a chain is cut short by bumping the
+   * generation, e.g. when the bytes a stalled step waits for arrive and
+   * it moves on without the timer. A timer that had already expired then
+   * finds its generation stale and does not start a second chain.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _post_step()
+  {
+    boost::asio::post(_server.executor(), [this, generation = _step_generation]() {
+      if (generation == _step_generation) {
+        _step();
+      }
+    });
+  }
+
+  /**
+   * Applies the records that are due on the virtual clock, one at a time
+   * so the server's handlers run in between, then waits for the next.
+   * Only one chain of steps runs at a time; see _post_step().
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _step()
+  {
+    if (!_has_record) {
+      return;
+    }
+
+    if (_speed > 0) {
+      std::chrono::nanoseconds due = std::chrono::duration_cast<std::chrono::nanoseconds>((_record.when - _first) / _speed);
+      _Clock::time_point when = _began + due;
+
+      if (when > _Clock::now()) {
+        _timer.expires_at(when);
+        _timer.async_wait([this, generation = _step_generation](boost::system::error_code error) {
+          if (!error && generation == _step_generation) {
+            _step();
+          }
+        });
+        return;
+      }
+    }
+
+    if (_is_behind()) {
+      _timer.expires_at(_stalled_since + _stall_timeout);
+      _timer.async_wait([this, generation = _step_generation](boost::system::error_code error) {
+        if (!error && generation == _step_generation) {
+          _waiting.reset();
+          _step();
+        }
+      });
+      return;
+    }
+
+    _apply(_record);
+    _has_record = _reader.next(_record);
+    _post_step();
+  }
+public:
+  /**
+   *
+   * @param server The server to replay into. Must outlive the replay.
+   * @param speed Zero to replay as fast as possible, otherwise the multiple of real time to replay at.
+   * @param stall_timeout How long to wait for the server to send what it sent during the capture.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  explicit Replay(
+    ServerTy& server,
+    double speed = 0,
+    std::chrono::milliseconds stall_timeout = std::chrono::milliseconds(1000))
+    : _server(server),
+      _speed(speed),
+      _stall_timeout(stall_timeout),
+      _acceptor(server.executor()),
+      _timer(server.executor()),
+      _discard(16 * 1024),
+      _has_record(false),
+      _first(0),
+      _virtual_now(0),
+      _nwriting(0),
+      _nstalls(0),
+      _step_generation(0),
+      _nbytes_expected(0),
+      _nbytes_received(0)
+  {}
+
+  ~Replay()
+  {
+    boost::system::error_code ignored;
+
+    _timer.cancel();
+    _acceptor.close(ignored);
+
+    for (auto& peer : _peers) {
+      peer.second->socket.close(ignored);
+    }
+  }
+
+  /**
+   * Opens the passed capture and starts replaying it. Call from the
+   * server's executor, e.g. between update() calls.
+   *
+   * @param path The path of the capture file.
+   * @param error Set on failure.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool start(
+    const std::string& path,
+    boost::system::error_code& error)
+  {
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), 0);
+
+    if (!_reader.open(path, error)) {
+      return false;
+    }
+
+    _acceptor.open(endpoint.protocol(), error);
+
+    if (!error) {
+      _acceptor.bind(endpoint, error);
+    }
+
+    if (!error) {
+      _acceptor.listen(boost::asio::socket_base::max_listen_connections, error);
+    }
+
+    if (error) {
+      return false;
+    }
+
+    _has_record = _reader.next(_record);
+    _first = _has_record ? _record.when : std::chrono::nanoseconds(0);
+    _began = _Clock::now();
+    _post_step();
+
+    return true;
+  }
+
+  /**
+   * Returns true once every record has been applied and every captured
+   * byte has been written to the server.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool is_done() const {
+    return !_has_record && !_nwriting;
+  }
+
+  /**
+   * Returns the capture time of the record applied last, relative to the
+   * first record.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::chrono::nanoseconds virtual_now() const {
+    return _virtual_now;
+  }
+
+  /**
+   * Returns the live handle of the connection recorded under the passed
+   * handle, or NULL_HANDLE once it has been closed.
+   *
+   * @param captured The handle in the capture.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  ConnectionHandle handle_of(
+    ConnectionHandle captured) const
+  {
+    auto found = _peers.find(captured);
+    return found == _peers.end() ? es::NULL_HANDLE : found->second->handle;
+  }
+
+  /**
+   * Returns the number of bytes the server was asked to send during the
+   * capture, for the records applied so far.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t nbytes_expected() const {
+    return _nbytes_expected;
+  }
+
+  /**
+   * Returns the number of bytes the server has sent during the replay.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t nbytes_received() const {
+    return _nbytes_received;
+  }
+
+  /**
+   * Returns the number of records applied before the server had sent
+   * what it sent by then during the capture, i.e. the number of times
+   * the replay diverged from the capture.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::size_t nstalls() const {
+    return _nstalls;
+  }
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,376 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+#ifndef _EASYSOCKETS_SSLSERVER_HPP_
+#define _EASYSOCKETS_SSLSERVER_HPP_
+
+#include "Server.hpp"
+
+#include <boost/asio/ssl.hpp>
+
+namespace es {
+
+/**
+ * Protocol of SSLServer: TCP with every connection wrapped in a TLS
+ * stream.
+ * */
+class SSLTCP {
+public:
+  typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket> socket;
+};
+
+typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket> SSLSocket;
+
+/**
+ * TCP server terminating TLS itself. Connections go through the usual
+ * accept/read/send events and read modes; ACCEPT_HANDLE is only queued
+ * once the handshake has completed, and failed handshakes are reported
+ * as ERROR_HANDLE events carrying ERROR_ACCEPT and NULL_HANDLE.
+ * 
+ * Sessions can be resumed from the server's session cache or from
+ * session tickets, so returning clients skip the full handshake.
+ * shutdown_write() only half-closes the TCP connection; no TLS
+ * close_notify is sent.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class SSLServer : public Server<SSLTCP> {
+public:
+  typedef std::shared_ptr<SSLServer> Pointer;
+private:
+  bool __is_started;
+protected:
+  boost::asio::ssl::context _context;
+  boost::asio::ip::tcp::acceptor _acceptor;
+  HandlerMemory _accept_memory;
+
+  /**
+   * Starts waiting for the next incoming connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _begin_accept() {
+    ConnectionP connection = std::make_shared<ConnectionTy>(_executor, _context);
+    boost::asio::ip::tcp::socket& socket = connection->socket.next_layer();
+
+    _push_begin_event<Event>(
+      es::NULL_HANDLE, es::ACCEPT_BEGIN, _protocol
+    );
+
+    _acceptor.async_accept(socket,
+      es::make_custom_alloc_handler(_accept_memory,
+        [this, connection = std::move(connection)](
+          boost::system::error_code error) mutable
+        {
+          _handle_accept(std::move(connection), error);
+        }
+      )
+    );
+  }
+
+  /**
+   * 
+   * @param
+   * @param
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _handle_accept(
+    ConnectionP connection,
+    boost::system::error_code error)
+  {
+    if (error) {
+      _handle_accept_error(Error(es::ERROR_ACCEPT, error), [this]() { _begin_accept(); });
+      return;
+    }
+
+    _accept_backoff = boost::posix_time::time_duration();
+    _begin_handshake(std::move(connection));
+    _begin_accept();
+  }
+
+  /**
+   * Starts the TLS handshake of a freshly accepted connection. If a read
+   * timeout is set, the handshake has to complete within it.
+   * 
+   * @param connection The accepted connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _begin_handshake(
+    ConnectionP connection)
+  {
+    ConnectionTy& target = *connection;
+
+    if (_read_timeout_seconds) {
+      target.read_timer.expires_from_now(boost::posix_time::seconds(_read_timeout_seconds));
+      target.read_timer.async_wait([connection](boost::system::error_code error) {
+        if (!error) {
+          boost::system::error_code ignored;
+          connection->socket.lowest_layer().close(ignored);
+        }
+      });
+    }
+
+    target.socket.async_handshake(boost::asio::ssl::stream_base::server,
+      [this, connection = std::move(connection)](
+        boost::system::error_code error) mutable
+      {
+        _handle_handshake(std::move(connection), error);
+      }
+    );
+  }
+
+  /**
+   * 
+   * @param connection The connection that finished its handshake.
+   * @param error The error container. Expected generic/blank if there was no error.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _handle_handshake(
+    ConnectionP connection,
+    boost::system::error_code error)
+  {
+    boost::system::error_code ignored;
+
+    connection->read_timer.cancel(ignored);
+
+    if (error) {
+      _handle_error(es::NULL_HANDLE, Error(es::ERROR_ACCEPT, error));
+      connection->socket.lowest_layer().close(ignored);
+      return;
+    }
+
+    if (_is_stopping) {
+      connection->socket.lowest_layer().close(ignored);
+      return;
+    }
+
+    if (!_insert(connection)) {
+      return;
+    }
+
+    _push_event<Event>(
+      connection->handle, es::ACCEPT_HANDLE, _protocol
+    );
+
+    if (_is_auto_read()) {
+      _begin_read(std::move(connection));
+    }
+  }
+public:
+  /**
+   * Creates a server with an empty TLS context. A certificate and private
+   * key have to be loaded, see use_certificate(), before update() is
+   * first called.
+   * 
+   * @param host
+   * @param port
+   * @param method The TLS versions to accept.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  SSLServer(
+    const std::string& host,
+    uint16_t port,
+    boost::asio::ssl::context::method method = boost::asio::ssl::context::tls_server)
+  : Server<SSLTCP>(es::TCP, host, port),
+    __is_started(false),
+    _context(method),
+    _acceptor(
+      _executor,
+      boost::asio::ip::tcp::endpoint(
+        boost::asio::ip::address::from_string(host), port
+      )
+    )
+  {
+    static const unsigned char session_id_context[] = "EasySockets";
+    SSL_CTX* context = _context.native_handle();
+
+    _context.set_options(
+      boost::asio::ssl::context::default_workarounds |
+      boost::asio::ssl::context::no_sslv2 |
+      boost::asio::ssl::context::no_sslv3 |
+      boost::asio::ssl::context::single_dh_use
+    );
+
+    // Idle connections give their TLS buffers back, and resumed sessions
+    // are looked up in the server-side cache or decrypted from tickets.
+    SSL_CTX_set_mode(context, SSL_MODE_RELEASE_BUFFERS);
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(context, session_id_context, sizeof(session_id_context) - 1);
+  }
+
+  /**
+   * Returns the TLS context shared by every connection, for settings not
+   * covered by the methods below (cipher lists, client certificates...)
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  boost::asio::ssl::context& context() {
+    return _context;
+  }
+
+  /**
+   * Loads the server's certificate chain and private key from PEM files.
+   * Throws boost::system::system_error if either cannot be loaded.
+   * 
+   * @param chain_file Path to the certificate chain.
+   * @param key_file Path to the private key.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void use_certificate(
+    const std::string& chain_file,
+    const std::string& key_file)
+  {
+    _context.use_certificate_chain_file(chain_file);
+    _context.use_private_key_file(key_file, boost::asio::ssl::context::pem);
+  }
+
+  /**
+   * Sets how long a session can be resumed after its full handshake,
+   * both from the session cache and from tickets.
+   * 
+   * @param timeout The lifetime of a session.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_session_timeout(
+    std::chrono::seconds timeout)
+  {
+    SSL_CTX_set_timeout(_context.native_handle(), static_cast<long>(timeout.count()));
+  }
+
+  /**
+   * Sets the 80 bytes of key material session tickets are encrypted with.
+   * By default a random key is generated per server, so tickets can only
+   * be resumed by the server that issued them; giving every node the same
+   * key lets clients resume anywhere. Returns false if the key is not
+   * exactly 80 bytes long.
+   * 
+   * @param keys The ticket key material.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool set_session_ticket_keys(
+    const std::string& keys)
+  {
+    return SSL_CTX_set_tlsext_ticket_keys(
+      _context.native_handle(), const_cast<char*>(keys.data()), static_cast<long>(keys.size())
+    ) == 1;
+  }
+
+  /**
+   * Enables or disables session tickets. With tickets disabled, sessions
+   * are only resumed from the server's own session cache.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_session_tickets_enabled(
+    bool enabled)
+  {
+    if (enabled) {
+      SSL_CTX_clear_options(_context.native_handle(), SSL_OP_NO_TICKET);
+    } else {
+      SSL_CTX_set_options(_context.native_handle(), SSL_OP_NO_TICKET);
+    }
+  }
+
+  /**
+   * Sets the largest plaintext fragment put in a single TLS record,
+   * between 512 and 16384 bytes. Matching it to the size payloads are
+   * usually sent in keeps each payload in as few records as possible,
+   * while smaller records let clients start decrypting sooner.
+   * 
+   * @param nbytes The largest record payload.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_max_record_nbytes(
+    std::size_t nbytes)
+  {
+    SSL_CTX_set_max_send_fragment(_context.native_handle(), static_cast<long>(nbytes));
+  }
+
+  /**
+   * Returns true if the passed connection resumed an earlier session
+   * rather than performing a full handshake.
+   * 
+   * @param handle The handle of the connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool is_session_resumed(
+    ConnectionHandle handle)
+  {
+    ConnectionTy* target = connection(handle);
+    return target && SSL_session_reused(target->socket.native_handle()) == 1;
+  }
+
+  /**
+   * 
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  UpdateResult update()
+  {
+    if (!__is_started) {
+      _begin_accept();
+      __is_started = true;
+    }
+
+    return Server<SSLTCP>::update();
+  }
+
+  /**
+   * Stops accepting new connections, then drains and closes the open ones
+   * as described by Server::stop().
+   * 
+   * @param drain_timeout How long to wait for connections to close on their own.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void stop(
+    std::chrono::milliseconds drain_timeout)
+  {
+    boost::system::error_code ignored;
+
+    _acceptor.close(ignored);
+    _accept_timer.cancel(ignored);
+    __is_started = true;
+
+    Server<SSLTCP>::stop(drain_timeout);
+  }
+};
+
+}
+
+#endif
\ No newline at end of file
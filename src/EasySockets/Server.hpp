@@ -29,32 +29,38 @@
 #ifndef _EASYSOCKETS_SERVER_HPP_
 #define _EASYSOCKETS_SERVER_HPP_
 
+#include "Capture.hpp"
+#include "Codec.hpp"
+#include "Compression.hpp"
+#include "Connection.hpp"
 #include "Event.hpp"
 #include "Logger.hpp"
+#include "Policies.hpp"
+#include "SocketOptions.hpp"
+#include "UringEngine.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <functional>
 #include <queue>
+#include <type_traits>
+#include <vector>
 
-namespace es {
+#include <unistd.h>
 
-class UpdateResult {
-protected:
-  /**
-   * @author Tyler O'Brien <contact@tylerobrien.com>
-   * todo:
-   *  - Move this into the server class itself. Otherwise having more than one Server object will cause multiple calls here and muck things up.
-   * */
-  static std::chrono::milliseconds _get_delta() {
-    static std::chrono::system_clock::time_point previous_when = std::chrono::system_clock::now();
-    
-    std::chrono::milliseconds delta = std::chrono::duration_cast<std::chrono::milliseconds>(
-      previous_when - std::chrono::system_clock::now()
-    );
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+#include <sys/socket.h>
+#endif
 
-    previous_when = std::chrono::system_clock::now();
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 
-    return delta;
-  }
+namespace es {
+
+template <class> class AwaitableConnection;
+
+class UpdateResult {
 public:
   std::size_t nhandles_executed;
   int8_t protocol;
@@ -64,371 +70,2897 @@ public:
   UpdateResult(
     std::size_t nhandles_executed,
     int8_t protocol,
-    boost::system::error_code error)
+    boost::system::error_code error,
+    std::chrono::milliseconds delta)
     : nhandles_executed(nhandles_executed),
       protocol(protocol),
       error(error),
-      delta(UpdateResult::_get_delta())
+      delta(delta)
   {}
 };
 
+/**
+ * 
+ * 
+ * The codec decodes every received frame into a message before its
+ * READ_HANDLE event is queued, and encodes messages passed to sendm().
+ * With the default RawCodec, frames are delivered as plain ReadEvents;
+ * with any other codec, READ_HANDLE events are MessageEvents.
+ * 
+ * The policies decide at compile time what RuntimePolicies, the default,
+ * leaves to runtime settings: the read mode and automatic reads, whether
+ * BEGIN events are queued and events handed to an event handler, and
+ * which executor runs the server's handlers. Together with the logger
+ * type, they let a server that needs none of these choices compile to a
+ * hot path without the checks on them.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
 template <
   class ProtocolTy,
-  class _LoggerTy = Logger>
+  class _LoggerTy = Logger,
+  class _CodecTy = RawCodec,
+  class _PoliciesTy = RuntimePolicies>
 class Server {
+  template <class> friend class AwaitableConnection;
 public:
-  typedef std::shared_ptr<Server<ProtocolTy>> Pointer;
-  typedef std::shared_ptr<typename ProtocolTy::socket> SocketP;
+  typedef std::shared_ptr<Server<ProtocolTy, _LoggerTy, _CodecTy, _PoliciesTy>> Pointer;
+  typedef _CodecTy Codec;
+  typedef typename _PoliciesTy::Read ReadPolicy;
+  typedef typename _PoliciesTy::Dispatch DispatchPolicy;
+  typedef typename _PoliciesTy::Threading ThreadingPolicy;
+  typedef typename ThreadingPolicy::Executor Executor;
+  typedef typename _CodecTy::Message Message;
+  typedef Connection<ProtocolTy> ConnectionTy;
+  typedef typename ConnectionTy::Pointer ConnectionP;
+  typedef typename ConnectionTy::Transfer Transfer;
 protected:
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  typedef std::is_same<typename ConnectionTy::Socket, boost::asio::local::stream_protocol::socket> _HasDescriptorPassing;
+#else
+  typedef std::false_type _HasDescriptorPassing;
+#endif
+
+#if defined(__linux__)
+  typedef std::integral_constant<bool,
+    std::is_same<typename ConnectionTy::Socket, boost::asio::ip::tcp::socket>::value || _HasDescriptorPassing::value
+  > _HasKernelSendFile;
+#else
+  typedef std::false_type _HasKernelSendFile;
+#endif
+
+  // Plain stream sockets can be waited on and then read without blocking;
+  // TLS streams hold decrypted bytes the socket's readiness knows nothing
+  // about.
+  typedef std::is_base_of<typename ConnectionTy::Socket::lowest_layer_type, typename ConnectionTy::Socket> _CanReceiveWhenReady;
+
+  static constexpr std::size_t _file_chunk_nbytes = 64 * 1024;
+  static constexpr std::size_t _max_received_descriptors = 64;
+  static constexpr std::size_t _max_pooled_buffers = 256;
+  static constexpr std::size_t _max_pooled_compressors = 64;
+  static constexpr std::size_t _receive_chunk_nbytes = 16 * 1024;
+  static constexpr std::size_t _min_read_chunk_nbytes = 256;
+  static constexpr unsigned _nread_chunk_classes = 9;
+
   _LoggerTy _logger;
+  _CodecTy _codec;
 
   bool _auto_read;
-  
-  std::function<void()> _io_service_run_one;
-  std::function<std::size_t()> _io_service_poll;
+  bool _events_enabled;
 
   int8_t _protocol;
   int8_t _read_mode;
   std::size_t _read_buffer_nbytes;
+  uint16_t _read_timeout_seconds;
   std::string _read_delimeter;
+  bool _is_stopping;
+  bool _is_socket_options_error_reported;
+  SocketOptions _socket_options;
+  std::size_t _max_reads_per_update;
+  uint64_t _update_epoch;
+  std::chrono::system_clock::time_point _previous_update_when;
+  RateLimiter _read_limiter;
+  RateLimiter _connection_read_limiter;
+  std::deque<ConnectionP> _deferred_reads;
   IOServiceP _io_service;
+  Executor _executor;
+  boost::asio::deadline_timer _drain_timer;
+  boost::asio::deadline_timer _accept_timer;
+  boost::posix_time::time_duration _accept_backoff;
+  UringEngine::Pointer _uring;
+  std::vector<StreamBufferP> _buffer_pool;
+  std::vector<std::unique_ptr<char[]>> _read_chunk_pools[_nread_chunk_classes];
+  bool _is_read_sizing_adaptive;
+  Compressor::Factory _compressor_factory;
+  std::vector<Compressor::Pointer> _compressor_pool;
   std::queue<EventP> _events;
+  std::function<void(EventP)> _event_handler;
+  std::function<void(const ConnectionP&)> _close_handler;
+  bool _is_delivery_posted;
+  CaptureLog::Pointer _capture;
+  ConnectionTable<ConnectionTy> _connections;
+
+  /**
+   * Queues a new event of the passed type, constructed from the passed
+   * arguments. Nothing is constructed while events are disabled.
+   * 
+   * @param args The arguments of the event's constructor.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class EventTy, class... ArgTys>
+  void _push_event(
+    ArgTys&&... args)
+  {
+    if (_events_enabled) {
+      _events.push(std::make_shared<EventTy>(std::forward<ArgTys>(args)...));
+
+      if (_has_event_handler() && !_is_delivery_posted) {
+        _post_delivery();
+      }
+    }
+  }
+
+  /**
+   * Same as above, for ACCEPT_BEGIN, CONNECT_BEGIN, READ_BEGIN and
+   * SEND_BEGIN events, which the dispatch policy may leave out.
+   * 
+   * @param args The arguments of the event's constructor.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class EventTy, class... ArgTys>
+  void _push_begin_event(
+    ArgTys&&... args)
+  {
+    if (DispatchPolicy::has_begin_events) {
+      _push_event<EventTy>(std::forward<ArgTys>(args)...);
+    }
+  }
+
+  bool _has_event_handler() const {
+    return DispatchPolicy::has_event_handler && static_cast<bool>(_event_handler);
+  }
+
+  /**
+   * Returns the read mode, as fixed by the read policy or otherwise set
+   * with set_read_mode().
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  int8_t _current_read_mode() const {
+    return ReadPolicy::is_fixed ? ReadPolicy::mode : _read_mode;
+  }
+
+  bool _is_auto_read() const {
+    return ReadPolicy::is_fixed ? ReadPolicy::auto_read : _auto_read;
+  }
+
+  /**
+   * Hands the queued events to the event handler from a handler of its
+   * own, so the event handler never runs in the middle of the server's
+   * bookkeeping and may freely call back into the server.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _post_delivery()
+  {
+    _is_delivery_posted = true;
+
+    boost::asio::post(_executor, [this]() {
+      _is_delivery_posted = false;
+
+      while (_has_event_handler() && !_events.empty()) {
+        EventP event = std::move(_events.front());
+        _events.pop();
+        _event_handler(std::move(event));
+      }
+    });
+  }
 
   /**
-   * Starts receiving from the passed socket using the passed string as a
-   * delimeter. The socket will remain in a transmission state until the
-   * passed delimeter is received, the action is cancelled, or the socket
+   * Starts receiving from the passed connection using the set delimeter.
+   * The connection will remain in a transmission state until the
+   * delimeter is received, the action is cancelled, or the socket
    * is forcibly closed.
    * 
-   * @param client The socket connection.
-   * @param delim The delimeter denoting when upon delivery to stop receiving.
+   * @param connection The socket connection.
+   * @param event_id The id of the READ_BEGIN event for this read.
    *
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
   void _begin_read_until(
-    SocketP client,
-    const std::string& delim,
+    ConnectionP connection,
     uint64_t event_id)
   {
-    StreamBufferP buffer = std::make_shared<StreamBuffer>();
+    ConnectionTy& target = *connection;
+
+    target._is_reading = true;
 
     boost::asio::async_read_until(
-      *client, *buffer, delim.c_str(),
-      boost::bind(&Server::_handle_read,
-        this, client, buffer, event_id,
-        boost::asio::placeholders::bytes_transferred,
-        boost::asio::placeholders::error
+      target.socket, *target.read_buffer, _read_delimeter,
+      es::make_custom_alloc_handler(target._read_memory,
+        [this, connection = std::move(connection), event_id](
+          boost::system::error_code error,
+          std::size_t nbytes_received) mutable
+        {
+          connection->_is_reading = false;
+          _handle_read(std::move(connection), event_id, nbytes_received, error);
+        }
       )
     );
   }
 
   /**
-   * Starts receiving from the passed socket using the set default number
-   * of bytes as a buffer size. The socket will remain in a transmission state until the
-   * buffer is filled (i.e. the set number of bytes are received,) the action is
-   * cancelled, or the socket is forcibly closed.
+   * Starts receiving from the passed connection for the passed number of
+   * bytes. Bytes already sitting in the connection's read buffer count
+   * towards the total. The connection will remain in a transmission state
+   * until the bytes are received, the action is cancelled, or the socket
+   * is forcibly closed.
    * 
-   * @param client The socket connection.
+   * @param connection The socket connection.
+   * @param nbytes The number of bytes to receive.
+   * @param event_id The id of the READ_BEGIN event for this read.
    *
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
   void _begin_read_some(
-    SocketP client,
+    ConnectionP connection,
+    std::size_t nbytes,
     uint64_t event_id)
   {
-    StreamBufferP buffer = std::make_shared<StreamBuffer>(_read_buffer_nbytes);
+    ConnectionTy& target = *connection;
+    std::size_t nbytes_buffered = target.read_buffer->size();
+    std::size_t nbytes_missing = nbytes > nbytes_buffered ? nbytes - nbytes_buffered : 0;
+
+    target._is_reading = true;
 
     boost::asio::async_read(
-      *client, *buffer,
-      boost::bind(&Server::_handle_read,
-        this, client, buffer, event_id,
-        boost::asio::placeholders::bytes_transferred,
-        boost::asio::placeholders::error
+      target.socket, *target.read_buffer, boost::asio::transfer_exactly(nbytes_missing),
+      es::make_custom_alloc_handler(target._read_memory,
+        [this, connection = std::move(connection), nbytes, event_id](
+          boost::system::error_code error,
+          std::size_t) mutable
+        {
+          std::size_t nbytes_available = connection->read_buffer->size();
+
+          connection->_is_reading = false;
+          _handle_read(std::move(connection), event_id, nbytes < nbytes_available ? nbytes : nbytes_available, error);
+        }
       )
     );
   }
 
   /**
+   * Starts receiving whatever the passed connection has to offer, up to
+   * the passed number of bytes. Completes as soon as anything has been
+   * received, or right away if bytes are already buffered.
    * 
-   * 
-   * @param client The socket connection.
-   * @param buffer 
-   * @param nbytes_received The number of bytes received.
-   * @param error The error container. Expected generic/blank if there was no error.
+   * @param connection The socket connection.
+   * @param nbytes The most bytes to receive.
+   * @param event_id The id of the READ_BEGIN event for this read.
    *
    * @author Tyler O'Brien <contact@tylerobrien.com>
-   *
-   * todo:
-   *  - Implement read timeout event.
    * */
-  void _handle_read(
-    SocketP client,
-    StreamBufferP buffer,
-    uint64_t unique_id,
-    std::size_t nbytes_received,
-    boost::system::error_code error)
+  void _begin_read_available(
+    ConnectionP connection,
+    std::size_t nbytes,
+    uint64_t event_id)
   {
-    if (buffer->size()) {
-      _events.push(std::make_shared<ReadEvent>(
-          buffer, nbytes_received, client, es::READ_HANDLE, _protocol, unique_id, error
-      ));
+    ConnectionTy& target = *connection;
 
-      if (_auto_read) {
-        _begin_read(client);
-      }
-    } else {
-      _handle_close(client);
+    if (std::size_t nbytes_buffered = target.read_buffer->size()) {
+      boost::asio::post(_executor, [this, connection = std::move(connection), nbytes_framed = std::min(nbytes, nbytes_buffered), event_id]() mutable {
+        _handle_read(std::move(connection), event_id, nbytes_framed, boost::system::error_code());
+      });
+      return;
     }
+
+    target._is_reading = true;
+    target.socket.async_read_some(target.read_buffer->prepare(nbytes),
+      es::make_custom_alloc_handler(target._read_memory,
+        [this, connection = std::move(connection), event_id](
+          boost::system::error_code error,
+          std::size_t nbytes_received) mutable
+        {
+          connection->_is_reading = false;
+          connection->read_buffer->commit(nbytes_received);
+          _handle_read(std::move(connection), event_id, nbytes_received, error);
+        }
+      )
+    );
   }
 
   /**
-   * Called when the passed socket's connection has been closed.
-   *
-   * @param client The socket connection.
+   * Returns the size of the frame sitting at the front of the passed
+   * connection's read buffer, or zero if no complete frame is buffered
+   * yet. A frame is either the passed number of bytes or, when that is
+   * zero, everything up to and including the read delimeter. When reading
+   * what is available, any buffered bytes, up to the passed number, are a
+   * frame.
+   * 
+   * @param connection The socket connection.
+   * @param nbytes The number of bytes making up a frame, or zero.
    *
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  void _handle_close(
-    SocketP client)
+  std::size_t _buffered_frame_nbytes(
+    const ConnectionTy& connection,
+    std::size_t nbytes) const
   {
-    _events.push(std::make_shared<Event>(
-      client, es::CLOSE_HANDLE, _protocol
-    ));
-  }
+    std::size_t nbytes_buffered = connection.read_buffer->size();
+
+    if (_current_read_mode() == es::READ_AVAILABLE) {
+      return std::min(nbytes, nbytes_buffered);
+    }
+
+    if (nbytes) {
+      return nbytes_buffered >= nbytes ? nbytes : 0;
+    }
 
+    if (_read_delimeter.empty()) {
+      return 0;
+    }
+
+    BufferIterator begin = boost::asio::buffers_begin(connection.read_buffer->data());
+    BufferIterator end = boost::asio::buffers_end(connection.read_buffer->data());
+    BufferIterator found = std::search(begin, end, _read_delimeter.begin(), _read_delimeter.end());
+
+    return found == end ? 0 : (found - begin) + _read_delimeter.size();
+  }
 
   /**
+   * Returns a compressor from the pool, or a new one made by the
+   * server's compressor factory if the pool is empty.
    * 
-   * 
-   * @param The socket connection.
-   * @param
-   * @param
-   * @param
-   *
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  void _handle_send(
-    SocketP client,
-    uint64_t transfer_id,
-    std::size_t nbytes_sent,
-    boost::system::error_code error)
+  Compressor::Pointer _acquire_compressor()
   {
-    _events.push(std::make_shared<SendEvent>(
-      transfer_id, nbytes_sent, client, es::SEND_HANDLE, _protocol, error
-    ));
+    if (_compressor_pool.empty()) {
+      return _compressor_factory();
+    }
+
+    Compressor::Pointer compressor = std::move(_compressor_pool.back());
+    _compressor_pool.pop_back();
+
+    return compressor;
   }
-public:
-  /**
-   * 
-   * 
-   * @param
-   * @param
-   * @param
-   * 
-   * @author Tyler O'Brien <contact@tylerobrien.com>
-   * */
-  Server(
-    int8_t protocol,
-    const std::string& host,
-    uint16_t port)
-  : _auto_read(true),
-    _protocol(protocol),
-    _io_service(std::make_shared<boost::asio::io_service>())
-  {}
 
   /**
+   * Resets the passed compressor and puts it back into the pool, unless
+   * the pool is full.
    * 
-   * 
-   * @param
-   * @param
-   * @param
-   * @param
+   * @param compressor The compressor of a closed connection.
    * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  Server(
-    int8_t protocol,
-    IOServiceP io_service,
-    const std::string& host,
-    uint16_t port)
-  : _auto_read(true),
-    _io_service(io_service),
-    _protocol(protocol)
-  {}
+  void _release_compressor(
+    Compressor::Pointer compressor)
+  {
+    if (_compressor_pool.size() < _max_pooled_compressors) {
+      compressor->reset();
+      _compressor_pool.push_back(std::move(compressor));
+    }
+  }
 
   /**
-   * Returns the most recent event, if there is one. If there is no event
-   * a "blank" event is returned that will be falsey.
+   * Queues the compression magic on the passed connection, ahead of
+   * anything else and without going through its compressor. Only a
+   * transfer already being written goes out before it, so a server that
+   * supports compression must not send on a connection before its first
+   * read; a greeting already on its way would reach a peer that asked for
+   * compression ahead of the magic, and that peer fails the connection.
    * 
+   * @param connection The socket connection.
+   *
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  EventP poll()
+  void _send_compression_magic(
+    ConnectionTy& connection)
   {
-    if (!_events.empty()) {
-      EventP event = _events.front();
-      _events.pop();
-      return event;
+    const ConnectionP& target = _connections.find(connection.handle);
+
+    if (!target || connection._close_pending || connection._shutdown_pending) {
+      return;
     }
 
-    return EventP();
+    Transfer magic;
+
+    magic.id = es::make_uid();
+    magic.payload = _acquire_buffer();
+    magic.on_sent = [](boost::system::error_code, std::size_t) {};
+    magic.is_pooled = true;
+    magic.bypasses_compression = true;
+    magic.payload->commit(boost::asio::buffer_copy(
+      magic.payload->prepare(Compressor::magic_nbytes), boost::asio::buffer(Compressor::magic, Compressor::magic_nbytes)
+    ));
+
+    connection.write_queue.insert(connection.write_queue.begin() + (connection._is_sending ? 1 : 0), std::move(magic));
+
+    if (!connection._is_sending) {
+      _begin_send(target);
+    }
   }
-  
+
   /**
+   * Asks the peer of the passed connection for compression. Everything
+   * sent from now on is compressed, while what is received is read as
+   * records once the peer has echoed the magic.
    * 
-   * 
+   * @param connection The socket connection.
+   *
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  UpdateResult update()
+  void _initiate_compression(
+    ConnectionTy& connection)
   {
-    boost::system::error_code error;
-
-    _io_service->run_one();
-    
-    std::size_t nhandles_executed = _io_service->poll(error);
-
-    return UpdateResult(nhandles_executed, _protocol, error);
+    _send_compression_magic(connection);
+    connection._compressor = _acquire_compressor();
   }
-  
+
   /**
-   * Called when it is needed to receive data from the passed socket.
+   * Called for the first bytes received on a connection of a server that
+   * supports compression. If they are the compression magic, the magic is
+   * echoed back and everything after it is decompressed; anything else
+   * means the connection stays uncompressed. On a connection that asked
+   * for compression itself, the magic is the peer's echo and is not sent
+   * back, and anything else fails the connection since its sends are
+   * already compressed.
    * 
-   * @param client The socket connection.
+   * @param connection The socket connection.
+   * @param error Set when the bytes following the magic cannot be decompressed.
    *
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  uint64_t _begin_read(
-    SocketP client)
+  bool _negotiate_compression(
+    ConnectionTy& connection,
+    boost::system::error_code& error)
   {
-    uint64_t event_id = es::make_uid();
+    StreamBuffer& buffer = *connection.read_buffer;
+    const char* received = static_cast<const char*>(buffer.data().data());
+    std::size_t nbytes = std::min(buffer.size(), Compressor::magic_nbytes);
+    bool is_initiator = static_cast<bool>(connection._compressor);
 
-    _events.push(std::make_shared<Event>(
-      client, es::READ_BEGIN, _protocol, event_id
-    ));
+    if (!std::equal(received, received + nbytes, Compressor::magic)) {
+      connection._is_negotiating = false;
 
-    if (_read_mode == es::READ_UNTIL) {
-      _begin_read_until(client, _read_delimeter, event_id);
-    } else {
-      _begin_read_some(client, event_id);
+      if (is_initiator) {
+        error = boost::asio::error::no_protocol_option;
+        return false;
+      }
+
+      return true;
     }
 
-    return event_id;
+    if (nbytes < Compressor::magic_nbytes) {
+      return true;
+    }
+
+    buffer.consume(Compressor::magic_nbytes);
+    connection._is_negotiating = false;
+
+    if (!is_initiator) {
+      _send_compression_magic(connection);
+      connection._compressor = _acquire_compressor();
+    }
+
+    if (!buffer.size()) {
+      return true;
+    }
+
+    StreamBufferP compressed = _acquire_buffer();
+
+    compressed->commit(boost::asio::buffer_copy(compressed->prepare(buffer.size()), buffer.data()));
+    buffer.consume(buffer.size());
+
+    bool is_decompressed = connection._compressor->decompress(compressed->data(), buffer, error);
+    _release_buffer(std::move(compressed));
+
+    return is_decompressed;
   }
-  
+
   /**
-   * Called when it is needed to receive data from the passed socket for a
-   * predefined number of bytes.
+   * Appends bytes received on the passed connection to its read buffer,
+   * decompressing them first if the connection is compressed. Returns
+   * false if they cannot be decompressed.
    * 
-   * @param client The socket connection.
-   * @param nbytes The number of bytes to receive.
+   * @param connection The socket connection.
+   * @param data The received bytes.
+   * @param error Set when the bytes cannot be decompressed.
    *
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  uint64_t _begin_read_nbytes(
-    SocketP socket,
-    std::size_t nbytes)
+  bool _receive(
+    ConnectionTy& connection,
+    boost::asio::const_buffer data,
+    boost::system::error_code& error)
   {
-    int8_t previous_read_mode = _read_mode;
-    std::size_t previous_nbytes = _read_buffer_nbytes;
-
-    set_read_mode(es::READ_SOME);
-    set_read_buffer_nbytes(nbytes);
+    StreamBuffer& buffer = *connection.read_buffer;
 
-    uint64_t event_id = _begin_read(socket);
+    if (connection._compressor && !connection._is_negotiating) {
+      return connection._compressor->decompress(data, buffer, error);
+    }
 
-    set_read_mode(previous_read_mode);
-    set_read_buffer_nbytes(previous_nbytes);
+    buffer.commit(boost::asio::buffer_copy(buffer.prepare(data.size()), data));
 
-    return event_id;
+    return !connection._is_negotiating || _negotiate_compression(connection, error);
   }
 
   /**
+   * Receives whatever the connection's socket has into the passed space,
+   * calling the passed function once done.
    * 
-   * 
-   * @param The socket connection.
-   * @param
+   * @param connection The socket connection.
+   * @param space Where to receive to.
+   * @param handler Called with the error, if any, and the number of bytes received.
    *
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  uint64_t sendb(
-    SocketP client,
-    StreamBufferP payload)
+  template <class HandlerTy>
+  void _async_receive(
+    ConnectionTy& connection,
+    boost::asio::mutable_buffer space,
+    HandlerTy handler,
+    std::false_type)
   {
-    uint64_t event_id = es::make_uid();
-
-    _events.push(std::make_shared<SendEvent>(
-      uid, event_id, client, es::SEND_BEGIN, _protocol
-    ));
-
-    boost::asio::async_write(
-      *client, *payload,
-      boost::bind(&Server::_handle_send,
-        this, client, event_id,
-        boost::asio::placeholders::bytes_transferred,
-        boost::asio::placeholders::error
-      )
+    connection.socket.async_read_some(space,
+      es::make_custom_alloc_handler(connection._read_memory, std::move(handler))
     );
-
-    return event_id;
   }
 
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
   /**
+   * Same as above, for local sockets. Bytes are received with recvmsg()
+   * so that descriptors passed along with them are kept, and appended to
+   * the connection's descriptors.
    * 
-   * 
-   * @param The socket connection.
-   * @param
+   * @param connection The socket connection.
+   * @param space Where to receive to.
+   * @param handler Called with the error, if any, and the number of bytes received.
    *
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  uint64_t sends(
-    SocketP client,
-    const std::string& payload)
+  template <class HandlerTy>
+  void _async_receive(
+    ConnectionTy& connection,
+    boost::asio::mutable_buffer space,
+    HandlerTy handler,
+    std::true_type)
   {
-    uint64_t event_id = es::make_uid();
+    connection.socket.async_wait(ConnectionTy::Socket::wait_read,
+      es::make_custom_alloc_handler(connection._read_memory,
+        [this, &connection, space, handler = std::move(handler)](
+          boost::system::error_code error) mutable
+        {
+          std::size_t nbytes_received = 0;
 
-    _events.push(std::make_shared<SendEvent>(
-      event_id, 0, client, es::SEND_BEGIN, _protocol
-    ));
+          if (!error) {
+            nbytes_received = _receive_descriptors(connection, space, error);
 
-    boost::asio::async_write(
-      *client, boost::asio::buffer(payload.c_str(), payload.size()),
-      boost::bind(&Server::_handle_send,
-        this, client, event_id,
-        boost::asio::placeholders::bytes_transferred,
-        boost::asio::placeholders::error
+            if (error == boost::asio::error::would_block) {
+              _async_receive(connection, space, std::move(handler), std::true_type());
+              return;
+            }
+          }
+
+          handler(error, nbytes_received);
+        }
       )
     );
-
-    return event_id;
   }
 
   /**
+   * Reads from the passed local connection's socket without blocking,
+   * keeping any descriptors sent along with the bytes.
+   * 
+   * @param connection The socket connection.
+   * @param space Where to receive to.
+   * @param error Set on failure, to would_block if there is nothing to receive yet, or to message_size if more descriptors were sent than fit.
+   *
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  void set_read_timeout_seconds(
-    uint16_t seconds)
+  std::size_t _receive_descriptors(
+    ConnectionTy& connection,
+    boost::asio::mutable_buffer space,
+    boost::system::error_code& error)
   {
-    _read_timeout_seconds = seconds;
+    union {
+      cmsghdr header;
+      char bytes[CMSG_SPACE(sizeof(int) * _max_received_descriptors)];
+    } control;
+
+    iovec vector { space.data(), space.size() };
+    msghdr message {};
+    int flags = MSG_DONTWAIT;
+    ssize_t result;
+
+#if defined(MSG_CMSG_CLOEXEC)
+    flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control.bytes;
+    message.msg_controllen = sizeof(control.bytes);
+
+    do {
+      result = ::recvmsg(connection.socket.native_handle(), &message, flags);
+    } while (result < 0 && errno == EINTR);
+
+    if (result < 0) {
+      error = boost::system::error_code(errno, boost::system::system_category());
+      return 0;
+    }
+
+    for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+      if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+        std::size_t ndescriptors = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const unsigned char* data = CMSG_DATA(header);
+
+        for (std::size_t i = 0; i < ndescriptors; i++) {
+          int descriptor;
+          std::memcpy(&descriptor, data + i * sizeof(int), sizeof(int));
+          connection.descriptors.push_back(descriptor);
+        }
+      }
+    }
+
+    // The kernel discards descriptors beyond the control buffer, which
+    // the connection cannot go on without.
+    if (message.msg_flags & MSG_CTRUNC) {
+      error = boost::asio::error::message_size;
+    } else if (!result) {
+      error = boost::asio::error::eof;
+    }
+
+    return static_cast<std::size_t>(result);
   }
+#endif
 
   /**
+   * Same as _begin_read_until() and _begin_read_some(), for servers that
+   * support compression or receive descriptors. Whatever the socket has is received into a
+   * pooled buffer and passed through _receive(), and receiving continues
+   * until a whole frame sits in the connection's read buffer.
+   * 
+   * @param connection The socket connection.
+   * @param nbytes The number of bytes to receive, or zero to read until the delimeter.
+   * @param event_id The id of the READ_BEGIN event for this read.
+   *
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  void set_read_mode(
-    int8_t mode)
+  void _begin_buffered_read(
+    ConnectionP connection,
+    std::size_t nbytes,
+    uint64_t event_id)
   {
-    _read_mode = mode;
+    if (std::size_t nbytes_framed = _buffered_frame_nbytes(*connection, nbytes)) {
+      boost::asio::post(_executor, [this, connection = std::move(connection), nbytes_framed, event_id]() mutable {
+        _handle_read(std::move(connection), event_id, nbytes_framed, boost::system::error_code());
+      });
+      return;
+    }
+
+    ConnectionTy& target = *connection;
+    StreamBufferP chunk = _acquire_buffer();
+    boost::asio::mutable_buffer space = chunk->prepare(_receive_chunk_nbytes);
+
+    target._is_reading = true;
+
+    _async_receive(target, space,
+      [this, connection = std::move(connection), chunk = std::move(chunk), nbytes, event_id](
+        boost::system::error_code error,
+        std::size_t nbytes_received) mutable
+      {
+        connection->_is_reading = false;
+
+        if (nbytes_received) {
+          StreamBuffer& buffer = *connection->read_buffer;
+
+          chunk->commit(nbytes_received);
+
+          // A connection paused for a handoff keeps the bytes as they
+          // came, since its read buffer goes along with its socket.
+          if (connection->_is_closed) {
+            buffer.commit(boost::asio::buffer_copy(buffer.prepare(nbytes_received), chunk->data()));
+          } else if (!_receive(*connection, chunk->data(), error)) {
+            _release_buffer(std::move(chunk));
+            _handle_read(std::move(connection), event_id, 0, error);
+            return;
+          }
+        }
+
+        _release_buffer(std::move(chunk));
+
+        if (!error) {
+          if (std::size_t nbytes_framed = _buffered_frame_nbytes(*connection, nbytes)) {
+            _handle_read(std::move(connection), event_id, nbytes_framed, error);
+          } else if (!connection->_is_closed) {
+            _begin_buffered_read(std::move(connection), nbytes, event_id);
+          }
+          return;
+        }
+
+        std::size_t nbytes_available = nbytes ? std::min(nbytes, connection->read_buffer->size()) : 0;
+        _handle_read(std::move(connection), event_id, nbytes_available, error);
+      },
+      _HasDescriptorPassing()
+    );
   }
 
   /**
+   * Receives whatever the passed connection's socket has into the passed
+   * space without blocking.
+   * 
+   * @param connection The socket connection.
+   * @param space Where to receive to.
+   * @param error Set on failure, to would_block if there is nothing to receive yet.
+   *
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  void set_read_delimeter(
-    const std::string& delimeter)
+  std::size_t _receive_now(
+    ConnectionTy& connection,
+    boost::asio::mutable_buffer space,
+    boost::system::error_code& error,
+    std::false_type)
   {
-    _read_delimeter = delimeter;
-  }
+    ssize_t result;
 
-  /**
+    do {
+      result = ::recv(connection.socket.lowest_layer().native_handle(), space.data(), space.size(), MSG_DONTWAIT);
+    } while (result < 0 && errno == EINTR);
+
+    if (result < 0) {
+      error = boost::system::error_code(errno, boost::system::system_category());
+      return 0;
+    }
+
+    if (!result) {
+      error = boost::asio::error::eof;
+    }
+
+    return static_cast<std::size_t>(result);
+  }
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  /**
+   * Same as above, for local sockets, keeping any descriptors sent along
+   * with the bytes.
+   * 
+   * @param connection The socket connection.
+   * @param space Where to receive to.
+   * @param error Set on failure, to would_block if there is nothing to receive yet.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::size_t _receive_now(
+    ConnectionTy& connection,
+    boost::asio::mutable_buffer space,
+    boost::system::error_code& error,
+    std::true_type)
+  {
+    return _receive_descriptors(connection, space, error);
+  }
+#endif
+
+  /**
+   * Same as _begin_buffered_read(), sizing receives to the connection's
+   * traffic. The connection waits for its socket to become readable
+   * without holding any buffer, and only then takes a chunk from the pool
+   * of the size class its read estimate calls for, receives into it, and
+   * hands it straight back. An idle connection therefore holds no read
+   * memory at all, once whatever it had buffered has been framed.
+   * 
+   * @param connection The socket connection.
+   * @param nbytes The number of bytes to receive, or zero to read until the delimeter.
+   * @param event_id The id of the READ_BEGIN event for this read.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _begin_adaptive_read(
+    ConnectionP connection,
+    std::size_t nbytes,
+    uint64_t event_id)
+  {
+    if (std::size_t nbytes_framed = _buffered_frame_nbytes(*connection, nbytes)) {
+      boost::asio::post(_executor, [this, connection = std::move(connection), nbytes_framed, event_id]() mutable {
+        _handle_read(std::move(connection), event_id, nbytes_framed, boost::system::error_code());
+      });
+      return;
+    }
+
+    ConnectionTy& target = *connection;
+
+    // A read buffer left empty by the last frame gives its memory back
+    // before the connection goes idle.
+    if (!target.read_buffer->size() && target.read_buffer->capacity() > _min_read_chunk_nbytes) {
+      target.read_buffer = std::make_shared<StreamBuffer>();
+    }
+
+    target.socket.lowest_layer().async_wait(ConnectionTy::Socket::lowest_layer_type::wait_read,
+      es::make_custom_alloc_handler(target._read_memory,
+        [this, connection = std::move(connection), nbytes, event_id](
+          boost::system::error_code error) mutable
+        {
+          if (connection->_is_closed) {
+            return;
+          }
+
+          std::size_t nbytes_received = 0;
+
+          if (!error) {
+            unsigned size_class = _read_chunk_class_of(*connection);
+            std::size_t chunk_nbytes = _min_read_chunk_nbytes << size_class;
+            std::unique_ptr<char[]> chunk = _acquire_read_chunk(size_class);
+
+            nbytes_received = _receive_now(*connection, boost::asio::buffer(chunk.get(), chunk_nbytes), error, _HasDescriptorPassing());
+
+            if (error == boost::asio::error::would_block || error == boost::asio::error::try_again) {
+              _release_read_chunk(size_class, std::move(chunk));
+              _begin_adaptive_read(std::move(connection), nbytes, event_id);
+              return;
+            }
+
+            if (nbytes_received) {
+              _update_read_estimate(*connection, nbytes_received, chunk_nbytes);
+
+              if (!_receive(*connection, boost::asio::buffer(chunk.get(), nbytes_received), error)) {
+                _release_read_chunk(size_class, std::move(chunk));
+                _handle_read(std::move(connection), event_id, 0, error);
+                return;
+              }
+            }
+
+            _release_read_chunk(size_class, std::move(chunk));
+          }
+
+          if (!error) {
+            if (std::size_t nbytes_framed = _buffered_frame_nbytes(*connection, nbytes)) {
+              _handle_read(std::move(connection), event_id, nbytes_framed, error);
+            } else {
+              _begin_adaptive_read(std::move(connection), nbytes, event_id);
+            }
+            return;
+          }
+
+          std::size_t nbytes_available = nbytes ? std::min(nbytes, connection->read_buffer->size()) : 0;
+          _handle_read(std::move(connection), event_id, nbytes_available, error);
+        }
+      )
+    );
+  }
+
+  /**
+   * Same as _begin_read_until() and _begin_read_some(), receiving through
+   * the io_uring engine. Received bytes land in one of the engine's
+   * provided buffers and are appended to the connection's read buffer,
+   * and receiving continues until a whole frame is buffered.
+   * 
+   * @param connection The socket connection.
+   * @param nbytes The number of bytes to receive, or zero to read until the delimeter.
+   * @param event_id The id of the READ_BEGIN event for this read.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _begin_uring_read(
+    ConnectionP connection,
+    std::size_t nbytes,
+    uint64_t event_id)
+  {
+    if (std::size_t nbytes_framed = _buffered_frame_nbytes(*connection, nbytes)) {
+      boost::asio::post(_executor, [this, connection = std::move(connection), nbytes_framed, event_id]() mutable {
+        _handle_read(std::move(connection), event_id, nbytes_framed, boost::system::error_code());
+      });
+      return;
+    }
+
+    ConnectionTy& target = *connection;
+
+    target._engine_op = _uring->recv(target.socket.lowest_layer().native_handle(),
+      [this, connection = std::move(connection), nbytes, event_id](
+        int result,
+        const char* data) mutable
+      {
+        connection->_engine_op = 0;
+
+        if (result > 0) {
+          boost::system::error_code error;
+
+          if (!_receive(*connection, boost::asio::buffer(data, result), error)) {
+            _handle_read(std::move(connection), event_id, 0, error);
+            return;
+          }
+
+          if (std::size_t nbytes_framed = _buffered_frame_nbytes(*connection, nbytes)) {
+            _handle_read(std::move(connection), event_id, nbytes_framed, boost::system::error_code());
+          } else if (!connection->_is_closed) {
+            _begin_uring_read(std::move(connection), nbytes, event_id);
+          }
+          return;
+        }
+
+        // Every provided buffer was in use; they are handed back as soon
+        // as their completions have been dispatched.
+        if (result == -ENOBUFS && !connection->_is_closed) {
+          _begin_uring_read(std::move(connection), nbytes, event_id);
+          return;
+        }
+
+        boost::system::error_code error = result
+          ? boost::system::error_code(-result, boost::system::system_category())
+          : boost::system::error_code(boost::asio::error::eof);
+
+        std::size_t nbytes_available = nbytes ? std::min(nbytes, connection->read_buffer->size()) : 0;
+        _handle_read(std::move(connection), event_id, nbytes_available, error);
+      }
+    );
+  }
+
+  /**
+   * Arms the read timer of the passed connection, if a read timeout is
+   * set. The pending read is cancelled if the timer expires first.
+   * 
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _begin_read_timer(
+    const ConnectionP& connection)
+  {
+    if (!_read_timeout_seconds) {
+      return;
+    }
+
+    connection->read_timer.expires_from_now(boost::posix_time::seconds(_read_timeout_seconds));
+    connection->read_timer.async_wait(
+      es::make_custom_alloc_handler(connection->_timer_memory,
+        [this, connection](
+          boost::system::error_code error)
+        {
+          if (!error && connection->read_timer.expires_at() <= boost::asio::deadline_timer::traits_type::now()) {
+            _handle_read_timeout(connection);
+          }
+        }
+      )
+    );
+  }
+
+  /**
+   * Returns an empty buffer from the pool, or a new one if the pool is
+   * empty. Pooled buffers keep the memory they grew to, so a steady
+   * stream of similar payloads stops allocating.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  StreamBufferP _acquire_buffer()
+  {
+    if (_buffer_pool.empty()) {
+      return std::make_shared<StreamBuffer>();
+    }
+
+    StreamBufferP buffer = std::move(_buffer_pool.back());
+    _buffer_pool.pop_back();
+
+    return buffer;
+  }
+
+  /**
+   * Empties the passed buffer and puts it back into the pool, unless
+   * the pool is full or the buffer is still referenced elsewhere.
+   * 
+   * @param buffer The buffer.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _release_buffer(
+    StreamBufferP buffer)
+  {
+    if (buffer && buffer.use_count() == 1 && _buffer_pool.size() < _max_pooled_buffers) {
+      buffer->consume(buffer->size());
+      _buffer_pool.push_back(std::move(buffer));
+    }
+  }
+
+  /**
+   * Returns the size class of the next receive of the passed connection:
+   * the power of two at or above its read estimate, from 256 bytes up to
+   * 64 KB.
+   * 
+   * @param connection The socket connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  unsigned _read_chunk_class_of(
+    const ConnectionTy& connection) const
+  {
+    unsigned size_class = 0;
+
+    while (size_class + 1 < _nread_chunk_classes && (_min_read_chunk_nbytes << size_class) < connection._read_estimate) {
+      size_class++;
+    }
+
+    return size_class;
+  }
+
+  /**
+   * Returns a receive chunk of the passed size class from its pool, or a
+   * new one if the pool is empty.
+   * 
+   * @param size_class The size class, where class n holds 256 << n bytes.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::unique_ptr<char[]> _acquire_read_chunk(
+    unsigned size_class)
+  {
+    std::vector<std::unique_ptr<char[]>>& pool = _read_chunk_pools[size_class];
+
+    if (pool.empty()) {
+      return std::unique_ptr<char[]>(new char[_min_read_chunk_nbytes << size_class]);
+    }
+
+    std::unique_ptr<char[]> chunk = std::move(pool.back());
+    pool.pop_back();
+
+    return chunk;
+  }
+
+  /**
+   * Puts the passed receive chunk back into the pool of its size class,
+   * unless the pool is full.
+   * 
+   * @param size_class The size class the chunk was acquired with.
+   * @param chunk The chunk.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _release_read_chunk(
+    unsigned size_class,
+    std::unique_ptr<char[]> chunk)
+  {
+    std::vector<std::unique_ptr<char[]>>& pool = _read_chunk_pools[size_class];
+
+    if (pool.size() < _max_pooled_buffers) {
+      pool.push_back(std::move(chunk));
+    }
+  }
+
+  /**
+   * Moves the passed connection's read estimate towards the size of the
+   * receive that just completed. A receive that filled its whole chunk
+   * doubles the estimate, so bulk transfers reach large chunks within a
+   * few reads, while smaller receives pull it down a quarter of the way
+   * at a time.
+   * 
+   * @param connection The socket connection.
+   * @param nbytes_received The number of bytes received.
+   * @param chunk_nbytes The size of the chunk received into.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _update_read_estimate(
+    ConnectionTy& connection,
+    std::size_t nbytes_received,
+    std::size_t chunk_nbytes)
+  {
+    std::size_t& estimate = connection._read_estimate;
+
+    if (nbytes_received == chunk_nbytes) {
+      estimate = chunk_nbytes * 2;
+    } else if (nbytes_received > estimate) {
+      estimate += (nbytes_received - estimate + 3) / 4;
+    } else {
+      estimate -= (estimate - nbytes_received) / 4;
+    }
+  }
+
+  /**
+   * Queues the READ_HANDLE event of the passed frame, decoding it first
+   * unless the server uses the RawCodec. Returns false if the codec
+   * rejected the frame, in which case the error has been reported.
+   * 
+   * @param connection The socket connection.
+   * @param frame The received frame.
+   * @param nbytes The size of the frame.
+   * @param unique_id The id of the READ_BEGIN event for this read.
+   * @param error The error the read ended with, if any (e.g. eof after a last partial frame.)
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool _deliver_frame(
+    const ConnectionP& connection,
+    StreamBufferP frame,
+    std::size_t nbytes,
+    uint64_t unique_id,
+    boost::system::error_code error)
+  {
+    if (std::is_same<_CodecTy, RawCodec>::value) {
+      _push_event<ReadEvent>(
+        std::move(frame), nbytes, connection->handle, es::READ_HANDLE, _protocol, unique_id, error
+      );
+      return true;
+    }
+
+    Message message;
+    boost::system::error_code decode_error;
+
+    if (!_codec.decode(connection->handle, frame, message, decode_error)) {
+      _handle_error(connection->handle, Error(es::ERROR_READ, decode_error ? decode_error : boost::system::error_code(boost::asio::error::invalid_argument)));
+      return false;
+    }
+
+    _push_event<MessageEvent<Message>>(
+      std::move(message), std::move(frame), nbytes, connection->handle, es::READ_HANDLE, _protocol, unique_id, error
+    );
+
+    return true;
+  }
+
+  /**
+   * Moves the first nbytes of the connection's read buffer into a buffer
+   * of their own. When the read buffer holds nothing else the buffer
+   * itself is handed over and the connection is given a fresh one.
+   * 
+   * @param connection The socket connection.
+   * @param nbytes The number of bytes making up the frame.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  StreamBufferP _take_frame(
+    ConnectionTy& connection,
+    std::size_t nbytes)
+  {
+    StreamBufferP frame;
+
+    if (connection.read_buffer->size() == nbytes) {
+      frame = std::move(connection.read_buffer);
+      connection.read_buffer = std::make_shared<StreamBuffer>();
+    } else {
+      frame = std::make_shared<StreamBuffer>();
+      frame->commit(boost::asio::buffer_copy(frame->prepare(nbytes), connection.read_buffer->data(), nbytes));
+      connection.read_buffer->consume(nbytes);
+    }
+
+    return frame;
+  }
+
+  /**
+   * 
+   * 
+   * @param connection The socket connection.
+   * @param unique_id The id of the READ_BEGIN event for this read.
+   * @param nbytes_received The number of bytes making up the received frame.
+   * @param error The error container. Expected generic/blank if there was no error.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _handle_read(
+    ConnectionP connection,
+    uint64_t unique_id,
+    std::size_t nbytes_received,
+    boost::system::error_code error)
+  {
+    connection->read_timer.expires_at(boost::posix_time::pos_infin);
+
+    if (connection->_is_closed || error == boost::asio::error::operation_aborted) {
+      return;
+    }
+
+    if (nbytes_received) {
+      StreamBufferP frame = _take_frame(*connection, nbytes_received);
+
+      if (_capture) {
+        _capture->append(es::CAPTURE_READ, connection->handle, frame->data());
+      }
+
+      if (_socket_options.quick_ack) {
+        boost::system::error_code ignored;
+        SocketOptions::apply_quick_ack(connection->socket.lowest_layer(), ignored);
+      }
+
+      if (!_deliver_frame(connection, std::move(frame), nbytes_received, unique_id, error)) {
+        _close(connection);
+        return;
+      }
+    }
+
+    if (error || !nbytes_received) {
+      _handle_error(connection->handle, Error(es::ERROR_READ, error));
+      _close_after_send(connection);
+    } else if (_is_auto_read()) {
+      _continue_reading(std::move(connection), nbytes_received);
+    }
+  }
+
+  /**
+   * Registers a newly established connection, giving it the per
+   * connection read rate limit and socket options, and returns its
+   * handle. Options the system refuses are skipped; the first such
+   * failure is reported through an ERROR_HANDLE event. If the connection
+   * table is full, the connection is closed, the failure is reported
+   * and NULL_HANDLE is returned.
+   * 
+   * @param connection The socket connection.
+   * @param error_state The error state a full table is reported with.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  ConnectionHandle _insert(
+    const ConnectionP& connection,
+    int error_state = es::ERROR_ACCEPT)
+  {
+    boost::system::error_code error;
+    ConnectionHandle handle = _connections.insert(connection);
+
+    if (handle == es::NULL_HANDLE) {
+      connection->socket.lowest_layer().close(error);
+      _handle_error(es::NULL_HANDLE, Error(error_state, boost::asio::error::no_buffer_space));
+      return es::NULL_HANDLE;
+    }
+
+    connection->read_limiter = _connection_read_limiter;
+    connection->_is_negotiating = static_cast<bool>(_compressor_factory);
+    _socket_options.apply(connection->socket.lowest_layer(), error);
+
+    if (error && !_is_socket_options_error_reported) {
+      _is_socket_options_error_reported = true;
+      _handle_error(handle, Error(es::ERROR_ACCEPT, error));
+    }
+
+    if (_capture) {
+      _capture->append(es::CAPTURE_OPEN, handle);
+    }
+
+    return handle;
+  }
+
+  /**
+   * Starts the next read of a connection that just received a frame of
+   * the passed size. The read is delayed for as long as the connection's
+   * or the server's rate limit is exceeded.
+   * 
+   * @param connection The socket connection.
+   * @param nbytes_received The size of the frame just received.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _continue_reading(
+    ConnectionP connection,
+    std::size_t nbytes_received)
+  {
+    if (connection->read_limiter.is_limited() || _read_limiter.is_limited()) {
+      TokenBucket::Clock::time_point now = TokenBucket::Clock::now();
+      std::chrono::microseconds delay = std::max(
+        connection->read_limiter.consume(nbytes_received, now),
+        _read_limiter.consume(nbytes_received, now)
+      );
+
+      // No read is pending while throttled, so the read timer is free to
+      // time the wait.
+      if (delay.count() > 0) {
+        ConnectionTy& target = *connection;
+
+        target.read_timer.expires_from_now(boost::posix_time::microseconds(delay.count()));
+        target.read_timer.async_wait(
+          es::make_custom_alloc_handler(target._timer_memory,
+            [this, connection = std::move(connection)](
+              boost::system::error_code error) mutable
+            {
+              if (!error && !connection->_is_closed) {
+                _schedule_read(std::move(connection));
+              }
+            }
+          )
+        );
+        return;
+      }
+    }
+
+    _schedule_read(std::move(connection));
+  }
+
+  /**
+   * Starts the next read of the passed connection, unless it already
+   * used up its reads for the current update(), in which case the read
+   * is started by the next update() instead. Deferred reads are resumed
+   * in the order they were deferred, so every busy connection gets its
+   * turn. With an event handler set, the read is posted instead.
+   * 
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _schedule_read(
+    ConnectionP connection)
+  {
+    if (_max_reads_per_update) {
+      if (connection->_read_epoch != _update_epoch) {
+        connection->_read_epoch = _update_epoch;
+        connection->_nreads_in_epoch = 0;
+      }
+
+      if (++connection->_nreads_in_epoch > _max_reads_per_update) {
+        // Without update() calls, letting the handlers queued meanwhile
+        // run first is what gives every connection its turn.
+        if (_has_event_handler()) {
+          connection->_nreads_in_epoch = 0;
+          boost::asio::post(_executor, [this, connection = std::move(connection)]() mutable {
+            if (!connection->_is_closed) {
+              _begin_read(std::move(connection));
+            }
+          });
+        } else {
+          _deferred_reads.push_back(std::move(connection));
+        }
+        return;
+      }
+    }
+
+    _begin_read(std::move(connection));
+  }
+
+  /**
+   * Called when a read on the passed connection took longer than the set
+   * read timeout. The connection is closed once its pending sends are
+   * done; a read that was merely cancelled would leave it open with
+   * nothing reading from it.
+   * 
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _handle_read_timeout(
+    const ConnectionP& connection)
+  {
+    _push_event<Event>(
+      connection->handle, es::READ_TIMEOUT, _protocol
+    );
+
+    _close_after_send(connection);
+  }
+
+  /**
+   * Reports the passed error through an ERROR_HANDLE event. A clean end
+   * of stream and operations cancelled by the server itself are part of
+   * the normal life of a connection and are not reported.
+   * 
+   * @param handle The handle of the connection, or NULL_HANDLE.
+   * @param error The error.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _handle_error(
+    ConnectionHandle handle,
+    const Error& error)
+  {
+    if (!error || error.is_cancelled() || error.code == boost::asio::error::eof) {
+      return;
+    }
+
+    _push_event<Event>(
+      handle, es::ERROR_HANDLE, _protocol, error
+    );
+  }
+
+  /**
+   * Doubles the accept backoff, starting at 10ms and capping at one
+   * second, and returns the new value.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  boost::posix_time::time_duration _next_accept_backoff()
+  {
+    if (_accept_backoff < boost::posix_time::milliseconds(10)) {
+      _accept_backoff = boost::posix_time::milliseconds(10);
+    } else if (_accept_backoff < boost::posix_time::milliseconds(1000)) {
+      _accept_backoff = std::min<boost::posix_time::time_duration>(_accept_backoff * 2, boost::posix_time::milliseconds(1000));
+    }
+
+    return _accept_backoff;
+  }
+
+  /**
+   * Reports a failed accept of a listening server and decides when to
+   * try again. A peer that gave up before being accepted is retried right
+   * away. Anything else, most notably running out of file descriptors,
+   * would fail again just as fast, so the next accept is delayed by a
+   * backoff that doubles up to one second. Servers reset the backoff once
+   * an accept succeeds.
+   * 
+   * @param error The accept error.
+   * @param retry Starts the next accept.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class RetryTy>
+  void _handle_accept_error(
+    const Error& error,
+    RetryTy retry)
+  {
+    if (error.is_cancelled()) {
+      return;
+    }
+
+    _handle_error(es::NULL_HANDLE, error);
+
+    if (error.is_disconnect()) {
+      retry();
+      return;
+    }
+
+    _accept_timer.expires_from_now(_next_accept_backoff());
+    _accept_timer.async_wait([retry = std::move(retry)](boost::system::error_code error) mutable {
+      if (!error) {
+        retry();
+      }
+    });
+  }
+
+  /**
+   * Stops all activity on the passed connection so its socket and
+   * buffered bytes can be handed to another process. Only connections
+   * with nothing to send and no state beyond their read buffer qualify;
+   * returns false, leaving the connection alone, for any other.
+   *
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool _pause_for_handoff(
+    const ConnectionP& connection)
+  {
+    if (_uring || connection->_is_closed || connection->_is_sending || !connection->write_queue.empty()
+      || connection->_close_pending || connection->_shutdown_pending
+      || connection->_compressor || !connection->descriptors.empty())
+    {
+      return false;
+    }
+
+    boost::system::error_code ignored;
+
+    // Marked closed so that the aborted read, and any delayed or deferred
+    // one, leave the connection alone.
+    connection->_is_closed = true;
+    connection->read_timer.cancel(ignored);
+    connection->socket.lowest_layer().cancel(ignored);
+
+    return true;
+  }
+
+  /**
+   * Returns true once the read cancelled by _pause_for_handoff() has
+   * completed. Until then, bytes it already received may not have reached
+   * the connection's read buffer. A composed read whose step completed
+   * before the pause goes on to its next step, so the socket is cancelled
+   * again while the read is still pending.
+   *
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool _is_ready_for_handoff(
+    const ConnectionP& connection)
+  {
+    if (!connection->_is_reading) {
+      return true;
+    }
+
+    boost::system::error_code ignored;
+
+    connection->socket.lowest_layer().cancel(ignored);
+
+    return false;
+  }
+
+  /**
+   * Takes back a connection paused by _pause_for_handoff() after the
+   * handoff failed.
+   *
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _resume_after_handoff(
+    const ConnectionP& connection)
+  {
+    connection->_is_closed = false;
+
+    if (_is_auto_read()) {
+      _begin_read(connection);
+    }
+  }
+
+  /**
+   * Forgets a connection another process has adopted. Its socket is
+   * closed without being shut down, which would end the connection for
+   * the adopting process as well.
+   *
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _release_after_handoff(
+    const ConnectionP& connection)
+  {
+    boost::system::error_code ignored;
+
+    connection->socket.lowest_layer().close(ignored);
+    connection->_is_closed = false;
+    _close(connection);
+  }
+
+  /**
+   * Shuts down and closes the socket of the passed connection, fails any
+   * payloads still waiting in its write queue, and removes it from the
+   * connection table. Does nothing if the connection is already closed.
+   * The close handler, if set, is called before the connection is erased.
+   *
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _close(
+    const ConnectionP& connection)
+  {
+    if (connection->_is_closed) {
+      return;
+    }
+
+    boost::system::error_code ignored;
+
+    connection->_is_closed = true;
+    connection->read_timer.cancel(ignored);
+
+    // Requests still queued for the engine must reach the kernel before
+    // the descriptor is closed and possibly reused by a new connection.
+    if (_uring) {
+      if (connection->_engine_op) {
+        _uring->cancel(connection->_engine_op);
+      }
+
+      _uring->flush();
+    }
+
+    connection->socket.lowest_layer().shutdown(boost::asio::socket_base::shutdown_both, ignored);
+    connection->socket.lowest_layer().close(ignored);
+
+    if (connection->_compressor) {
+      _release_compressor(std::move(connection->_compressor));
+    }
+
+    while (!connection->descriptors.empty()) {
+      ::close(connection->descriptors.front());
+      connection->descriptors.pop_front();
+    }
+
+    // The payload at the front (if any) is still owned by the pending
+    // write, which reports its own completion once it is aborted.
+    std::deque<Transfer> aborted;
+
+    while (connection->write_queue.size() > (connection->_is_sending ? 1 : 0)) {
+      aborted.push_back(std::move(connection->write_queue.back()));
+      connection->write_queue.pop_back();
+    }
+
+    if (_capture) {
+      _capture->append(es::CAPTURE_CLOSE, connection->handle);
+    }
+
+    _push_event<Event>(
+      connection->handle, es::CLOSE_HANDLE, _protocol
+    );
+
+    // The passed pointer may live in the table, and so must not be used
+    // once the connection has been erased from it.
+    ConnectionHandle handle = connection->handle;
+
+    if (_close_handler) {
+      _close_handler(connection);
+    }
+
+    _connections.erase(handle);
+
+    if (_is_stopping && !_connections.size()) {
+      _drain_timer.cancel(ignored);
+    }
+
+    while (!aborted.empty()) {
+      _complete_send(handle, aborted.back(), 0, boost::asio::error::operation_aborted);
+      aborted.pop_back();
+    }
+  }
+
+  /**
+   * Closes the passed connection once everything in its write queue has
+   * been sent, or right away if nothing is queued.
+   *
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _close_after_send(
+    const ConnectionP& connection)
+  {
+    if (connection->_is_sending) {
+      connection->_close_pending = true;
+    } else {
+      _close(connection);
+    }
+  }
+
+  /**
+   * Shuts down the sending side of the passed connection once everything
+   * in its write queue has been sent, or right away if nothing is queued.
+   *
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _shutdown_after_send(
+    const ConnectionP& connection)
+  {
+    if (connection->_is_sending) {
+      connection->_shutdown_pending = true;
+    } else {
+      boost::system::error_code ignored;
+      connection->socket.lowest_layer().shutdown(boost::asio::socket_base::shutdown_send, ignored);
+    }
+  }
+
+  /**
+   * Starts writing the payload at the front of the connection's write
+   * queue. Only one payload is written at a time so that consecutive
+   * sends never interleave on the wire.
+   * 
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _begin_send(
+    ConnectionP connection)
+  {
+    ConnectionTy& target = *connection;
+
+    Transfer& transfer = target.write_queue.front();
+
+    target._is_sending = true;
+
+    // Compressing right before writing keeps the compressor's stream in
+    // the same order as the bytes on the wire.
+    if (target._compressor && !transfer.bypasses_compression) {
+      if (transfer.file >= 0) {
+        _send_file(std::move(connection), 0, std::false_type());
+        return;
+      }
+
+      StreamBufferP compressed = _acquire_buffer();
+      target._compressor->compress(transfer.payload->data(), *compressed);
+
+      if (transfer.is_pooled) {
+        _release_buffer(std::move(transfer.payload));
+      }
+
+      transfer.payload = std::move(compressed);
+      transfer.is_pooled = true;
+    }
+
+    if (transfer.file >= 0) {
+      _send_file(std::move(connection), 0, _HasKernelSendFile());
+      return;
+    }
+
+    if (!transfer.descriptors.empty()) {
+      _send_descriptors(std::move(connection), _HasDescriptorPassing());
+      return;
+    }
+
+    if (_uring) {
+      _begin_uring_send(std::move(connection), 0);
+      return;
+    }
+
+    boost::asio::async_write(
+      target.socket, *target.write_queue.front().payload,
+      es::make_custom_alloc_handler(target._send_memory,
+        [this, connection = std::move(connection)](
+          boost::system::error_code error,
+          std::size_t nbytes_sent) mutable
+        {
+          _handle_send(std::move(connection), nbytes_sent, error);
+        }
+      )
+    );
+  }
+
+  /**
+   * Same as _begin_send(), writing through the io_uring engine. Sent
+   * bytes are consumed from the payload, and sending continues until it
+   * is empty.
+   * 
+   * @param connection The socket connection.
+   * @param nbytes_sent The number of bytes of the payload sent so far.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _begin_uring_send(
+    ConnectionP connection,
+    std::size_t nbytes_sent)
+  {
+    ConnectionTy& target = *connection;
+    boost::asio::const_buffer payload = target.write_queue.front().payload->data();
+
+    _uring->send(target.socket.lowest_layer().native_handle(), payload.data(), payload.size(),
+      [this, connection = std::move(connection), nbytes_sent](
+        int result) mutable
+      {
+        if (result < 0) {
+          _handle_send(std::move(connection), nbytes_sent, boost::system::error_code(-result, boost::system::system_category()));
+          return;
+        }
+
+        StreamBuffer& payload = *connection->write_queue.front().payload;
+
+        payload.consume(result);
+        nbytes_sent += result;
+
+        // A send taking nothing with bytes left means the peer is gone.
+        if (!payload.size()) {
+          _handle_send(std::move(connection), nbytes_sent, boost::system::error_code());
+        } else if (connection->_is_closed) {
+          _handle_send(std::move(connection), nbytes_sent, boost::asio::error::operation_aborted);
+        } else if (!result) {
+          _handle_send(std::move(connection), nbytes_sent, boost::asio::error::broken_pipe);
+        } else {
+          _begin_uring_send(std::move(connection), nbytes_sent);
+        }
+      }
+    );
+  }
+
+#if defined(__linux__)
+  /**
+   * Sends the file range of the transfer at the front of the connection's
+   * write queue with sendfile(2), so the bytes go straight from the page
+   * cache to the socket without being copied through user space. Whenever
+   * the socket's send buffer fills up, the progress is reported and
+   * sending resumes once the socket becomes writable again.
+   * 
+   * @param connection The socket connection.
+   * @param nbytes_sent The number of bytes of the range sent so far.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _send_file(
+    ConnectionP connection,
+    std::size_t nbytes_sent,
+    std::true_type)
+  {
+    ConnectionTy& target = *connection;
+    Transfer& transfer = target.write_queue.front();
+    typename ConnectionTy::Socket& socket = target.socket;
+    std::size_t nbytes_reported = nbytes_sent;
+    boost::system::error_code error;
+
+    socket.non_blocking(true, error);
+
+    while (!error && nbytes_sent < transfer.file_nbytes) {
+      off_t offset = static_cast<off_t>(transfer.file_offset + nbytes_sent);
+      std::size_t nbytes = std::min<std::size_t>(transfer.file_nbytes - nbytes_sent, 0x7FFFF000);
+      ssize_t result = ::sendfile(socket.native_handle(), transfer.file, &offset, nbytes);
+
+      if (result > 0) {
+        nbytes_sent += result;
+      } else if (!result) {
+        error = boost::asio::error::eof;
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (nbytes_sent > nbytes_reported) {
+          _report_file_progress(connection, nbytes_sent);
+        }
+
+        socket.async_wait(ConnectionTy::Socket::wait_write,
+          es::make_custom_alloc_handler(target._send_memory,
+            [this, connection = std::move(connection), nbytes_sent](
+              boost::system::error_code error) mutable
+            {
+              if (error) {
+                _handle_send(std::move(connection), nbytes_sent, error);
+              } else {
+                _send_file(std::move(connection), nbytes_sent, std::true_type());
+              }
+            }
+          )
+        );
+        return;
+      } else if (errno != EINTR) {
+        error = boost::system::error_code(errno, boost::system::system_category());
+      }
+    }
+
+    boost::asio::post(_executor, [this, connection = std::move(connection), nbytes_sent, error]() mutable {
+      _handle_send(std::move(connection), nbytes_sent, error);
+    });
+  }
+#endif
+
+  /**
+   * Same as above, for sockets the kernel cannot send files to directly
+   * (TLS, compressed connections, or systems without sendfile). The file
+   * range is read with pread() into pooled chunks that are written one
+   * after the other, each compressed first on compressed connections.
+   * The progress is reported after every chunk but the last.
+   * 
+   * @param connection The socket connection.
+   * @param nbytes_sent The number of bytes of the range sent so far.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _send_file(
+    ConnectionP connection,
+    std::size_t nbytes_sent,
+    std::false_type)
+  {
+    Transfer& transfer = connection->write_queue.front();
+
+    if (nbytes_sent >= transfer.file_nbytes) {
+      boost::asio::post(_executor, [this, connection = std::move(connection), nbytes_sent]() mutable {
+        _handle_send(std::move(connection), nbytes_sent, boost::system::error_code());
+      });
+      return;
+    }
+
+    StreamBufferP chunk = _acquire_buffer();
+
+    std::size_t nbytes = std::min(transfer.file_nbytes - nbytes_sent, _file_chunk_nbytes);
+    boost::asio::mutable_buffer space = chunk->prepare(nbytes);
+    ssize_t result;
+
+    do {
+      result = ::pread(transfer.file, space.data(), nbytes, static_cast<off_t>(transfer.file_offset + nbytes_sent));
+    } while (result < 0 && errno == EINTR);
+
+    if (result <= 0) {
+      boost::system::error_code error = result
+        ? boost::system::error_code(errno, boost::system::system_category())
+        : boost::system::error_code(boost::asio::error::eof);
+
+      _release_buffer(std::move(chunk));
+      boost::asio::post(_executor, [this, connection = std::move(connection), nbytes_sent, error]() mutable {
+        _handle_send(std::move(connection), nbytes_sent, error);
+      });
+      return;
+    }
+
+    chunk->commit(result);
+
+    ConnectionTy& target = *connection;
+    bool is_compressed = static_cast<bool>(target._compressor);
+
+    if (is_compressed) {
+      StreamBufferP compressed = _acquire_buffer();
+
+      target._compressor->compress(chunk->data(), *compressed);
+      _release_buffer(std::move(chunk));
+      chunk = std::move(compressed);
+    }
+
+    StreamBuffer& buffer = *chunk;
+
+    boost::asio::async_write(
+      target.socket, buffer,
+      es::make_custom_alloc_handler(target._send_memory,
+        [this, connection = std::move(connection), chunk = std::move(chunk), nbytes_sent, nbytes_read = static_cast<std::size_t>(result), is_compressed](
+          boost::system::error_code error,
+          std::size_t nbytes_written) mutable
+        {
+          _release_buffer(std::move(chunk));
+
+          // The range is counted in bytes of the file, which the bytes
+          // written only match when they were not compressed.
+          if (!error) {
+            nbytes_sent += nbytes_read;
+          } else if (!is_compressed) {
+            nbytes_sent += nbytes_written;
+          }
+
+          if (error) {
+            _handle_send(std::move(connection), nbytes_sent, error);
+          } else {
+            _report_file_progress(connection, nbytes_sent);
+            _send_file(std::move(connection), nbytes_sent, std::false_type());
+          }
+        }
+      )
+    );
+  }
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  /**
+   * Sends the transfer at the front of the connection's write queue with
+   * sendmsg(), passing its descriptors along with the first bytes of its
+   * payload. Whatever sendmsg() leaves of the payload is written as usual.
+   * 
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _send_descriptors(
+    ConnectionP connection,
+    std::true_type)
+  {
+    ConnectionTy& target = *connection;
+    Transfer& transfer = target.write_queue.front();
+
+    // Descriptors only travel along with at least one byte.
+    if (!transfer.payload || !transfer.payload->size()) {
+      boost::asio::post(_executor, [this, connection = std::move(connection)]() mutable {
+        _handle_send(std::move(connection), 0, boost::asio::error::invalid_argument);
+      });
+      return;
+    }
+
+    boost::asio::const_buffer payload = transfer.payload->data();
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * transfer.descriptors.size()));
+    iovec vector { const_cast<void*>(payload.data()), payload.size() };
+    msghdr message {};
+    int flags = MSG_DONTWAIT;
+    ssize_t result;
+
+#if defined(MSG_NOSIGNAL)
+    flags |= MSG_NOSIGNAL;
+#endif
+
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * transfer.descriptors.size());
+    std::memcpy(CMSG_DATA(header), transfer.descriptors.data(), sizeof(int) * transfer.descriptors.size());
+
+    do {
+      result = ::sendmsg(target.socket.native_handle(), &message, flags);
+    } while (result < 0 && errno == EINTR);
+
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      target.socket.async_wait(ConnectionTy::Socket::wait_write,
+        es::make_custom_alloc_handler(target._send_memory,
+          [this, connection = std::move(connection)](
+            boost::system::error_code error) mutable
+          {
+            if (error) {
+              _handle_send(std::move(connection), 0, error);
+            } else {
+              _send_descriptors(std::move(connection), std::true_type());
+            }
+          }
+        )
+      );
+      return;
+    }
+
+    if (result < 0) {
+      boost::system::error_code error(errno, boost::system::system_category());
+
+      boost::asio::post(_executor, [this, connection = std::move(connection), error]() mutable {
+        _handle_send(std::move(connection), 0, error);
+      });
+      return;
+    }
+
+    std::size_t nbytes_sent = static_cast<std::size_t>(result);
+
+    transfer.descriptors.clear();
+    transfer.payload->consume(nbytes_sent);
+
+    if (!transfer.payload->size()) {
+      boost::asio::post(_executor, [this, connection = std::move(connection), nbytes_sent]() mutable {
+        _handle_send(std::move(connection), nbytes_sent, boost::system::error_code());
+      });
+      return;
+    }
+
+    boost::asio::async_write(
+      target.socket, *transfer.payload,
+      es::make_custom_alloc_handler(target._send_memory,
+        [this, connection = std::move(connection), nbytes_sent](
+          boost::system::error_code error,
+          std::size_t nbytes_written) mutable
+        {
+          _handle_send(std::move(connection), nbytes_sent + nbytes_written, error);
+        }
+      )
+    );
+  }
+#endif
+
+  /**
+   * Same as above, for sockets that cannot pass descriptors.
+   * 
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _send_descriptors(
+    ConnectionP connection,
+    std::false_type)
+  {
+    boost::asio::post(_executor, [this, connection = std::move(connection)]() mutable {
+      _handle_send(std::move(connection), 0, boost::asio::error::operation_not_supported);
+    });
+  }
+
+  /**
+   * Reports the outcome of the passed transfer, either to its on_sent
+   * function or through a SEND_HANDLE event.
+   * 
+   * @param handle The handle of the connection.
+   * @param transfer The finished transfer.
+   * @param nbytes_sent The number of bytes sent.
+   * @param error The error container. Expected generic/blank if there was no error.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _complete_send(
+    ConnectionHandle handle,
+    Transfer& transfer,
+    std::size_t nbytes_sent,
+    boost::system::error_code error)
+  {
+    if (transfer.on_sent) {
+      transfer.on_sent(error, nbytes_sent);
+    } else {
+      _push_event<SendEvent>(
+        transfer.id, nbytes_sent, handle, es::SEND_HANDLE, _protocol, error
+      );
+    }
+
+    if (transfer.is_pooled) {
+      _release_buffer(std::move(transfer.payload));
+    }
+  }
+
+  /**
+   * Reports how much of the file transfer at the front of the passed
+   * connection's write queue has been sent so far, through a SEND_HANDLE
+   * event marked as partial. Transfers completing through a callback
+   * only report their completion.
+   * 
+   * @param connection The socket connection.
+   * @param nbytes_sent The number of bytes of the range sent so far.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _report_file_progress(
+    const ConnectionP& connection,
+    std::size_t nbytes_sent)
+  {
+    const Transfer& transfer = connection->write_queue.front();
+
+    if (!transfer.on_sent && nbytes_sent < transfer.file_nbytes) {
+      _push_event<SendEvent>(
+        transfer.id, nbytes_sent, connection->handle, es::SEND_HANDLE, _protocol, boost::system::error_code(), true
+      );
+    }
+  }
+
+  /**
+   * Appends the passed transfer to the connection's write queue, and
+   * starts sending if nothing else is being sent.
+   * 
+   * @param handle The handle of the connection.
+   * @param transfer The payload to send.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _queue_send(
+    ConnectionHandle handle,
+    Transfer transfer)
+  {
+    const ConnectionP& connection = _connections.find(handle);
+
+    if (!connection || connection->_close_pending || connection->_shutdown_pending) {
+      boost::asio::post(_executor, [this, handle, transfer = std::move(transfer)]() mutable {
+        _complete_send(handle, transfer, 0, boost::asio::error::bad_descriptor);
+      });
+      return;
+    }
+
+    // File ranges are only counted, which is all a replay needs to know
+    // of what the server sent.
+    if (_capture && transfer.payload) {
+      _capture->append(es::CAPTURE_SEND, handle, transfer.payload->data());
+    } else if (_capture && transfer.file >= 0) {
+      _capture->append_elided(es::CAPTURE_SEND, handle, transfer.file_nbytes);
+    }
+
+    connection->write_queue.push_back(std::move(transfer));
+
+    if (!connection->_is_sending) {
+      _begin_send(connection);
+    }
+  }
+
+  /**
+   * 
+   * 
+   * @param connection The socket connection.
+   * @param nbytes_sent The number of bytes sent.
+   * @param error The error container. Expected generic/blank if there was no error.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _handle_send(
+    ConnectionP connection,
+    std::size_t nbytes_sent,
+    boost::system::error_code error)
+  {
+    Transfer transfer = std::move(connection->write_queue.front());
+
+    connection->write_queue.pop_front();
+    connection->_is_sending = false;
+
+    _complete_send(connection->handle, transfer, nbytes_sent, error);
+
+    // Completing the transfer may have resumed code that already closed
+    // the connection or started the next send.
+    if (connection->_is_closed || connection->_is_sending) {
+      return;
+    }
+
+    if (error) {
+      _handle_error(connection->handle, Error(es::ERROR_SEND, error));
+      _close(connection);
+    } else if (!connection->write_queue.empty()) {
+      _begin_send(std::move(connection));
+    } else if (connection->_close_pending) {
+      _close(connection);
+    } else if (connection->_shutdown_pending) {
+      _shutdown_after_send(connection);
+    }
+  }
+public:
+  /**
+   * 
+   * 
+   * @param
+   * @param
+   * @param
+   * @param engine ENGINE_EPOLL, or ENGINE_IO_URING to perform I/O through io_uring where the kernel supports it.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  Server(
+    int8_t protocol,
+    const std::string& host,
+    uint16_t port,
+    int8_t engine = es::ENGINE_EPOLL)
+  : _auto_read(true),
+    _events_enabled(true),
+    _protocol(protocol),
+    _read_mode(es::READ_SOME),
+    _read_buffer_nbytes(1024),
+    _read_timeout_seconds(0),
+    _is_stopping(false),
+    _is_socket_options_error_reported(false),
+    _max_reads_per_update(0),
+    _update_epoch(0),
+    _previous_update_when(std::chrono::system_clock::now()),
+    _io_service(std::make_shared<boost::asio::io_service>()),
+    _executor(ThreadingPolicy::executor_of(*_io_service, false)),
+    _drain_timer(_executor),
+    _accept_timer(_executor),
+    _uring(engine == es::ENGINE_IO_URING ? UringEngine::create(_executor) : nullptr),
+    _is_read_sizing_adaptive(false),
+    _is_delivery_posted(false)
+  {}
+
+  /**
+   * Same as above, running on the passed io_service, which may be shared
+   * with other servers and run by the application's own threads instead
+   * of update(). The server's handlers run on a strand of their own, so
+   * any number of threads may run the io_service. When it is not run by
+   * update(), set an event handler to receive events, and only call into
+   * the server from that handler or through its executor().
+   * 
+   * @param
+   * @param io_service The io_service to run on.
+   * @param
+   * @param
+   * @param engine ENGINE_EPOLL, or ENGINE_IO_URING to perform I/O through io_uring where the kernel supports it.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  Server(
+    int8_t protocol,
+    IOServiceP io_service,
+    const std::string& host,
+    uint16_t port,
+    int8_t engine = es::ENGINE_EPOLL)
+  : _auto_read(true),
+    _events_enabled(true),
+    _protocol(protocol),
+    _read_mode(es::READ_SOME),
+    _read_buffer_nbytes(1024),
+    _read_timeout_seconds(0),
+    _is_stopping(false),
+    _is_socket_options_error_reported(false),
+    _max_reads_per_update(0),
+    _update_epoch(0),
+    _previous_update_when(std::chrono::system_clock::now()),
+    _io_service(io_service),
+    _executor(ThreadingPolicy::executor_of(*_io_service, true)),
+    _drain_timer(_executor),
+    _accept_timer(_executor),
+    _uring(engine == es::ENGINE_IO_URING ? UringEngine::create(_executor) : nullptr),
+    _is_read_sizing_adaptive(false),
+    _is_delivery_posted(false)
+  {}
+
+  /**
+   * Returns the most recent event, if there is one. If there is no event
+   * a "blank" event is returned that will be falsey.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  EventP poll()
+  {
+    if (!_events.empty()) {
+      EventP event = _events.front();
+      _events.pop();
+      return event;
+    }
+
+    return EventP();
+  }
+  
+  /**
+   * 
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  UpdateResult update()
+  {
+    boost::system::error_code error;
+
+    _update_epoch++;
+
+    if (!_deferred_reads.empty()) {
+      std::deque<ConnectionP> deferred;
+
+      deferred.swap(_deferred_reads);
+
+      for (ConnectionP& connection : deferred) {
+        if (!connection->_is_closed) {
+          _begin_read(std::move(connection));
+        }
+      }
+    }
+
+    if (_io_service->stopped()) {
+      _io_service->restart();
+    }
+
+    _io_service->run_one();
+    
+    std::size_t nhandles_executed = _io_service->poll(error);
+    std::chrono::system_clock::time_point when = std::chrono::system_clock::now();
+    std::chrono::milliseconds delta = std::chrono::duration_cast<std::chrono::milliseconds>(
+      _previous_update_when - when
+    );
+
+    _previous_update_when = when;
+
+    return UpdateResult(nhandles_executed, _protocol, error, delta);
+  }
+
+  /**
+   * Returns the connection with the passed handle, or null if there is no
+   * such connection. A connection leaves the table as soon as it closes,
+   * before its CLOSE_HANDLE event and possibly before READ_HANDLE events
+   * it queued earlier are polled, so the result must be checked even
+   * while handling an event of the connection. The pointer is only good
+   * until the server next runs handlers, e.g. in update().
+   * 
+   * @param handle The handle of the connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  ConnectionTy* connection(
+    ConnectionHandle handle) const
+  {
+    return _connections.find(handle).get();
+  }
+
+  /**
+   * Returns the io_service the server runs on.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  IOServiceP io_service() const {
+    return _io_service;
+  }
+
+  /**
+   * Returns the executor the server's handlers run on, as chosen by the
+   * threading policy. By default this is a strand when the server was
+   * given an io_service; anything calling into the server from threads
+   * running that io_service has to go through it, e.g. with
+   * boost::asio::dispatch().
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  const Executor& executor() const {
+    return _executor;
+  }
+
+  /**
+   * Takes over an already connected socket, which has to run on the
+   * server's io_service. The connection gets a handle and an ACCEPT_HANDLE
+   * event like any accepted one, and starts reading if auto reading is
+   * enabled. Returns NULL_HANDLE, reporting the error, if the socket
+   * could not be taken over.
+   * 
+   * @param socket The connected socket. Left closed.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  ConnectionHandle adopt(
+    typename ConnectionTy::Socket& socket)
+  {
+    boost::system::error_code error;
+    typename ConnectionTy::Socket::protocol_type protocol = socket.local_endpoint(error).protocol();
+    typename ConnectionTy::Socket::native_handle_type descriptor = error ? -1 : socket.release(error);
+    ConnectionP connection = std::make_shared<ConnectionTy>(_executor);
+
+    // The descriptor moves to a new socket, rather than the socket itself
+    // moving, so that the connection runs on the server's executor.
+    if (!error) {
+      connection->socket.assign(protocol, descriptor, error);
+
+      if (error) {
+        ::close(descriptor);
+      }
+    }
+
+    if (error) {
+      _handle_error(es::NULL_HANDLE, Error(es::ERROR_ACCEPT, error));
+      return es::NULL_HANDLE;
+    }
+
+    if (!_insert(connection)) {
+      return es::NULL_HANDLE;
+    }
+
+    _push_event<Event>(
+      connection->handle, es::ACCEPT_HANDLE, _protocol
+    );
+
+    if (_is_auto_read()) {
+      _begin_read(connection);
+    }
+
+    return connection->handle;
+  }
+
+  /**
+   * Returns the engine performing the server's I/O. This is ENGINE_EPOLL
+   * if io_uring was asked for but is not available on this system.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  int8_t engine() const {
+    return _uring ? es::ENGINE_IO_URING : es::ENGINE_EPOLL;
+  }
+
+  /**
+   * Returns the server's codec, for codecs that have settings of their
+   * own.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  _CodecTy& codec() {
+    return _codec;
+  }
+
+  /**
+   * Returns the number of open connections.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::size_t nconnections() const {
+    return _connections.size();
+  }
+
+  /**
+   * Returns the handles of every open connection, packed together so
+   * broadcasts and metrics walk them in one linear pass. The vector
+   * changes as connections open and close, so copy it first when the
+   * walk may close connections.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  const std::vector<ConnectionHandle>& handles() const {
+    return _connections.handles();
+  }
+  
+  /**
+   * Called when it is needed to receive data from the passed connection.
+   * 
+   * @param handle The handle of the connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t _begin_read(
+    ConnectionHandle handle)
+  {
+    return _begin_read(_connections.find(handle));
+  }
+
+  /**
+   * Same as above, for when the connection itself is already at hand.
+   * 
+   * @param connection The socket connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t _begin_read(
+    ConnectionP connection)
+  {
+    uint64_t event_id = es::make_uid();
+    int8_t read_mode = _current_read_mode();
+
+    if (!connection) {
+      return event_id;
+    }
+
+    _push_begin_event<Event>(
+      connection->handle, es::READ_BEGIN, _protocol, event_id
+    );
+
+    _begin_read_timer(connection);
+
+    if (_uring) {
+      _begin_uring_read(std::move(connection), read_mode == es::READ_UNTIL ? 0 : _read_buffer_nbytes, event_id);
+    } else if (_is_read_sizing_adaptive && _CanReceiveWhenReady::value) {
+      _begin_adaptive_read(std::move(connection), read_mode == es::READ_UNTIL ? 0 : _read_buffer_nbytes, event_id);
+    } else if (_compressor_factory || _HasDescriptorPassing::value) {
+      _begin_buffered_read(std::move(connection), read_mode == es::READ_UNTIL ? 0 : _read_buffer_nbytes, event_id);
+    } else if (read_mode == es::READ_UNTIL) {
+      _begin_read_until(std::move(connection), event_id);
+    } else if (read_mode == es::READ_AVAILABLE) {
+      _begin_read_available(std::move(connection), _read_buffer_nbytes, event_id);
+    } else {
+      _begin_read_some(std::move(connection), _read_buffer_nbytes, event_id);
+    }
+
+    return event_id;
+  }
+  
+  /**
+   * Called when it is needed to receive data from the passed connection
+   * for a predefined number of bytes. Servers whose read policy fixes
+   * the read mode read in that mode.
+   * 
+   * @param handle The handle of the connection.
+   * @param nbytes The number of bytes to receive.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t _begin_read_nbytes(
+    ConnectionHandle handle,
+    std::size_t nbytes)
+  {
+    int8_t previous_read_mode = _read_mode;
+    std::size_t previous_nbytes = _read_buffer_nbytes;
+
+    _read_mode = es::READ_SOME;
+    set_read_buffer_nbytes(nbytes);
+
+    uint64_t event_id = _begin_read(handle);
+
+    _read_mode = previous_read_mode;
+    set_read_buffer_nbytes(previous_nbytes);
+
+    return event_id;
+  }
+
+  /**
+   * Queues the passed buffer for sending. Payloads sent to the same
+   * connection are written in the order they were queued.
+   * 
+   * @param handle The handle of the connection.
+   * @param payload The bytes to send.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t sendb(
+    ConnectionHandle handle,
+    StreamBufferP payload)
+  {
+    uint64_t event_id = es::make_uid();
+
+    _push_begin_event<SendEvent>(
+      event_id, 0, handle, es::SEND_BEGIN, _protocol
+    );
+
+    _queue_send(handle, Transfer { event_id, std::move(payload), nullptr });
+
+    return event_id;
+  }
+
+  /**
+   * Encodes the passed message with the server's codec into a pooled
+   * buffer, and queues it for sending like sendb().
+   * 
+   * @param handle The handle of the connection.
+   * @param message The message to send.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t sendm(
+    ConnectionHandle handle,
+    const Message& message)
+  {
+    uint64_t event_id = es::make_uid();
+    Transfer transfer { event_id, _acquire_buffer(), nullptr };
+
+    transfer.is_pooled = true;
+    _codec.encode(handle, message, *transfer.payload);
+
+    _push_begin_event<SendEvent>(
+      event_id, 0, handle, es::SEND_BEGIN, _protocol
+    );
+
+    _queue_send(handle, std::move(transfer));
+
+    return event_id;
+  }
+
+  /**
+   * Queues part of an open file for sending. On Linux, plain TCP
+   * connections have the kernel copy the file straight to the socket;
+   * anything else reads and sends it in chunks. Either way the file is
+   * written in order with the connection's other sends. Progress is
+   * reported through SEND_HANDLE events with is_partial set, whenever the
+   * socket's send buffer fills up or a chunk has been written, and the
+   * final SEND_HANDLE event, without is_partial, reports how many bytes
+   * were transferred in total. The descriptor must stay open until then.
+   * 
+   * @param handle The handle of the connection.
+   * @param file The descriptor of the file to send.
+   * @param offset Where in the file to start.
+   * @param nbytes The number of bytes to send.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t sendfile(
+    ConnectionHandle handle,
+    int file,
+    uint64_t offset,
+    std::size_t nbytes)
+  {
+    uint64_t event_id = es::make_uid();
+    Transfer transfer { event_id, nullptr, nullptr };
+
+    transfer.file = file;
+    transfer.file_offset = offset;
+    transfer.file_nbytes = nbytes;
+
+    _push_begin_event<SendEvent>(
+      event_id, 0, handle, es::SEND_BEGIN, _protocol
+    );
+
+    _queue_send(handle, std::move(transfer));
+
+    return event_id;
+  }
+
+  /**
+   * Same as sendb(), copying the passed string into a buffer owned by the
+   * connection's write queue.
+   * 
+   * @param handle The handle of the connection.
+   * @param payload The bytes to send.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t sends(
+    ConnectionHandle handle,
+    const std::string& payload)
+  {
+    StreamBufferP buffer = std::make_shared<StreamBuffer>();
+
+    buffer->commit(boost::asio::buffer_copy(
+      buffer->prepare(payload.size()), boost::asio::buffer(payload)
+    ));
+
+    return sendb(handle, std::move(buffer));
+  }
+
+  /**
+   * Closes the passed connection right away. Pending reads are cancelled
+   * and payloads that have not been sent yet are reported through
+   * SEND_HANDLE events carrying operation_aborted.
+   * 
+   * @param handle The handle of the connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void close(
+    ConnectionHandle handle)
+  {
+    if (const ConnectionP& connection = _connections.find(handle)) {
+      _close(connection);
+    }
+  }
+
+  /**
+   * Stops sending on the passed connection once everything already queued
+   * has been sent. The connection keeps receiving until the remote end
+   * closes it as well.
+   * 
+   * @param handle The handle of the connection.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void shutdown_write(
+    ConnectionHandle handle)
+  {
+    if (const ConnectionP& connection = _connections.find(handle)) {
+      _shutdown_after_send(connection);
+    }
+  }
+
+  /**
+   * Shuts down the sending side of every connection once its queued
+   * sends are flushed, then closes whatever is still open after the
+   * passed amount of time. update() should keep being called until
+   * is_stopped() returns true.
+   * 
+   * @param drain_timeout How long to wait for connections to close on their own.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void stop(
+    std::chrono::milliseconds drain_timeout)
+  {
+    _is_stopping = true;
+
+    _connections.for_each([this](const ConnectionP& connection) {
+      _shutdown_after_send(connection);
+    });
+
+    if (!_connections.size()) {
+      return;
+    }
+
+    _drain_timer.expires_from_now(boost::posix_time::milliseconds(drain_timeout.count()));
+    _drain_timer.async_wait([this](boost::system::error_code error) {
+      if (error) {
+        return;
+      }
+
+      _connections.for_each([this](const ConnectionP& connection) {
+        _close(connection);
+      });
+    });
+  }
+
+  /**
+   * Returns true once stop() has been called and every connection has
+   * been closed.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool is_stopped() const {
+    return _is_stopping && !_connections.size();
+  }
+
+  /**
+   * Enables or disables the event queue. Code that drives connections
+   * exclusively through AwaitableConnection never calls poll(), and
+   * should disable events so they do not pile up.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_events_enabled(
+    bool enabled)
+  {
+    _events_enabled = enabled;
+  }
+
+  /**
+   * Sets a function that receives every event as it is queued, instead
+   * of the events waiting for poll(). This is how events reach a server
+   * whose io_service is run by the application rather than update().
+   * The handler runs on the server's executor, so it may call into the
+   * server; it should not block. Events already queued are handed to it
+   * as well.
+   * 
+   * @param handler The event handler, or an empty function to go back to poll().
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class DispatchPolicyTy = DispatchPolicy>
+  void set_event_handler(
+    std::function<void(EventP)> handler)
+  {
+    static_assert(DispatchPolicyTy::has_event_handler, "The dispatch policy only delivers events through poll()");
+
+    _event_handler = std::move(handler);
+
+    if (_event_handler && !_events.empty() && !_is_delivery_posted) {
+      _post_delivery();
+    }
+  }
+
+  /**
+   * Starts recording, into the passed capture, every connection opening
+   * and closing, every frame received and every payload queued for
+   * sending, or stops recording when passed null. Files passed to
+   * sendfile() are not recorded.
+   * 
+   * @param capture The capture to record into, e.g. from CaptureLog::create().
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_capture(
+    CaptureLog::Pointer capture)
+  {
+    _capture = std::move(capture);
+  }
+
+  /**
+   * Returns the socket options applied to new connections.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  const SocketOptions& socket_options() const {
+    return _socket_options;
+  }
+
+  /**
+   * Sets the socket options applied to connections established from now
+   * on. Options of a listening socket only take effect when passed to
+   * the server's constructor.
+   * 
+   * @param options
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_socket_options(
+    const SocketOptions& options)
+  {
+    _socket_options = options;
+    _is_socket_options_error_reported = false;
+  }
+
+  /**
+   * Limits how fast the server as a whole reads, in bytes and in frames
+   * per second. Once either limit is exceeded, connections wait before
+   * starting their next read. Zero disables a limit.
+   * 
+   * @param bytes_per_second
+   * @param messages_per_second
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_read_rate_limit(
+    double bytes_per_second,
+    double messages_per_second)
+  {
+    _read_limiter.set_limits(bytes_per_second, messages_per_second);
+  }
+
+  /**
+   * Same as above, for each connection on its own. Applies to open
+   * connections as well as later ones; a single connection's limit can
+   * also be changed through its read_limiter.
+   * 
+   * @param bytes_per_second
+   * @param messages_per_second
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_connection_read_rate_limit(
+    double bytes_per_second,
+    double messages_per_second)
+  {
+    _connection_read_limiter.set_limits(bytes_per_second, messages_per_second);
+
+    _connections.for_each([this](const ConnectionP& connection) {
+      connection->read_limiter = _connection_read_limiter;
+    });
+  }
+
+  /**
+   * Limits how many frames a single connection can receive, and so add
+   * READ_HANDLE events for, per call to update(). Connections over the
+   * limit resume reading, in turn, on the next update(). Zero disables
+   * the limit.
+   * 
+   * @param nreads
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_max_reads_per_update(
+    std::size_t nreads)
+  {
+    _max_reads_per_update = nreads;
+  }
+
+  /**
+   * Lets connections negotiate compression. A peer asks for it by making
+   * Compressor::magic the first bytes it sends; the server echoes them,
+   * and from then on both directions of the connection are compressed
+   * records. Other connections are unaffected. Compressors come from the
+   * passed factory and are pooled, so connections reuse the compressors
+   * of closed ones. SEND_HANDLE events of compressed connections report
+   * the number of compressed bytes sent. Connections opened by a
+   * TCPClient ask for compression themselves as soon as they connect,
+   * and fail with an ERROR_READ event if the peer does not echo the
+   * magic.
+   * 
+   * Must be called before the server starts accepting connections.
+   * 
+   * @param factory Makes a compressor, e.g. DeflateCompressor::factory().
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_compression(
+    Compressor::Factory factory)
+  {
+    _compressor_factory = std::move(factory);
+    _compressor_pool.clear();
+  }
+
+  /**
+   * Sets how long a read may wait for data, or zero for no limit. When a
+   * read times out, a READ_TIMEOUT event is queued and the connection is
+   * closed once its pending sends are done, followed by CLOSE_HANDLE.
+   * 
+   * @param seconds The read timeout in seconds.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_read_timeout_seconds(
+    uint16_t seconds)
+  {
+    _read_timeout_seconds = seconds;
+  }
+
+  /**
+   * Sets how connections are read from: READ_SOME for frames of the read
+   * buffer size, READ_UNTIL for frames ending with the read delimeter, or
+   * READ_AVAILABLE for whatever has arrived, up to the read buffer size.
+   * Servers whose read policy fixes the mode have no such setting.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class ReadPolicyTy = ReadPolicy>
+  void set_read_mode(
+    int8_t mode)
+  {
+    static_assert(!ReadPolicyTy::is_fixed, "The read policy fixes the read mode");
+
+    _read_mode = mode;
+  }
+
+  /**
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_read_delimeter(
+    const std::string& delimeter)
+  {
+    _read_delimeter = delimeter;
+  }
+
+  /**
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
   void set_read_buffer_nbytes(
@@ -436,6 +2968,27 @@ public:
   {
     _read_buffer_nbytes = nbytes;
   }
+
+  /**
+   * Sizes every connection's receives to its own traffic instead of to
+   * the read buffer size. Each connection keeps a moving estimate of how
+   * much it receives at a time and takes a chunk of the matching power of
+   * two size class, between 256 bytes and 64 KB, from a pool shared by
+   * all connections; connections wait for data without holding a chunk.
+   * Frames are formed as usual, so READ_SOME still delivers frames of the
+   * read buffer size and READ_AVAILABLE still delivers at most that many
+   * bytes. Has no effect on SSL servers, or with ENGINE_IO_URING, which
+   * receives into buffers of its own.
+   * 
+   * @param is_adaptive True to size receives per connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_adaptive_read_sizing(
+    bool is_adaptive)
+  {
+    _is_read_sizing_adaptive = is_adaptive;
+  }
 };
 
 }
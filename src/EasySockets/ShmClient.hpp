@@ -0,0 +1,318 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+
+#ifndef _EASYSOCKETS_SHMCLIENT_HPP_
+#define _EASYSOCKETS_SHMCLIENT_HPP_
+
+#include "ShmRing.hpp"
+
+#if defined(__linux__) && defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace es {
+
+/**
+ * Client of a ShmServer. Meant for the process on the other side of the
+ * channel, which typically has a thread of its own doing nothing but
+ * talking to the server: send() and receive() block, spinning for a
+ * while before sleeping until the server wakes them.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class ShmClient {
+protected:
+  boost::asio::io_service _io_service;
+  boost::asio::local::stream_protocol::socket _control;
+  ShmChannel _channel;
+  int _server_wake;
+  int _wake;
+  AdaptiveSpin _spin;
+
+  /**
+   * Writes to the server's eventfd if the server went to sleep.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _wake_server()
+  {
+    if (_channel.header->is_server_waiting.load(std::memory_order_seq_cst)
+      && _channel.header->is_server_waiting.exchange(0))
+    {
+      uint64_t one = 1;
+      ssize_t ignored = ::write(_server_wake, &one, sizeof(one));
+      (void)ignored;
+    }
+  }
+
+  /**
+   * Waits until the passed function returns true: spins first, then
+   * tells the server the client is waiting and sleeps until woken up.
+   * Fails with eof if the server closes the channel in the meantime.
+   * 
+   * @param is_ready The condition to wait for.
+   * @param error Set on failure.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class FnTy>
+  bool _wait(
+    FnTy is_ready,
+    boost::system::error_code& error)
+  {
+    if (_spin.spin(is_ready)) {
+      return true;
+    }
+
+    for (;;) {
+      _channel.header->is_client_waiting.store(1, std::memory_order_seq_cst);
+
+      if (is_ready()) {
+        _channel.header->is_client_waiting.store(0, std::memory_order_relaxed);
+        return true;
+      }
+
+      pollfd descriptors[2] = {
+        { _wake, POLLIN, 0 },
+        { _control.native_handle(), POLLIN, 0 }
+      };
+
+      if (::poll(descriptors, 2, -1) < 0 && errno != EINTR) {
+        error = boost::system::error_code(errno, boost::system::system_category());
+        return false;
+      }
+
+      if (descriptors[0].revents & POLLIN) {
+        uint64_t count;
+        ssize_t ignored = ::read(_wake, &count, sizeof(count));
+        (void)ignored;
+      }
+
+      // The server never sends anything on the local socket after the
+      // handshake, so it only becomes readable once closed.
+      if (descriptors[1].revents) {
+        if (is_ready()) {
+          return true;
+        }
+
+        error = boost::asio::error::eof;
+        return false;
+      }
+    }
+  }
+public:
+  ShmClient()
+    : _control(_io_service),
+      _server_wake(-1),
+      _wake(-1)
+  {}
+
+  ShmClient(const ShmClient&) = delete;
+  ShmClient& operator = (const ShmClient&) = delete;
+
+  ~ShmClient() {
+    close();
+  }
+
+  /**
+   * Connects to the ShmServer listening on the passed path and maps the
+   * channel it hands over.
+   * 
+   * @param path The server's socket path, or '@' followed by an abstract name.
+   * @param error Set on failure.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool connect(
+    const std::string& path,
+    boost::system::error_code& error)
+  {
+    _control.connect(es::local_endpoint_of(path), error);
+
+    if (error) {
+      return false;
+    }
+
+    union {
+      cmsghdr header;
+      char bytes[CMSG_SPACE(sizeof(int) * 3)];
+    } control;
+
+    uint32_t hello[2];
+    iovec vector { hello, sizeof(hello) };
+    msghdr message {};
+    ssize_t result;
+    int descriptors[3] = { -1, -1, -1 };
+
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control.bytes;
+    message.msg_controllen = sizeof(control.bytes);
+
+    do {
+      result = ::recvmsg(_control.native_handle(), &message, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    } while (result < 0 && errno == EINTR);
+
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+
+    if (header && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+      std::memcpy(descriptors, CMSG_DATA(header), std::min<std::size_t>(sizeof(descriptors), header->cmsg_len - CMSG_LEN(0)));
+    }
+
+    if (result < 0) {
+      error = boost::system::error_code(errno, boost::system::system_category());
+    } else if (result != sizeof(hello) || hello[0] != ShmChannelHeader::magic_value || descriptors[2] < 0) {
+      error = boost::asio::error::invalid_argument;
+    } else {
+      _channel.map(descriptors[0], hello[1], false, error);
+    }
+
+    if (descriptors[0] >= 0) {
+      ::close(descriptors[0]);
+    }
+
+    _server_wake = descriptors[1];
+    _wake = descriptors[2];
+
+    if (error) {
+      close();
+      return false;
+    }
+
+    return true;
+  }
+
+  /**
+   * Sends the passed message, waiting for room in the ring if needed.
+   * 
+   * @param message The message.
+   * @param error Set on failure.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool send(
+    boost::asio::const_buffer message,
+    boost::system::error_code& error)
+  {
+    if (message.size() > _channel.to_server.max_message_nbytes()) {
+      error = boost::asio::error::message_size;
+      return false;
+    }
+
+    if (!_wait([this, message]() { return _channel.to_server.produce(message); }, error)) {
+      return false;
+    }
+
+    _wake_server();
+
+    return true;
+  }
+
+  /**
+   * Waits for the next message from the server and appends it to the
+   * passed buffer. Fails with eof once the server has closed the channel
+   * and every message it sent has been received, or with invalid_argument
+   * after closing the channel if the server's ring is corrupt.
+   * 
+   * @param buffer The buffer to append the message to.
+   * @param error Set on failure.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool receive(
+    StreamBuffer& buffer,
+    boost::system::error_code& error)
+  {
+    boost::system::error_code corruption;
+
+    if (!_wait([this, &buffer, &corruption]() { return _channel.to_client.consume(buffer, corruption) || corruption; }, error)) {
+      return false;
+    }
+
+    if (corruption) {
+      error = corruption;
+      close();
+      return false;
+    }
+
+    _wake_server();
+
+    return true;
+  }
+
+  /**
+   * Closes the channel. The server sees its CLOSE_HANDLE event.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void close()
+  {
+    boost::system::error_code ignored;
+
+    _channel.unmap();
+    _control.close(ignored);
+
+    if (_server_wake >= 0) {
+      ::close(_server_wake);
+      _server_wake = -1;
+    }
+
+    if (_wake >= 0) {
+      ::close(_wake);
+      _wake = -1;
+    }
+  }
+
+  bool is_open() const {
+    return _channel.header != nullptr;
+  }
+
+  /**
+   * Sets the longest send() and receive() spin before sleeping, in polls
+   * of the ring. Zero never spins.
+   * 
+   * @param max_iterations
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_max_spin_iterations(
+    std::size_t max_iterations)
+  {
+    _spin.set_max_iterations(max_iterations);
+  }
+};
+
+}
+
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,440 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+
+#ifndef _EASYSOCKETS_SHMRING_HPP_
+#define _EASYSOCKETS_SHMRING_HPP_
+
+#include "EasySockets.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace es {
+
+/**
+ * Shared state at the start of a shared memory channel, followed by the
+ * ring carrying messages from the client to the server and then by the
+ * ring carrying them back. A side about to sleep sets its waiting flag,
+ * and the other side writes to that side's eventfd when it finds the
+ * flag set after producing or consuming a message.
+ * */
+struct ShmChannelHeader {
+  static constexpr uint32_t magic_value = 0x4553484D;
+
+  uint32_t magic;
+  uint32_t ring_nbytes;
+  alignas(64) std::atomic<uint32_t> is_server_waiting;
+  alignas(64) std::atomic<uint32_t> is_client_waiting;
+};
+
+/**
+ * Positions of a ring, each on a cache line of its own. Both only ever
+ * grow; their difference is the number of bytes in use.
+ * */
+struct ShmRingHeader {
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+};
+
+/**
+ * Single producer, single consumer ring of messages living in memory
+ * shared by two processes. Each message is an 8 byte header holding its
+ * size followed by its bytes, padded to a multiple of 8. Messages never
+ * wrap: when one does not fit before the end of the ring, the rest of
+ * the ring is skipped with a padding header. A message may therefore
+ * take up to half the ring.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class ShmRing {
+protected:
+  static constexpr uint32_t _padding = 0xFFFFFFFFu;
+
+  ShmRingHeader* _header;
+  char* _data;
+  uint64_t _nbytes;
+
+  static uint64_t _record_nbytes(
+    std::size_t nbytes)
+  {
+    return 8 + ((nbytes + 7) & ~uint64_t(7));
+  }
+public:
+  ShmRing()
+    : _header(nullptr),
+      _data(nullptr),
+      _nbytes(0)
+  {}
+
+  /**
+   * 
+   * @param memory Where the ring's header is, followed by its data.
+   * @param nbytes The size of the ring's data, a power of two.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  ShmRing(
+    void* memory,
+    uint64_t nbytes)
+    : _header(static_cast<ShmRingHeader*>(memory)),
+      _data(static_cast<char*>(memory) + sizeof(ShmRingHeader)),
+      _nbytes(nbytes)
+  {}
+
+  /**
+   * Returns the size of the shared memory taken by a ring holding the
+   * passed number of bytes.
+   * 
+   * @param nbytes The size of the ring's data.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static std::size_t memory_nbytes(
+    uint64_t nbytes)
+  {
+    return sizeof(ShmRingHeader) + nbytes;
+  }
+
+  /**
+   * Returns the largest message the ring can carry.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::size_t max_message_nbytes() const {
+    return _nbytes / 2 - 8;
+  }
+
+  /**
+   * Returns true if there is no message to consume. Called by the
+   * consumer.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool is_empty() const {
+    return _header->head.load(std::memory_order_relaxed) == _header->tail.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Appends the passed message if there is room for it, and returns
+   * whether there was. Called by the producer.
+   * 
+   * @param message The message.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool produce(
+    boost::asio::const_buffer message)
+  {
+    uint64_t tail = _header->tail.load(std::memory_order_relaxed);
+    uint64_t head = _header->head.load(std::memory_order_acquire);
+    uint64_t nbytes = _record_nbytes(message.size());
+    uint64_t offset = tail & (_nbytes - 1);
+    uint64_t nbytes_to_end = _nbytes - offset;
+    uint64_t nbytes_needed = nbytes <= nbytes_to_end ? nbytes : nbytes_to_end + nbytes;
+
+    if (message.size() > max_message_nbytes() || _nbytes - (tail - head) < nbytes_needed) {
+      return false;
+    }
+
+    if (nbytes > nbytes_to_end) {
+      std::memcpy(_data + offset, &_padding, sizeof(_padding));
+      tail += nbytes_to_end;
+      offset = 0;
+    }
+
+    uint32_t size = static_cast<uint32_t>(message.size());
+
+    std::memcpy(_data + offset, &size, sizeof(size));
+    std::memcpy(_data + offset + 8, message.data(), message.size());
+
+    // Sequentially consistent so that the waiting flag the producer reads
+    // next cannot be read before the message is visible.
+    _header->tail.store(tail + nbytes, std::memory_order_seq_cst);
+
+    return true;
+  }
+
+  /**
+   * Appends the next message to the passed buffer and removes it from
+   * the ring. Returns false if there was none, or if the ring is corrupt
+   * in which case the error is set and the ring must not be used again.
+   * The ring lives in memory the other process can write to at will, so
+   * its positions and sizes are checked before being trusted. Called by
+   * the consumer.
+   * 
+   * @param buffer The buffer to append the message to.
+   * @param error Set when the ring is corrupt.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool consume(
+    StreamBuffer& buffer,
+    boost::system::error_code& error)
+  {
+    uint64_t head = _header->head.load(std::memory_order_relaxed);
+    uint64_t tail = _header->tail.load(std::memory_order_acquire);
+
+    if (head == tail) {
+      return false;
+    }
+
+    if (tail - head > _nbytes) {
+      error = boost::asio::error::invalid_argument;
+      return false;
+    }
+
+    uint64_t offset = head & (_nbytes - 1);
+    uint32_t size;
+
+    std::memcpy(&size, _data + offset, sizeof(size));
+
+    if (size == _padding) {
+      head += _nbytes - offset;
+      offset = 0;
+
+      if (head >= tail) {
+        error = boost::asio::error::invalid_argument;
+        return false;
+      }
+
+      std::memcpy(&size, _data, sizeof(size));
+    }
+
+    if (size > max_message_nbytes() || offset + 8 + size > _nbytes || tail - head < _record_nbytes(size)) {
+      error = boost::asio::error::invalid_argument;
+      return false;
+    }
+
+    buffer.commit(boost::asio::buffer_copy(buffer.prepare(size), boost::asio::buffer(_data + offset + 8, size)));
+    _header->head.store(head + _record_nbytes(size), std::memory_order_seq_cst);
+
+    return true;
+  }
+};
+
+
+/**
+ * Busy waiting that adapts to how often it pays off. Every time spinning
+ * finds what it waits for the next spin may last twice as long, up to
+ * the maximum; every time it does not, the next one lasts half as long,
+ * down to the minimum. A consumer that is fed steadily ends up spinning
+ * instead of paying for a sleep and a wakeup, and one that is idle gives
+ * the core back quickly.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class AdaptiveSpin {
+protected:
+  std::size_t _iterations;
+  std::size_t _min_iterations;
+  std::size_t _max_iterations;
+public:
+  /**
+   * 
+   * @param max_iterations The longest spin, in polls. Zero disables spinning.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  explicit AdaptiveSpin(
+    std::size_t max_iterations = default_max_iterations())
+  {
+    set_max_iterations(max_iterations);
+  }
+
+  /**
+   * Returns the default longest spin. On a single core, spinning only
+   * delays the other side, so it is disabled.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static std::size_t default_max_iterations() {
+    return std::thread::hardware_concurrency() > 1 ? 1 << 14 : 0;
+  }
+
+  void set_max_iterations(
+    std::size_t max_iterations)
+  {
+    _max_iterations = max_iterations;
+    _min_iterations = max_iterations ? std::max<std::size_t>(max_iterations / 256, 1) : 0;
+    _iterations = max_iterations / 16;
+  }
+
+  /**
+   * Polls the passed function until it returns true or the spin is over,
+   * and returns whether it did.
+   * 
+   * @param is_ready The function to poll.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class FnTy>
+  bool spin(
+    FnTy is_ready)
+  {
+    for (std::size_t i = 0; i < _iterations; i++) {
+      if (is_ready()) {
+        _iterations = std::min(_max_iterations, std::max(_iterations * 2, _min_iterations));
+        return true;
+      }
+
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    }
+
+    _iterations = std::max(_iterations / 2, _min_iterations);
+
+    return false;
+  }
+};
+
+#if defined(__linux__)
+/**
+ * Mapping of a shared memory channel: the channel header and the two
+ * rings. The server creates the memory and hands its descriptor to the
+ * client, which maps the same pages.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class ShmChannel {
+protected:
+  static constexpr std::size_t _page_nbytes = 4096;
+
+  void* _memory;
+  std::size_t _memory_nbytes;
+
+  static std::size_t _round_to_page(
+    std::size_t nbytes)
+  {
+    return (nbytes + _page_nbytes - 1) & ~(_page_nbytes - 1);
+  }
+public:
+  ShmChannelHeader* header;
+  ShmRing to_server;
+  ShmRing to_client;
+
+  ShmChannel()
+    : _memory(nullptr),
+      _memory_nbytes(0),
+      header(nullptr)
+  {}
+
+  ~ShmChannel() {
+    unmap();
+  }
+
+  ShmChannel(const ShmChannel&) = delete;
+  ShmChannel& operator = (const ShmChannel&) = delete;
+
+  /**
+   * Returns the size of the memory of a channel whose rings each hold
+   * the passed number of bytes.
+   * 
+   * @param ring_nbytes The size of each ring, a power of two.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static std::size_t memory_nbytes(
+    uint32_t ring_nbytes)
+  {
+    return _page_nbytes + 2 * _round_to_page(ShmRing::memory_nbytes(ring_nbytes));
+  }
+
+  /**
+   * Maps the channel memory of the passed descriptor. The creator of
+   * the memory initializes the header; the other side checks it.
+   * 
+   * @param descriptor The descriptor of the channel memory.
+   * @param ring_nbytes The size of each ring.
+   * @param is_creator True if the memory was just created, and is all zeroes.
+   * @param error Set on failure.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool map(
+    int descriptor,
+    uint32_t ring_nbytes,
+    bool is_creator,
+    boost::system::error_code& error)
+  {
+    if (ring_nbytes < 16 || (ring_nbytes & (ring_nbytes - 1))) {
+      error = boost::asio::error::invalid_argument;
+      return false;
+    }
+
+    std::size_t nbytes = memory_nbytes(ring_nbytes);
+    void* memory = ::mmap(nullptr, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+
+    if (memory == MAP_FAILED) {
+      error = boost::system::error_code(errno, boost::system::system_category());
+      return false;
+    }
+
+    _memory = memory;
+    _memory_nbytes = nbytes;
+    header = static_cast<ShmChannelHeader*>(memory);
+
+    if (is_creator) {
+      header->magic = ShmChannelHeader::magic_value;
+      header->ring_nbytes = ring_nbytes;
+    } else if (header->magic != ShmChannelHeader::magic_value || header->ring_nbytes != ring_nbytes) {
+      error = boost::asio::error::invalid_argument;
+      unmap();
+      return false;
+    }
+
+    char* rings = static_cast<char*>(memory) + _page_nbytes;
+
+    to_server = ShmRing(rings, ring_nbytes);
+    to_client = ShmRing(rings + _round_to_page(ShmRing::memory_nbytes(ring_nbytes)), ring_nbytes);
+
+    return true;
+  }
+
+  void unmap()
+  {
+    if (_memory) {
+      ::munmap(_memory, _memory_nbytes);
+      _memory = nullptr;
+      header = nullptr;
+    }
+  }
+};
+#endif
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,656 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+
+#ifndef _EASYSOCKETS_SHMSERVER_HPP_
+#define _EASYSOCKETS_SHMSERVER_HPP_
+
+#include "LocalServer.hpp"
+#include "ShmRing.hpp"
+
+#if defined(__linux__) && defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+#include <deque>
+#include <queue>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace es {
+
+/**
+ * Server for processes on the same host, moving messages through rings
+ * in shared memory instead of through sockets. Clients (see ShmClient)
+ * connect to a local socket, over which the server hands them the
+ * memory of their channel and the eventfds used for wakeups; from then
+ * on messages only go through memory. The local socket stays open, and
+ * its closing closes the channel.
+ * 
+ * The server queues the same ACCEPT_HANDLE, READ_HANDLE, SEND_BEGIN,
+ * SEND_HANDLE, ERROR_HANDLE and CLOSE_HANDLE events as the socket
+ * servers, with a protocol of SHM, so code written against poll() does
+ * not change. Every message is delivered as a frame of its own, so read
+ * modes do not apply. When nothing is waiting, update() spins for a
+ * while before going to sleep on the server's eventfd; the spin adapts
+ * to how often it finds messages.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class ShmServer {
+public:
+  typedef std::shared_ptr<ShmServer> Pointer;
+protected:
+  static constexpr std::size_t _max_messages_per_drain = 1024;
+  static constexpr uint32_t _max_ring_nbytes = 1u << 30;
+
+  struct _Send {
+    uint64_t id;
+    StreamBufferP payload;
+  };
+
+  struct _Channel {
+    ConnectionHandle handle;
+    ShmChannel memory;
+    int memory_descriptor;
+    int client_wake;
+    uint64_t handshake_id;
+    std::deque<_Send> pending;
+  };
+
+  LocalServer _control;
+  uint32_t _ring_nbytes;
+  int _wake;
+  boost::asio::posix::stream_descriptor _wake_descriptor;
+  uint64_t _wake_count;
+  bool _is_wake_pending;
+  AdaptiveSpin _spin;
+  std::vector<std::unique_ptr<_Channel>> _channels;
+  std::size_t _nchannels;
+  std::queue<EventP> _events;
+
+  template <class EventTy, class... ArgTys>
+  void _push_event(
+    ArgTys&&... args)
+  {
+    _events.push(std::make_shared<EventTy>(std::forward<ArgTys>(args)...));
+  }
+
+  _Channel* _find(
+    ConnectionHandle handle) const
+  {
+    if (handle == es::NULL_HANDLE || es::slot_of(handle) >= _channels.size()) {
+      return nullptr;
+    }
+
+    _Channel* channel = _channels[es::slot_of(handle)].get();
+
+    return channel && channel->handle == handle ? channel : nullptr;
+  }
+
+  /**
+   * Writes to the client's eventfd if the client went to sleep.
+   * 
+   * @param channel The channel of the client.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _wake_client(
+    _Channel& channel)
+  {
+    if (channel.memory.header->is_client_waiting.load(std::memory_order_seq_cst)
+      && channel.memory.header->is_client_waiting.exchange(0))
+    {
+      uint64_t one = 1;
+      ssize_t ignored = ::write(channel.client_wake, &one, sizeof(one));
+      (void)ignored;
+    }
+  }
+
+  /**
+   * Moves as many queued sends of the passed channel into its ring as
+   * fit, and returns how many did.
+   * 
+   * @param channel The channel.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::size_t _flush_sends(
+    _Channel& channel)
+  {
+    std::size_t nsent = 0;
+
+    while (!channel.pending.empty() && channel.memory.to_client.produce(channel.pending.front().payload->data())) {
+      _Send& send = channel.pending.front();
+
+      _push_event<SendEvent>(
+        send.id, send.payload->size(), channel.handle, es::SEND_HANDLE, es::SHM
+      );
+
+      channel.pending.pop_front();
+      nsent++;
+    }
+
+    return nsent;
+  }
+
+  /**
+   * Queues a READ_HANDLE event for every message waiting in the rings,
+   * and moves queued sends into rings that have room again. Returns the
+   * number of messages received.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::size_t _drain()
+  {
+    std::size_t nreceived = 0;
+
+    for (std::unique_ptr<_Channel>& slot : _channels) {
+      if (!slot || slot->memory_descriptor >= 0) {
+        continue;
+      }
+
+      _Channel& channel = *slot;
+      std::size_t nmessages = 0;
+
+      boost::system::error_code error;
+
+      channel.memory.header->is_server_waiting.store(0, std::memory_order_relaxed);
+
+      for (; nmessages < _max_messages_per_drain; nmessages++) {
+        StreamBufferP buffer = std::make_shared<StreamBuffer>();
+
+        if (!channel.memory.to_server.consume(*buffer, error)) {
+          break;
+        }
+
+        std::size_t nbytes = buffer->size();
+
+        _push_event<ReadEvent>(
+          std::move(buffer), nbytes, channel.handle, es::READ_HANDLE, es::SHM, boost::system::error_code()
+        );
+      }
+
+      nreceived += nmessages;
+
+      // A client corrupting its ring cannot be trusted with the channel
+      // any longer.
+      if (error) {
+        ConnectionHandle handle = channel.handle;
+
+        _push_event<Event>(handle, es::ERROR_HANDLE, es::SHM, Error(es::ERROR_READ, error));
+        _control.close(handle);
+        _close_channel(handle);
+        continue;
+      }
+
+      if (_flush_sends(channel) || nmessages) {
+        _wake_client(channel);
+      }
+    }
+
+    return nreceived;
+  }
+
+  /**
+   * Returns true if any ring has a message waiting.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool _has_messages() const
+  {
+    for (const std::unique_ptr<_Channel>& channel : _channels) {
+      if (channel && channel->memory_descriptor < 0 && !channel->memory.to_server.is_empty()) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  /**
+   * Gets ready to sleep until a client writes to the server's eventfd:
+   * tells every client the server is waiting, then checks the rings one
+   * last time so that a message produced in between is not missed.
+   * Returns false if there is work after all.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool _prepare_sleep()
+  {
+    for (std::unique_ptr<_Channel>& channel : _channels) {
+      if (channel && channel->memory_descriptor < 0) {
+        channel->memory.header->is_server_waiting.store(1, std::memory_order_seq_cst);
+      }
+    }
+
+    if (_has_messages()) {
+      return false;
+    }
+
+    if (!_is_wake_pending) {
+      _is_wake_pending = true;
+      _wake_descriptor.async_read_some(boost::asio::buffer(&_wake_count, sizeof(_wake_count)),
+        [this](boost::system::error_code, std::size_t) {
+          _is_wake_pending = false;
+        }
+      );
+    }
+
+    return true;
+  }
+
+  /**
+   * Creates the channel of a newly accepted client and sends it the
+   * channel's memory along with the eventfds. The memory is sealed at
+   * its size first, so that the client cannot shrink it from under the
+   * server's mapping.
+   * 
+   * @param handle The handle of the client's local connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _open_channel(
+    ConnectionHandle handle)
+  {
+    std::unique_ptr<_Channel> channel(new _Channel());
+    boost::system::error_code error;
+
+    channel->handle = handle;
+    channel->memory_descriptor = ::memfd_create("easysockets-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    channel->client_wake = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (channel->memory_descriptor < 0 || channel->client_wake < 0
+      || ::ftruncate(channel->memory_descriptor, ShmChannel::memory_nbytes(_ring_nbytes)) < 0
+      || ::fcntl(channel->memory_descriptor, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+    {
+      error = boost::system::error_code(errno, boost::system::system_category());
+    } else {
+      channel->memory.map(channel->memory_descriptor, _ring_nbytes, true, error);
+    }
+
+    if (error) {
+      _close_descriptors(*channel);
+      _push_event<Event>(handle, es::ERROR_HANDLE, es::SHM, Error(es::ERROR_ACCEPT, error));
+      _control.close(handle);
+      return;
+    }
+
+    StreamBufferP hello = std::make_shared<StreamBuffer>();
+    uint32_t hello_words[2] = { ShmChannelHeader::magic_value, _ring_nbytes };
+
+    hello->commit(boost::asio::buffer_copy(hello->prepare(sizeof(hello_words)), boost::asio::buffer(hello_words)));
+    channel->handshake_id = _control.sendfds(handle, { channel->memory_descriptor, _wake, channel->client_wake }, std::move(hello));
+
+    if (_channels.size() <= es::slot_of(handle)) {
+      _channels.resize(es::slot_of(handle) + 1);
+    }
+
+    _channels[es::slot_of(handle)] = std::move(channel);
+    _nchannels++;
+  }
+
+  static void _close_descriptors(
+    _Channel& channel)
+  {
+    if (channel.memory_descriptor >= 0) {
+      ::close(channel.memory_descriptor);
+      channel.memory_descriptor = -1;
+    }
+
+    if (channel.client_wake >= 0) {
+      ::close(channel.client_wake);
+      channel.client_wake = -1;
+    }
+  }
+
+  /**
+   * Called once the handshake of a channel has been sent. The client now
+   * holds the channel memory, so the server's descriptor of it is closed
+   * and the channel announced with an ACCEPT_HANDLE event.
+   * 
+   * @param channel The channel.
+   * @param error The error the handshake was sent with, if any.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _handle_handshake(
+    _Channel& channel,
+    const Error& error)
+  {
+    if (error) {
+      _push_event<Event>(channel.handle, es::ERROR_HANDLE, es::SHM, Error(es::ERROR_ACCEPT, error.code));
+      _control.close(channel.handle);
+      return;
+    }
+
+    ::close(channel.memory_descriptor);
+    channel.memory_descriptor = -1;
+
+    _push_event<Event>(
+      channel.handle, es::ACCEPT_HANDLE, es::SHM
+    );
+
+    // Sends queued before the handshake completed.
+    if (_flush_sends(channel)) {
+      _wake_client(channel);
+    }
+  }
+
+  /**
+   * Releases the channel of a client whose local connection closed.
+   * Sends still queued are reported as aborted.
+   * 
+   * @param handle The handle of the client's local connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _close_channel(
+    ConnectionHandle handle)
+  {
+    _Channel* channel = _find(handle);
+
+    if (!channel) {
+      return;
+    }
+
+    bool is_accepted = channel->memory_descriptor < 0;
+
+    for (_Send& send : channel->pending) {
+      _push_event<SendEvent>(
+        send.id, 0, handle, es::SEND_HANDLE, es::SHM, boost::asio::error::operation_aborted
+      );
+    }
+
+    _close_descriptors(*channel);
+    _channels[es::slot_of(handle)].reset();
+    _nchannels--;
+
+    if (is_accepted) {
+      _push_event<Event>(
+        handle, es::CLOSE_HANDLE, es::SHM
+      );
+    }
+  }
+
+  /**
+   * Turns the events of the local sockets into channel events.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _handle_control_events()
+  {
+    while (EventP event = _control.poll()) {
+      _Channel* channel = _find(event->connection);
+
+      switch (event->type) {
+        case es::ACCEPT_HANDLE:
+          _open_channel(event->connection);
+          break;
+        case es::SEND_HANDLE:
+          if (channel && channel->handshake_id == std::static_pointer_cast<SendEvent>(event)->transfer_id) {
+            _handle_handshake(*channel, event->error);
+          }
+          break;
+        case es::CLOSE_HANDLE:
+          _close_channel(event->connection);
+          break;
+        case es::ERROR_HANDLE:
+          if (!event->error.is_disconnect()) {
+            _push_event<Event>(event->connection, es::ERROR_HANDLE, es::SHM, event->error);
+          }
+          break;
+      }
+    }
+  }
+public:
+  /**
+   * 
+   * @param path The path of the local socket clients connect to, or '@' followed by an abstract name.
+   * @param ring_nbytes The size of each of a channel's two rings, rounded up to a power of two of at most 1GB.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  explicit ShmServer(
+    const std::string& path,
+    uint32_t ring_nbytes = 1024 * 1024)
+    : _control(path),
+      _ring_nbytes(4096),
+      _wake(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+      _wake_descriptor(*_control.io_service()),
+      _wake_count(0),
+      _is_wake_pending(false),
+      _nchannels(0)
+  {
+    boost::system::error_code error;
+
+    while (_ring_nbytes < ring_nbytes && _ring_nbytes < _max_ring_nbytes) {
+      _ring_nbytes *= 2;
+    }
+
+    if (_wake < 0) {
+      error = boost::system::error_code(errno, boost::system::system_category());
+    } else {
+      _wake_descriptor.assign(_wake, error);
+    }
+
+    if (error) {
+      _push_event<Event>(es::NULL_HANDLE, es::ERROR_HANDLE, es::SHM, Error(es::ERROR_ACCEPT, error));
+    }
+  }
+
+  ShmServer(const ShmServer&) = delete;
+  ShmServer& operator = (const ShmServer&) = delete;
+
+  ~ShmServer()
+  {
+    for (std::unique_ptr<_Channel>& channel : _channels) {
+      if (channel) {
+        _close_descriptors(*channel);
+      }
+    }
+  }
+
+  /**
+   * Returns the most recent event, if there is one. If there is no event
+   * a "blank" event is returned that will be falsey.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  EventP poll()
+  {
+    if (!_events.empty()) {
+      EventP event = _events.front();
+      _events.pop();
+      return event;
+    }
+
+    return EventP();
+  }
+
+  /**
+   * Receives the messages waiting in the rings. If there are none, spins
+   * for a while, then sleeps until a client sends something or a local
+   * socket event happens.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  UpdateResult update()
+  {
+    std::size_t nreceived = _drain();
+
+    if (!nreceived && _nchannels && _events.empty() && _spin.spin([this]() { return _has_messages(); })) {
+      nreceived = _drain();
+    }
+
+    if (nreceived || !_events.empty() || !_prepare_sleep()) {
+      boost::asio::post(*_control.io_service(), []() {});
+    }
+
+    UpdateResult result = _control.update();
+
+    _handle_control_events();
+    _drain();
+
+    return result;
+  }
+
+  /**
+   * Queues the passed message for the passed client. It is written to
+   * the client's ring right away if there is room; otherwise it waits,
+   * in order, until the client has consumed enough. The SEND_HANDLE
+   * event is queued once it is in the ring.
+   * 
+   * @param handle The handle of the client.
+   * @param payload The message.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t sendb(
+    ConnectionHandle handle,
+    StreamBufferP payload)
+  {
+    uint64_t event_id = es::make_uid();
+    _Channel* channel = _find(handle);
+
+    _push_event<SendEvent>(
+      event_id, 0, handle, es::SEND_BEGIN, es::SHM
+    );
+
+    if (!channel) {
+      _push_event<SendEvent>(
+        event_id, 0, handle, es::SEND_HANDLE, es::SHM, boost::asio::error::bad_descriptor
+      );
+    } else if (payload->size() > channel->memory.to_client.max_message_nbytes()) {
+      _push_event<SendEvent>(
+        event_id, 0, handle, es::SEND_HANDLE, es::SHM, boost::asio::error::message_size
+      );
+    } else {
+      channel->pending.push_back(_Send { event_id, std::move(payload) });
+
+      if (channel->memory_descriptor < 0 && _flush_sends(*channel)) {
+        _wake_client(*channel);
+      }
+    }
+
+    return event_id;
+  }
+
+  /**
+   * Same as sendb(), copying the passed string.
+   * 
+   * @param handle The handle of the client.
+   * @param payload The message.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t sends(
+    ConnectionHandle handle,
+    const std::string& payload)
+  {
+    StreamBufferP buffer = std::make_shared<StreamBuffer>();
+
+    buffer->commit(boost::asio::buffer_copy(
+      buffer->prepare(payload.size()), boost::asio::buffer(payload)
+    ));
+
+    return sendb(handle, std::move(buffer));
+  }
+
+  /**
+   * Closes the channel of the passed client.
+   * 
+   * @param handle The handle of the client.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void close(
+    ConnectionHandle handle)
+  {
+    _control.close(handle);
+  }
+
+  /**
+   * Stops accepting clients and closes the channels once their local
+   * connections are closed, as described by Server::stop().
+   * 
+   * @param drain_timeout How long to wait for clients to close on their own.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void stop(
+    std::chrono::milliseconds drain_timeout)
+  {
+    _control.stop(drain_timeout);
+  }
+
+  bool is_stopped() const {
+    return _control.is_stopped();
+  }
+
+  /**
+   * Returns the number of connected clients.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::size_t size() const {
+    return _nchannels;
+  }
+
+  /**
+   * Sets the longest the server spins waiting for messages before going
+   * to sleep, in polls of the rings. Zero never spins.
+   * 
+   * @param max_iterations
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_max_spin_iterations(
+    std::size_t max_iterations)
+  {
+    _spin.set_max_iterations(max_iterations);
+  }
+
+  /**
+   * Returns the local server clients connect through.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  LocalServer& control() {
+    return _control;
+  }
+};
+
+}
+
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,306 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+#ifndef _EASYSOCKETS_SOCKETOPTIONS_HPP_
+#define _EASYSOCKETS_SOCKETOPTIONS_HPP_
+
+#include "EasySockets.hpp"
+
+#include <string>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace es {
+
+/**
+ * Integer socket option settable through asio's set_option(), for the
+ * options asio does not define itself.
+ * */
+template <int LevelN, int NameN>
+class IntegerOption {
+protected:
+  int _value;
+public:
+  explicit IntegerOption(int value) : _value(value) {}
+
+  template <class ProtocolTy> int level(const ProtocolTy&) const { return LevelN; }
+  template <class ProtocolTy> int name(const ProtocolTy&) const { return NameN; }
+  template <class ProtocolTy> const void* data(const ProtocolTy&) const { return &_value; }
+  template <class ProtocolTy> std::size_t size(const ProtocolTy&) const { return sizeof(_value); }
+};
+
+/**
+ * Profile of socket options applied to a server's listening socket when
+ * it is bound, and to every connection once it is established. Fields
+ * left at zero/false keep the system default. low_latency() and
+ * high_throughput() are starting points for the two common cases.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class SocketOptions {
+public:
+  /**
+   * Name of the profile, for logs and benchmark reports.
+   * */
+  std::string name;
+
+  /**
+   * Options of the listening socket. Buffer sizes set here are inherited
+   * by accepted sockets, and a deferred accept only completes once the
+   * client has sent something (or the given number of seconds passed.)
+   * With several listeners sharing a port through reuse_port, setting
+   * incoming_cpu on each one hands connections to the listener on the
+   * CPU that received them.
+   * */
+  bool reuse_address;
+  bool reuse_port;
+  int listen_backlog;
+  int defer_accept_seconds;
+  int incoming_cpu;
+
+  /**
+   * Options of every connection. TCP_QUICKACK does not stick, so with
+   * quick_ack set it is set again after every frame received.
+   * */
+  bool no_delay;
+  bool quick_ack;
+  bool keep_alive;
+  int receive_buffer_nbytes;
+  int send_buffer_nbytes;
+  int busy_poll_microseconds;
+
+  SocketOptions()
+    : name("default"),
+      reuse_address(true),
+      reuse_port(false),
+      listen_backlog(boost::asio::socket_base::max_listen_connections),
+      defer_accept_seconds(0),
+      incoming_cpu(-1),
+      no_delay(false),
+      quick_ack(false),
+      keep_alive(false),
+      receive_buffer_nbytes(0),
+      send_buffer_nbytes(0),
+      busy_poll_microseconds(0)
+  {}
+
+  /**
+   * Disables Nagle's algorithm and delayed acknowledgements so small
+   * messages leave right away, and busy-polls the device queue briefly
+   * before sleeping on a read. Busy polling requires CAP_NET_ADMIN, and
+   * is quietly left off without it.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static SocketOptions low_latency()
+  {
+    SocketOptions options;
+
+    options.name = "low_latency";
+    options.no_delay = true;
+    options.quick_ack = true;
+    options.busy_poll_microseconds = 50;
+
+    return options;
+  }
+
+  /**
+   * Keeps Nagle's algorithm so small writes are coalesced, uses large
+   * socket buffers, and defers accepts until the client's first bytes
+   * arrive. Not suitable for protocols where the server speaks first.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static SocketOptions high_throughput()
+  {
+    SocketOptions options;
+
+    options.name = "high_throughput";
+    options.receive_buffer_nbytes = 4 * 1024 * 1024;
+    options.send_buffer_nbytes = 4 * 1024 * 1024;
+    options.defer_accept_seconds = 1;
+
+    return options;
+  }
+
+  /**
+   * Applies the options that must be set before binding to the passed
+   * opened acceptor. Returns the first option that failed, if any.
+   * 
+   * @param acceptor The opened, not yet bound acceptor.
+   * @param error Set to the first error.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class AcceptorTy>
+  void apply_before_bind(
+    AcceptorTy& acceptor,
+    boost::system::error_code& error) const
+  {
+    boost::system::error_code option_error;
+
+    acceptor.set_option(boost::asio::socket_base::reuse_address(reuse_address), option_error);
+    _keep_first(error, option_error);
+
+#if defined(SO_REUSEPORT)
+    if (reuse_port) {
+      acceptor.set_option(IntegerOption<SOL_SOCKET, SO_REUSEPORT>(1), option_error);
+      _keep_first(error, option_error);
+    }
+#endif
+
+#if defined(SO_INCOMING_CPU)
+    if (incoming_cpu >= 0) {
+      acceptor.set_option(IntegerOption<SOL_SOCKET, SO_INCOMING_CPU>(incoming_cpu), option_error);
+      _keep_first(error, option_error);
+    }
+#endif
+
+    if (receive_buffer_nbytes) {
+      acceptor.set_option(boost::asio::socket_base::receive_buffer_size(receive_buffer_nbytes), option_error);
+      _keep_first(error, option_error);
+    }
+
+    if (send_buffer_nbytes) {
+      acceptor.set_option(boost::asio::socket_base::send_buffer_size(send_buffer_nbytes), option_error);
+      _keep_first(error, option_error);
+    }
+  }
+
+  /**
+   * Applies the options of a listening socket to the passed acceptor,
+   * once it listens.
+   * 
+   * @param acceptor The listening acceptor.
+   * @param error Set to the first error.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class AcceptorTy>
+  void apply_after_listen(
+    AcceptorTy& acceptor,
+    boost::system::error_code& error) const
+  {
+#if defined(TCP_DEFER_ACCEPT)
+    if (defer_accept_seconds) {
+      boost::system::error_code option_error;
+
+      acceptor.set_option(IntegerOption<IPPROTO_TCP, TCP_DEFER_ACCEPT>(defer_accept_seconds), option_error);
+      _keep_first(error, option_error);
+    }
+#endif
+  }
+
+  /**
+   * Applies the per connection options to the passed connected socket.
+   * Every option is attempted even if an earlier one fails.
+   * 
+   * @param socket The connected socket.
+   * @param error Set to the first error.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class SocketTy>
+  void apply(
+    SocketTy& socket,
+    boost::system::error_code& error) const
+  {
+    boost::system::error_code option_error;
+
+    if (no_delay) {
+      socket.set_option(boost::asio::ip::tcp::no_delay(true), option_error);
+      _keep_first(error, option_error);
+    }
+
+    if (keep_alive) {
+      socket.set_option(boost::asio::socket_base::keep_alive(true), option_error);
+      _keep_first(error, option_error);
+    }
+
+    if (receive_buffer_nbytes) {
+      socket.set_option(boost::asio::socket_base::receive_buffer_size(receive_buffer_nbytes), option_error);
+      _keep_first(error, option_error);
+    }
+
+    if (send_buffer_nbytes) {
+      socket.set_option(boost::asio::socket_base::send_buffer_size(send_buffer_nbytes), option_error);
+      _keep_first(error, option_error);
+    }
+
+#if defined(SO_BUSY_POLL)
+    if (busy_poll_microseconds) {
+      socket.set_option(IntegerOption<SOL_SOCKET, SO_BUSY_POLL>(busy_poll_microseconds), option_error);
+
+      // Refused to processes without CAP_NET_ADMIN, which is not worth
+      // an error on every connection.
+      if (option_error != boost::system::errc::operation_not_permitted) {
+        _keep_first(error, option_error);
+      }
+    }
+#endif
+
+    if (quick_ack) {
+      apply_quick_ack(socket, option_error);
+      _keep_first(error, option_error);
+    }
+  }
+
+  /**
+   * Sets TCP_QUICKACK on the passed socket, where it is supported.
+   * 
+   * @param socket The connected socket.
+   * @param error Set on failure.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class SocketTy>
+  static void apply_quick_ack(
+    SocketTy& socket,
+    boost::system::error_code& error)
+  {
+#if defined(TCP_QUICKACK)
+    socket.set_option(IntegerOption<IPPROTO_TCP, TCP_QUICKACK>(1), error);
+#endif
+  }
+protected:
+  static void _keep_first(
+    boost::system::error_code& error,
+    const boost::system::error_code& option_error)
+  {
+    if (!error && option_error) {
+      error = option_error;
+    }
+  }
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,488 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+#ifndef _EASYSOCKETS_TCPCLIENT_HPP_
+#define _EASYSOCKETS_TCPCLIENT_HPP_
+
+#include "Server.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+namespace es {
+
+/**
+ * Outbound counterpart of TCPServer. Connections opened with connect()
+ * or acquire() behave exactly like accepted ones: they are read in the
+ * configured read mode, written with sendb()/sends() and reported
+ * through the same events. Connecting is reported through CONNECT_BEGIN
+ * and CONNECT_HANDLE events whose uid is the id returned by the call
+ * that started it. With set_compression(), every connection asks its
+ * server for compression before anything else is sent on it.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class TCPClient : public Server<boost::asio::ip::tcp> {
+public:
+  typedef std::shared_ptr<TCPClient> Pointer;
+protected:
+  /**
+   * A call to acquire() waiting for a pooled connection to a host that
+   * is already at its connection limit.
+   * */
+  struct _Waiter {
+    uint64_t event_id;
+    std::chrono::steady_clock::time_point deadline;
+  };
+
+  /**
+   * Pool state of a single host:port pair. members holds every open
+   * pooled connection to the host, whether leased out or idle.
+   * */
+  struct _Host {
+    std::string name;
+    uint16_t port;
+    std::size_t nconnecting;
+    std::vector<ConnectionP> members;
+    std::vector<ConnectionP> idle;
+    std::deque<_Waiter> waiters;
+
+    _Host() : port(0), nconnecting(0) {}
+  };
+
+  static constexpr long _waiter_interval_ms = 10;
+
+  std::size_t _max_connections_per_host;
+  std::size_t _max_idle_per_host;
+  std::size_t _nwaiters;
+  boost::asio::deadline_timer _waiter_timer;
+  std::unordered_map<std::string, _Host> _hosts;
+  std::unordered_map<const ConnectionTy*, _Host*> _host_of;
+
+  /**
+   * Resolves the passed host and connects a new connection to it. The
+   * connection's read timer doubles as the connect timer, since nothing
+   * can be read before the connection is established.
+   * 
+   * @param name The host name or address.
+   * @param port The port.
+   * @param timeout How long to wait for the connection to be established.
+   * @param event_id The id of the CONNECT_BEGIN event.
+   * @param host The pool the connection is for, or null.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _begin_connect(
+    const std::string& name,
+    uint16_t port,
+    std::chrono::milliseconds timeout,
+    uint64_t event_id,
+    _Host* host)
+  {
+    ConnectionP connection = std::make_shared<ConnectionTy>(_executor);
+    std::shared_ptr<boost::asio::ip::tcp::resolver> resolver = std::make_shared<boost::asio::ip::tcp::resolver>(_executor);
+
+    connection->read_timer.expires_from_now(boost::posix_time::milliseconds(timeout.count()));
+    connection->read_timer.async_wait([connection, resolver](boost::system::error_code error) {
+      if (!error) {
+        boost::system::error_code ignored;
+        resolver->cancel();
+        connection->socket.close(ignored);
+      }
+    });
+
+    resolver->async_resolve(name, std::to_string(port),
+      [this, connection, resolver, event_id, host](
+        boost::system::error_code error,
+        boost::asio::ip::tcp::resolver::results_type endpoints)
+      {
+        if (error) {
+          _handle_connect(connection, event_id, host, error);
+          return;
+        }
+
+        boost::asio::async_connect(connection->socket, endpoints,
+          [this, connection, event_id, host](
+            boost::system::error_code error,
+            const boost::asio::ip::tcp::endpoint&)
+          {
+            _handle_connect(connection, event_id, host, error);
+          }
+        );
+      }
+    );
+  }
+
+  /**
+   * 
+   * @param connection The connection that was being connected.
+   * @param event_id The id of the CONNECT_BEGIN event.
+   * @param host The pool the connection is for, or null.
+   * @param error The error container. Expected generic/blank if there was no error.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _handle_connect(
+    ConnectionP connection,
+    uint64_t event_id,
+    _Host* host,
+    boost::system::error_code error)
+  {
+    boost::system::error_code ignored;
+
+    if (error && connection->read_timer.expires_at() <= boost::asio::deadline_timer::traits_type::now()) {
+      error = boost::asio::error::timed_out;
+    }
+
+    connection->read_timer.expires_at(boost::posix_time::pos_infin, ignored);
+
+    if (host) {
+      host->nconnecting--;
+    }
+
+    if (error) {
+      _push_event<Event>(
+        es::NULL_HANDLE, es::CONNECT_HANDLE, _protocol, event_id, error
+      );
+      _handle_error(es::NULL_HANDLE, Error(es::ERROR_CONNECT, error));
+      return;
+    }
+
+    if (!_insert(connection, es::ERROR_CONNECT)) {
+      _push_event<Event>(
+        es::NULL_HANDLE, es::CONNECT_HANDLE, _protocol, event_id, boost::asio::error::no_buffer_space
+      );
+      return;
+    }
+
+    if (_compressor_factory) {
+      _initiate_compression(*connection);
+    }
+
+    if (host) {
+      connection->socket.set_option(boost::asio::socket_base::keep_alive(true), ignored);
+      host->members.push_back(connection);
+      _host_of[connection.get()] = host;
+    }
+
+    _push_event<Event>(
+      connection->handle, es::CONNECT_HANDLE, _protocol, event_id
+    );
+
+    if (_is_auto_read()) {
+      _begin_read(std::move(connection));
+    }
+  }
+
+  /**
+   * Removes the passed connection from the pool it belongs to, if any.
+   * Called as the connection is closed, so a pool only ever holds open
+   * connections.
+   * 
+   * @param connection The connection being closed.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _forget(
+    const ConnectionP& connection)
+  {
+    auto it = _host_of.find(connection.get());
+
+    if (it == _host_of.end()) {
+      return;
+    }
+
+    // The passed pointer may be an element of either vector, so the
+    // connection is held on to until it has been removed from both.
+    ConnectionP held = connection;
+    _Host& host = *it->second;
+
+    _host_of.erase(it);
+    host.members.erase(std::remove(host.members.begin(), host.members.end(), held), host.members.end());
+    host.idle.erase(std::remove(host.idle.begin(), host.idle.end(), held), host.idle.end());
+  }
+
+  /**
+   * Hands out, connects for or times out the waiters of every host that
+   * has any.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _service_waiters()
+  {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    for (auto& entry : _hosts) {
+      _Host& host = entry.second;
+
+      if (host.waiters.empty()) {
+        continue;
+      }
+
+      while (!host.waiters.empty()) {
+        _Waiter waiter = host.waiters.front();
+
+        if (waiter.deadline <= now) {
+          _push_event<Event>(
+            es::NULL_HANDLE, es::CONNECT_HANDLE, _protocol, waiter.event_id, boost::asio::error::timed_out
+          );
+        } else if (!host.idle.empty()) {
+          _push_event<Event>(
+            host.idle.back()->handle, es::CONNECT_HANDLE, _protocol, waiter.event_id
+          );
+          host.idle.pop_back();
+        } else if (host.members.size() + host.nconnecting < _max_connections_per_host) {
+          host.nconnecting++;
+          _begin_connect(host.name, host.port,
+            std::chrono::duration_cast<std::chrono::milliseconds>(waiter.deadline - now), waiter.event_id, &host
+          );
+        } else {
+          break;
+        }
+
+        host.waiters.pop_front();
+        _nwaiters--;
+      }
+    }
+  }
+
+  /**
+   * Services the waiters again shortly, and keeps doing so for as long
+   * as there are any. This way waiters are handed connections and timed
+   * out even when the io_service is run by the application instead of
+   * update(). A wait cut short by the client going away does nothing.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _schedule_waiters()
+  {
+    _waiter_timer.expires_from_now(boost::posix_time::milliseconds(_waiter_interval_ms));
+    _waiter_timer.async_wait([this](boost::system::error_code error) {
+      if (error) {
+        return;
+      }
+
+      _service_waiters();
+
+      if (_nwaiters) {
+        _schedule_waiters();
+      }
+    });
+  }
+public:
+  /**
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  TCPClient()
+  : Server<boost::asio::ip::tcp>(es::TCP, std::string(), 0),
+    _max_connections_per_host(8),
+    _max_idle_per_host(8),
+    _nwaiters(0),
+    _waiter_timer(_executor)
+  {
+    _close_handler = [this](const ConnectionP& connection) {
+      _forget(connection);
+    };
+  }
+
+  /**
+   * 
+   * @param io_service The io_service to run on, e.g. the one of a TCPServer.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  explicit TCPClient(
+    IOServiceP io_service)
+  : Server<boost::asio::ip::tcp>(es::TCP, io_service, std::string(), 0),
+    _max_connections_per_host(8),
+    _max_idle_per_host(8),
+    _nwaiters(0),
+    _waiter_timer(_executor)
+  {
+    _close_handler = [this](const ConnectionP& connection) {
+      _forget(connection);
+    };
+  }
+
+  /**
+   * Opens a new connection that is not part of any pool. Returns the id
+   * carried by the resulting CONNECT_BEGIN and CONNECT_HANDLE events.
+   * 
+   * @param name The host name or address.
+   * @param port The port.
+   * @param timeout How long to wait for the connection to be established.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t connect(
+    const std::string& name,
+    uint16_t port,
+    std::chrono::milliseconds timeout)
+  {
+    uint64_t event_id = es::make_uid();
+
+    _push_begin_event<Event>(
+      es::NULL_HANDLE, es::CONNECT_BEGIN, _protocol, event_id
+    );
+
+    _begin_connect(name, port, timeout, event_id, nullptr);
+
+    return event_id;
+  }
+
+  /**
+   * Leases a pooled connection to the passed host, reusing an idle one
+   * when there is one so no handshake is needed. Otherwise a new one is
+   * connected, unless the host is at its connection limit in which case
+   * the call waits for release() to hand one back. Returns the id carried
+   * by the resulting CONNECT_BEGIN and CONNECT_HANDLE events.
+   * 
+   * @param name The host name or address.
+   * @param port The port.
+   * @param timeout How long to wait for a connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t acquire(
+    const std::string& name,
+    uint16_t port,
+    std::chrono::milliseconds timeout)
+  {
+    uint64_t event_id = es::make_uid();
+    _Host& host = _hosts[name + ":" + std::to_string(port)];
+
+    host.name = name;
+    host.port = port;
+
+    _push_begin_event<Event>(
+      es::NULL_HANDLE, es::CONNECT_BEGIN, _protocol, event_id
+    );
+
+    if (!host.idle.empty()) {
+      _push_event<Event>(
+        host.idle.back()->handle, es::CONNECT_HANDLE, _protocol, event_id
+      );
+      host.idle.pop_back();
+    } else if (host.members.size() + host.nconnecting < _max_connections_per_host) {
+      host.nconnecting++;
+      _begin_connect(name, port, timeout, event_id, &host);
+    } else {
+      host.waiters.push_back({ event_id, std::chrono::steady_clock::now() + timeout });
+
+      if (!_nwaiters++) {
+        _schedule_waiters();
+      }
+    }
+
+    return event_id;
+  }
+
+  /**
+   * Returns a connection leased with acquire() to its pool. It goes to
+   * the oldest waiter if there is one, is kept idle otherwise, or is
+   * closed if the host already has as many idle connections as allowed.
+   * Connections that were not acquired from a pool, or that are already
+   * idle, are left untouched.
+   * 
+   * @param handle The handle of the connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void release(
+    ConnectionHandle handle)
+  {
+    const ConnectionP& connection = _connections.find(handle);
+
+    if (!connection) {
+      return;
+    }
+
+    auto it = _host_of.find(connection.get());
+
+    if (it == _host_of.end()) {
+      return;
+    }
+
+    _Host& host = *it->second;
+
+    if (std::find(host.idle.begin(), host.idle.end(), connection) != host.idle.end()) {
+      return;
+    }
+
+    if (!host.waiters.empty()) {
+      _push_event<Event>(
+        handle, es::CONNECT_HANDLE, _protocol, host.waiters.front().event_id
+      );
+      host.waiters.pop_front();
+      _nwaiters--;
+    } else if (host.idle.size() < _max_idle_per_host) {
+      host.idle.push_back(connection);
+    } else {
+      _close(connection);
+    }
+  }
+
+  /**
+   * 
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  UpdateResult update()
+  {
+    if (_nwaiters) {
+      _service_waiters();
+    }
+
+    return Server<boost::asio::ip::tcp>::update();
+  }
+
+  /**
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_max_connections_per_host(
+    std::size_t nconnections)
+  {
+    _max_connections_per_host = nconnections;
+  }
+
+  /**
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void set_max_idle_per_host(
+    std::size_t nconnections)
+  {
+    _max_idle_per_host = nconnections;
+  }
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -29,37 +29,192 @@
 #ifndef _EASYSOCKETS_TCPSERVER_HPP_
 #define _EASYSOCKETS_TCPSERVER_HPP_
 
+#include "Awaitable.hpp"
+#include "Handoff.hpp"
 #include "Server.hpp"
 
 namespace es {
 
-class TCPServer : public Server<boost::asio::ip::tcp> {
+/**
+ * TCP server decoding frames with the passed codec and compiled with the
+ * passed policies. Use TCPServer for the default RawCodec and runtime
+ * configuration.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+template <
+  class CodecTy = RawCodec,
+  class PoliciesTy = RuntimePolicies,
+  class LoggerTy = Logger>
+class BasicTCPServer : public Server<boost::asio::ip::tcp, LoggerTy, CodecTy, PoliciesTy> {
+  template <class> friend class AwaitableConnection;
 public:
-  typedef std::shared_ptr<TCPServer> Pointer;
+  typedef std::shared_ptr<BasicTCPServer> Pointer;
+  typedef Server<boost::asio::ip::tcp, LoggerTy, CodecTy, PoliciesTy> Base;
+  typedef typename Base::ConnectionTy ConnectionTy;
+  typedef typename Base::ConnectionP ConnectionP;
+protected:
+  using Base::_accept_backoff;
+  using Base::_accept_timer;
+  using Base::_begin_read;
+  using Base::_connections;
+  using Base::_deferred_reads;
+  using Base::_handle_accept_error;
+  using Base::_handle_error;
+  using Base::_insert;
+  using Base::_next_accept_backoff;
+  using Base::_is_auto_read;
+  using Base::_is_ready_for_handoff;
+  using Base::_executor;
+  using Base::_pause_for_handoff;
+  using Base::_protocol;
+  using Base::_release_after_handoff;
+  using Base::_resume_after_handoff;
+  using Base::_socket_options;
+  using Base::_uring;
 private:
   bool __is_started;
 protected:
+  boost::asio::ip::tcp _acceptor_protocol;
   boost::asio::ip::tcp::acceptor _acceptor;
+  HandlerMemory _accept_memory;
+  uint64_t _accept_op;
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  boost::asio::local::stream_protocol::acceptor _handoff_acceptor;
+  boost::asio::local::stream_protocol::socket _handoff_socket;
+  std::string _handoff_path;
+  std::chrono::milliseconds _handoff_drain_timeout;
+  bool _is_handing_off_connections;
+  std::vector<ConnectionP> _handed_off;
+  char _handoff_reply;
+#endif
+
+  /**
+   * Returns the protocol, IPv4 or IPv6, of the passed listening socket.
+   * 
+   * @param descriptor The listening socket.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static boost::asio::ip::tcp _protocol_of(
+    int descriptor)
+  {
+    sockaddr_storage address {};
+    socklen_t nbytes = sizeof(address);
+
+    ::getsockname(descriptor, reinterpret_cast<sockaddr*>(&address), &nbytes);
+
+    return address.ss_family == AF_INET6 ? boost::asio::ip::tcp::v6() : boost::asio::ip::tcp::v4();
+  }
 
   /**
+   * Opens, binds and listens on the listening socket.
+   * 
+   * @param host The address to listen on.
+   * @param port The port to listen on.
+   * @param options The socket options of the listening socket and of every accepted connection.
    * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _listen(
+    const std::string& host,
+    uint16_t port,
+    const SocketOptions& options)
+  {
+    boost::system::error_code error;
+
+    _socket_options = options;
+    _acceptor.open(_acceptor_protocol);
+    options.apply_before_bind(_acceptor, error);
+    _acceptor.bind(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(host), port));
+    _acceptor.listen(options.listen_backlog);
+    options.apply_after_listen(_acceptor, error);
+
+    if (error) {
+      _handle_error(es::NULL_HANDLE, Error(es::ERROR_ACCEPT, error));
+    }
+  }
+
+  /**
+   * Starts waiting for the next incoming connection. The connection only
+   * gets a handle once it has been accepted, so ACCEPT_BEGIN events carry
+   * NULL_HANDLE.
    * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
   void _begin_accept() {
-    TCPSocketP client = std::make_shared<TCPSocket>(*_io_service);
+    if (_uring) {
+      _begin_uring_accept();
+      return;
+    }
 
-    _events.push(std::make_shared<Event>(
-      client, es::ACCEPT_BEGIN, _protocol
-    ));
+    ConnectionP connection = std::make_shared<ConnectionTy>(_executor);
+    TCPSocket& socket = connection->socket;
 
-    _acceptor.async_accept(*client,
-      boost::bind(&TCPServer::_handle_accept,
-        this, client, boost::asio::placeholders::error
+    this->template _push_begin_event<Event>(
+      es::NULL_HANDLE, es::ACCEPT_BEGIN, _protocol
+    );
+
+    _acceptor.async_accept(socket,
+      es::make_custom_alloc_handler(_accept_memory,
+        [this, connection = std::move(connection)](
+          boost::system::error_code error) mutable
+        {
+          _handle_accept(std::move(connection), error);
+        }
       )
     );
   }
 
+  /**
+   * Same as above, accepting through the io_uring engine. A single
+   * multishot accept keeps producing connections until it fails or is
+   * cancelled, and only then is another one started.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _begin_uring_accept() {
+    this->template _push_begin_event<Event>(
+      es::NULL_HANDLE, es::ACCEPT_BEGIN, _protocol
+    );
+
+    _accept_op = _uring->accept(_acceptor.native_handle(),
+      [this](int result, bool more) {
+        if (!more) {
+          _accept_op = 0;
+        }
+
+        if (result >= 0) {
+          ConnectionP connection = std::make_shared<ConnectionTy>(_executor);
+          boost::system::error_code error;
+
+          connection->socket.assign(_acceptor_protocol, result, error);
+
+          if (error) {
+            UringEngine::close_descriptor(result);
+            _handle_error(es::NULL_HANDLE, Error(es::ERROR_ACCEPT, error));
+          } else {
+            _handle_accepted(std::move(connection));
+          }
+        } else if (result != -EAGAIN) {
+          Error error(es::ERROR_ACCEPT, boost::system::error_code(-result, boost::system::system_category()));
+
+          if (!more) {
+            _handle_accept_error(error, [this]() { _begin_accept(); });
+            return;
+          }
+
+          _handle_error(es::NULL_HANDLE, error);
+        }
+
+        if (!more) {
+          _begin_accept();
+        }
+      }
+    );
+  }
+
   /**
    * 
    * @param
@@ -68,56 +223,527 @@ protected:
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
   void _handle_accept(
-    SocketP client,
+    ConnectionP connection,
     boost::system::error_code error)
   {
-    _events.push(std::make_shared<Event>(
-      client, es::ACCEPT_HANDLE, _protocol, error
-    ));
+    if (error) {
+      _handle_accept_error(Error(es::ERROR_ACCEPT, error), [this]() { _begin_accept(); });
+      return;
+    }
+
+    _handle_accepted(std::move(connection));
+    _begin_accept();
+  }
+
+  /**
+   * Registers a freshly accepted connection and starts reading from it
+   * if auto reading is enabled.
+   * 
+   * @param connection The accepted connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _handle_accepted(
+    ConnectionP connection)
+  {
+    _accept_backoff = boost::posix_time::time_duration();
+
+    if (!_insert(connection)) {
+      return;
+    }
+
+    this->template _push_event<Event>(
+      connection->handle, es::ACCEPT_HANDLE, _protocol
+    );
+
+    if (_is_auto_read()) {
+      _begin_read(std::move(connection));
+    }
+  }
+
+  /**
+   * Stops accepting without closing the listening socket.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _pause_accept()
+  {
+    boost::system::error_code ignored;
+
+    if (_accept_op) {
+      _uring->cancel(_accept_op);
+      _uring->flush();
+      _accept_op = 0;
+    }
+
+    _acceptor.cancel(ignored);
+    _accept_timer.cancel(ignored);
+  }
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  /**
+   * Starts waiting for a successor on the handoff path.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _begin_handoff_accept()
+  {
+    _handoff_acceptor.async_accept(_handoff_socket,
+      [this](boost::system::error_code error) {
+        Error failure(es::ERROR_ACCEPT, error);
+
+        if (!error) {
+          _hand_off();
+        } else if (!failure.is_cancelled()) {
+          _handle_error(es::NULL_HANDLE, failure);
+
+          if (failure.is_disconnect()) {
+            _begin_handoff_accept();
+          }
+        }
+      }
+    );
+  }
+
+  /**
+   * Hands the listening socket, and the connections that qualify, to the
+   * successor that just connected, then waits for it to acknowledge them.
+   * Until it does, the listening socket and those connections are paused
+   * rather than given up.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _hand_off()
+  {
+    _pause_accept();
+
+    if (_is_handing_off_connections) {
+      _connections.for_each([this](const ConnectionP& connection) {
+        if (_pause_for_handoff(connection)) {
+          _handed_off.push_back(connection);
+        }
+      });
+    }
+
+    _send_handoff();
+  }
+
+  /**
+   * Sends the listening socket and the paused connections, with what
+   * their read buffers hold, to the successor. Waits first for the reads
+   * cancelled by the pause to complete, since a read that had already
+   * received bytes only adds them to the read buffer when its handler
+   * runs.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _send_handoff()
+  {
+    std::vector<HandoffConnection> connections;
+    boost::system::error_code error;
+
+    for (const ConnectionP& connection : _handed_off) {
+      if (!_is_ready_for_handoff(connection)) {
+        boost::asio::post(_executor, [this]() { _send_handoff(); });
+        return;
+      }
+    }
+
+    for (const ConnectionP& connection : _handed_off) {
+      const StreamBuffer& buffer = *connection->read_buffer;
+
+      connections.push_back(HandoffConnection {
+        connection->socket.native_handle(),
+        std::string(boost::asio::buffers_begin(buffer.data()), boost::asio::buffers_end(buffer.data()))
+      });
+    }
+
+    _handoff_socket.non_blocking(false, error);
+
+    if (error || !Handoff::send(_handoff_socket.native_handle(), _acceptor.native_handle(), connections, error)) {
+      _handle_handoff_failure(error);
+      return;
+    }
+
+    boost::asio::async_read(_handoff_socket, boost::asio::buffer(&_handoff_reply, 1),
+      [this](boost::system::error_code error, std::size_t) {
+        if (error || !Handoff::is_acknowledgement(_handoff_reply)) {
+          _handle_handoff_failure(error ? error : boost::asio::error::invalid_argument);
+        } else {
+          _handle_handoff_success();
+        }
+      }
+    );
+  }
+
+  /**
+   * Takes back the listening socket and paused connections after a failed
+   * handoff, and waits for another successor.
+   * 
+   * @param error The handoff error.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _handle_handoff_failure(
+    const boost::system::error_code& error)
+  {
+    boost::system::error_code ignored;
 
-    if (_auto_read) {
-      _begin_read(client);
+    _handle_error(es::NULL_HANDLE, Error(es::ERROR_ACCEPT, error));
+    _handoff_socket.close(ignored);
+
+    for (const ConnectionP& connection : _handed_off) {
+      _resume_after_handoff(connection);
+    }
+
+    _handed_off.clear();
+
+    if (__is_started) {
+      _begin_accept();
+    }
+
+    _begin_handoff_accept();
+  }
+
+  /**
+   * Lets go of everything the successor adopted and stops, draining the
+   * connections that stayed behind.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _handle_handoff_success()
+  {
+    boost::system::error_code ignored;
+
+    for (const ConnectionP& connection : _handed_off) {
+      _release_after_handoff(connection);
     }
 
-	  _begin_accept();
+    _handed_off.clear();
+    _handoff_socket.close(ignored);
+    stop(_handoff_drain_timeout);
   }
+#endif
 public:
   /**
    * 
    * @param 
    * @param 
+   * @param engine ENGINE_EPOLL, or ENGINE_IO_URING to perform I/O through io_uring where the kernel supports it.
+   * @param options The socket options of the listening socket and of every accepted connection.
    * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  TCPServer::TCPServer(
+  BasicTCPServer(
     const std::string& host,
-    uint16_t port)
-  : Server<boost::asio::ip::tcp>(es::TCP, host, port),
+    uint16_t port,
+    int8_t engine = es::ENGINE_EPOLL,
+    const SocketOptions& options = SocketOptions())
+  : Base(es::TCP, host, port, engine),
     __is_started(false),
-    _acceptor(
-      *_io_service,
-      boost::asio::ip::tcp::endpoint(
-        boost::asio::ip::address::from_string(host), port
-      )
-    )
-  {}
+    _acceptor_protocol(
+      boost::asio::ip::address::from_string(host).is_v6()
+        ? boost::asio::ip::tcp::v6()
+        : boost::asio::ip::tcp::v4()
+    ),
+    _acceptor(_executor),
+    _accept_op(0)
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    ,
+    _handoff_acceptor(_executor),
+    _handoff_socket(_executor),
+    _is_handing_off_connections(false)
+#endif
+  {
+    _listen(host, port, options);
+  }
+
+  /**
+   * Same as above, running on the passed io_service as described by the
+   * matching Server constructor. When the application runs the io_service
+   * itself, call start() to begin accepting.
+   * 
+   * @param io_service The io_service to run on.
+   * @param 
+   * @param 
+   * @param engine ENGINE_EPOLL, or ENGINE_IO_URING to perform I/O through io_uring where the kernel supports it.
+   * @param options The socket options of the listening socket and of every accepted connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  BasicTCPServer(
+    IOServiceP io_service,
+    const std::string& host,
+    uint16_t port,
+    int8_t engine = es::ENGINE_EPOLL,
+    const SocketOptions& options = SocketOptions())
+  : Base(es::TCP, io_service, host, port, engine),
+    __is_started(false),
+    _acceptor_protocol(
+      boost::asio::ip::address::from_string(host).is_v6()
+        ? boost::asio::ip::tcp::v6()
+        : boost::asio::ip::tcp::v4()
+    ),
+    _acceptor(_executor),
+    _accept_op(0)
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    ,
+    _handoff_acceptor(_executor),
+    _handoff_socket(_executor),
+    _is_handing_off_connections(false)
+#endif
+  {
+    _listen(host, port, options);
+  }
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  /**
+   * Adopts the listening socket and connections handed over by the
+   * server of a process being replaced, then acknowledges the handoff so
+   * that process lets go of them. Adopted connections are reported with
+   * ACCEPT_HANDLE events and start reading on the first update(); bytes
+   * they had received but not delivered yet are delivered as if they had
+   * just arrived.
+   * 
+   * @param handoff A handoff received from the old process.
+   * @param engine ENGINE_EPOLL, or ENGINE_IO_URING to perform I/O through io_uring where the kernel supports it.
+   * @param options The socket options of every adopted connection.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  BasicTCPServer(
+    Handoff& handoff,
+    int8_t engine = es::ENGINE_EPOLL,
+    const SocketOptions& options = SocketOptions())
+  : Base(es::TCP, std::string(), 0, engine),
+    __is_started(false),
+    _acceptor_protocol(_protocol_of(handoff.listener)),
+    _acceptor(_executor),
+    _accept_op(0),
+    _handoff_acceptor(_executor),
+    _handoff_socket(_executor),
+    _is_handing_off_connections(false)
+  {
+    boost::system::error_code error;
+
+    _socket_options = options;
+    _acceptor.assign(_acceptor_protocol, handoff.listener, error);
+
+    if (error) {
+      _handle_error(es::NULL_HANDLE, Error(es::ERROR_ACCEPT, error));
+      return;
+    }
+
+    handoff.listener = -1;
+
+    for (HandoffConnection& adopted : handoff.connections) {
+      ConnectionP connection = std::make_shared<ConnectionTy>(_executor);
+
+      connection->socket.assign(_acceptor_protocol, adopted.descriptor, error);
+
+      if (error) {
+        _handle_error(es::NULL_HANDLE, Error(es::ERROR_ACCEPT, error));
+        continue;
+      }
+
+      adopted.descriptor = -1;
+      connection->read_buffer->sputn(adopted.buffered.data(), adopted.buffered.size());
+
+      if (!_insert(connection)) {
+        continue;
+      }
+
+      this->template _push_event<Event>(
+        connection->handle, es::ACCEPT_HANDLE, _protocol
+      );
+
+      // Deferred so that reading starts with the read mode set after
+      // construction.
+      if (_is_auto_read()) {
+        _deferred_reads.push_back(std::move(connection));
+      }
+    }
+
+    if (!handoff.acknowledge(error)) {
+      _handle_error(es::NULL_HANDLE, Error(es::ERROR_ACCEPT, error));
+    }
+  }
+#endif
 
   /**
    * 
    * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  UpdateResult TCPServer::update()
+  UpdateResult update()
   {
     if (!__is_started) {
       _begin_accept();
       __is_started = true;
     }
 
-    return Server<boost::asio::ip::tcp>::update();
+    return Base::update();
+  }
+
+  /**
+   * Starts accepting connections on the server's executor. update() does
+   * this on its own; this is for servers whose io_service is run by the
+   * application. Safe to call from any thread.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void start()
+  {
+    boost::asio::dispatch(_executor, [this]() {
+      if (!__is_started) {
+        _begin_accept();
+        __is_started = true;
+      }
+    });
+  }
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+  /**
+   * Waits for the next incoming connection from within a coroutine. Once
+   * this has been called, update() no longer accepts connections on its
+   * own. Failed accepts are reported and retried as they are for the
+   * event-driven accept loop; the coroutine only sees an exception if the
+   * server is stopped while waiting.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  Awaitable<AwaitableConnection<BasicTCPServer>> accept()
+  {
+    __is_started = true;
+
+    for (;;) {
+      ConnectionP connection = std::make_shared<ConnectionTy>(_executor);
+      boost::system::error_code error;
+
+      co_await _acceptor.async_accept(connection->socket,
+        boost::asio::redirect_error(boost::asio::use_awaitable, error)
+      );
+
+      if (!error) {
+        _accept_backoff = boost::posix_time::time_duration();
+
+        if (!_insert(connection)) {
+          continue;
+        }
+
+        co_return AwaitableConnection<BasicTCPServer>(*this, std::move(connection));
+      }
+
+      Error failure(es::ERROR_ACCEPT, error);
+
+      if (failure.is_cancelled()) {
+        throw boost::system::system_error(error);
+      }
+
+      _handle_error(es::NULL_HANDLE, failure);
+
+      if (!failure.is_disconnect()) {
+        _accept_timer.expires_from_now(_next_accept_backoff());
+        co_await _accept_timer.async_wait(
+          boost::asio::redirect_error(boost::asio::use_awaitable, error)
+        );
+      }
+    }
+  }
+#endif
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  /**
+   * Waits on the passed local socket path for a successor, typically a
+   * newer build of this process, to take over. When one connects with
+   * Handoff::receive(), the listening socket is handed to it along with,
+   * if enabled, every connection with nothing left to send and no
+   * per-connection compression. Once the successor acknowledges them,
+   * this server stops as with stop(), draining the connections that
+   * stayed behind. If the successor fails first, everything is taken
+   * back and the server waits for another one.
+   * 
+   * Connections are only handed off with the epoll engine; with io_uring
+   * only the listening socket is.
+   * 
+   * @param path The handoff path, or '@' followed by an abstract name.
+   * @param drain_timeout How long to wait for the remaining connections to close on their own.
+   * @param is_handing_off_connections False to only hand off the listening socket.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool listen_for_handoff(
+    const std::string& path,
+    std::chrono::milliseconds drain_timeout,
+    bool is_handing_off_connections = true)
+  {
+    boost::system::error_code error;
+
+    if (path.empty()) {
+      return false;
+    }
+
+    es::remove_socket_file(path);
+
+    _handoff_path = path;
+    _handoff_drain_timeout = drain_timeout;
+    _is_handing_off_connections = is_handing_off_connections;
+    _handoff_acceptor.open(boost::asio::local::stream_protocol(), error);
+
+    if (!error) {
+      _handoff_acceptor.bind(es::local_endpoint_of(path), error);
+    }
+
+    if (!error) {
+      _handoff_acceptor.listen(1, error);
+    }
+
+    if (error) {
+      boost::system::error_code ignored;
+
+      _handoff_acceptor.close(ignored);
+      _handle_error(es::NULL_HANDLE, Error(es::ERROR_ACCEPT, error));
+      return false;
+    }
+
+    _begin_handoff_accept();
+
+    return true;
+  }
+#endif
+
+  /**
+   * Stops accepting new connections, then drains and closes the open ones
+   * as described by Server::stop().
+   * 
+   * @param drain_timeout How long to wait for connections to close on their own.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void stop(
+    std::chrono::milliseconds drain_timeout)
+  {
+    boost::system::error_code ignored;
+
+    // The engine holds its own reference to the listening socket, so its
+    // accept has to be cancelled before closing the acceptor stops it.
+    _pause_accept();
+    _acceptor.close(ignored);
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    if (_handoff_acceptor.is_open()) {
+      _handoff_acceptor.close(ignored);
+
+      es::remove_socket_file(_handoff_path);
+    }
+#endif
+    __is_started = true;
+
+    Base::stop(drain_timeout);
   }
 };
 
+typedef BasicTCPServer<> TCPServer;
+
 }
 
 #endif
\ No newline at end of file
@@ -44,7 +44,7 @@ public:
    * 
    * @author Tyler O'Brien <contact@tylerobrien.com>
    * */
-  UDPServer::UDPServer(
+  UDPServer(
     const std::string& host,
     uint16_t port)
   : Server<boost::asio::ip::udp>(es::UDP, host, port)
@@ -0,0 +1,817 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+#ifndef _EASYSOCKETS_URINGENGINE_HPP_
+#define _EASYSOCKETS_URINGENGINE_HPP_
+
+#include "EasySockets.hpp"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_ACCEPT_MULTISHOT)
+#define EASYSOCKETS_HAS_IO_URING 1
+#endif
+#endif
+#endif
+
+#if defined(EASYSOCKETS_HAS_IO_URING)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace es {
+
+/**
+ * I/O engine that performs accepts, receives and sends through a Linux
+ * io_uring instead of asio's epoll reactor. Requests made during one
+ * io_service handler are batched and submitted together with a single
+ * io_uring_enter(). Accepts are multishot, and receives pick a buffer
+ * from a ring of provided buffers owned by the engine, so no memory is
+ * tied up by connections that are merely waiting for data.
+ * 
+ * Completions are signalled through an eventfd that is waited on like
+ * any other descriptor, so callbacks run on whichever thread runs the
+ * io_service, exactly like asio completion handlers.
+ * 
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class UringEngine : public std::enable_shared_from_this<UringEngine> {
+public:
+  typedef std::shared_ptr<UringEngine> Pointer;
+protected:
+  /**
+   * A single in-flight request. The callback is stored inline so that
+   * issuing a request does not allocate once the op pool is warm.
+   * */
+  struct _Op {
+    uint32_t generation;
+    void (*invoke)(_Op&, int, uint32_t);
+    void (*destroy)(_Op&);
+    typename std::aligned_storage<64>::type storage;
+  };
+
+  boost::asio::any_io_executor _executor;
+  boost::asio::posix::stream_descriptor _notifier;
+  int _ring_fd;
+  uint64_t _notify_count;
+
+  void* _sq_ring;
+  void* _cq_ring;
+  std::size_t _sq_ring_nbytes;
+  std::size_t _cq_ring_nbytes;
+  io_uring_sqe* _sqes;
+  std::size_t _sqes_nbytes;
+  unsigned* _sq_head;
+  unsigned* _sq_tail;
+  unsigned* _sq_mask;
+  unsigned* _sq_array;
+  unsigned* _cq_head;
+  unsigned* _cq_tail;
+  unsigned* _cq_mask;
+  io_uring_cqe* _cqes;
+  unsigned _nsq_entries;
+  unsigned _npending;
+  bool _is_flush_posted;
+
+  io_uring_buf* _buffer_ring;
+  std::size_t _buffer_ring_nbytes;
+  std::vector<char> _buffers;
+  std::size_t _buffer_nbytes;
+  unsigned _nbuffers;
+  uint16_t _buffer_tail;
+
+  bool _has_multishot_accept;
+  std::vector<_Op*> _ops;
+  std::vector<uint32_t> _free_ops;
+
+  static int _setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+  }
+
+  static int _enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+  }
+
+  static int _register(int fd, unsigned opcode, void* arg, unsigned nargs) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nargs));
+  }
+
+  /**
+   * Maps the rings of a freshly set up io_uring. Returns false if any of
+   * the mappings fails.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool _map(
+    const io_uring_params& params)
+  {
+    _sq_ring_nbytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_ring_nbytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      _sq_ring_nbytes = _cq_ring_nbytes = std::max(_sq_ring_nbytes, _cq_ring_nbytes);
+    }
+
+    _sq_ring = ::mmap(nullptr, _sq_ring_nbytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+
+    if (_sq_ring == MAP_FAILED) {
+      _sq_ring = nullptr;
+      return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      _cq_ring = _sq_ring;
+    } else {
+      _cq_ring = ::mmap(nullptr, _cq_ring_nbytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_CQ_RING);
+
+      if (_cq_ring == MAP_FAILED) {
+        _cq_ring = nullptr;
+        return false;
+      }
+    }
+
+    _sqes_nbytes = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, _sqes_nbytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+
+    if (sqes == MAP_FAILED) {
+      return false;
+    }
+
+    char* sq = static_cast<char*>(_sq_ring);
+    char* cq = static_cast<char*>(_cq_ring);
+
+    _sqes = static_cast<io_uring_sqe*>(sqes);
+    _sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    _sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    _cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    _nsq_entries = params.sq_entries;
+
+    return true;
+  }
+
+  /**
+   * Allocates and registers the ring of provided buffers receives are
+   * served from. Returns false if the kernel does not support it.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  bool _map_buffers()
+  {
+    _buffer_ring_nbytes = _nbuffers * sizeof(io_uring_buf);
+    void* ring = ::mmap(nullptr, _buffer_ring_nbytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (ring == MAP_FAILED) {
+      return false;
+    }
+
+    _buffer_ring = static_cast<io_uring_buf*>(ring);
+    _buffers.resize(_nbuffers * _buffer_nbytes);
+
+    io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(_buffer_ring);
+    reg.ring_entries = _nbuffers;
+    reg.bgid = 0;
+
+    if (_register(_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+      return false;
+    }
+
+    for (uint16_t i = 0; i < _nbuffers; i++) {
+      _recycle_buffer(i, false);
+    }
+
+    _publish_buffers();
+
+    return true;
+  }
+
+  /**
+   * Hands the passed provided buffer back to the kernel.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _recycle_buffer(
+    uint16_t bid,
+    bool publish = true)
+  {
+    io_uring_buf& buf = _buffer_ring[_buffer_tail & (_nbuffers - 1)];
+
+    buf.addr = reinterpret_cast<uint64_t>(&_buffers[bid * _buffer_nbytes]);
+    buf.len = static_cast<uint32_t>(_buffer_nbytes);
+    buf.bid = bid;
+    _buffer_tail++;
+
+    if (publish) {
+      _publish_buffers();
+    }
+  }
+
+  void _publish_buffers()
+  {
+    // The ring tail overlays the reserved field of the first entry.
+    uint16_t* tail = reinterpret_cast<uint16_t*>(
+      reinterpret_cast<char*>(_buffer_ring) + offsetof(io_uring_buf, resv)
+    );
+
+    __atomic_store_n(tail, _buffer_tail, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * Returns a free op slot, storing the passed callback in it. The
+   * callback is invoked with the result and flags of every completion
+   * of the op.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class FnTy>
+  uint32_t _make_op(
+    FnTy&& fn)
+  {
+    typedef typename std::decay<FnTy>::type StoredTy;
+    static_assert(sizeof(StoredTy) <= sizeof(_Op::storage), "io_uring callback too large");
+
+    uint32_t index;
+
+    if (_free_ops.empty()) {
+      index = static_cast<uint32_t>(_ops.size());
+      _ops.push_back(new _Op());
+    } else {
+      index = _free_ops.back();
+      _free_ops.pop_back();
+    }
+
+    _Op& op = *_ops[index];
+
+    new (&op.storage) StoredTy(std::forward<FnTy>(fn));
+    op.invoke = [](_Op& op, int result, uint32_t flags) {
+      (*reinterpret_cast<StoredTy*>(&op.storage))(result, flags);
+    };
+    op.destroy = [](_Op& op) {
+      reinterpret_cast<StoredTy*>(&op.storage)->~StoredTy();
+    };
+
+    return index;
+  }
+
+  void _free_op(
+    uint32_t index)
+  {
+    _Op& op = *_ops[index];
+
+    op.destroy(op);
+    op.destroy = nullptr;
+    op.generation++;
+    _free_ops.push_back(index);
+  }
+
+  /**
+   * The user_data of an op's requests: its slot in the low half and the
+   * generation of the slot in the high half, so that a stale id never
+   * matches a later op reusing the same slot.
+   * */
+  uint64_t _id_of(
+    uint32_t index) const
+  {
+    return (static_cast<uint64_t>(_ops[index]->generation) << 32) | (index + 1);
+  }
+
+  /**
+   * Returns the next free submission queue entry, cleared. Pending
+   * entries are submitted first if the queue is full. Returns null if
+   * the queue is still full afterwards, e.g. because the kernel refused
+   * more submissions with EBUSY until completions are reaped.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  io_uring_sqe* _next_sqe()
+  {
+    unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *_sq_tail;
+
+    if (tail - head >= _nsq_entries) {
+      flush();
+      head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+      tail = *_sq_tail;
+
+      if (tail - head >= _nsq_entries) {
+        return nullptr;
+      }
+    }
+
+    unsigned index = tail & *_sq_mask;
+    io_uring_sqe* sqe = &_sqes[index];
+
+    std::memset(sqe, 0, sizeof(*sqe));
+    _sq_array[index] = index;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    _npending++;
+
+    if (!_is_flush_posted) {
+      std::weak_ptr<UringEngine> weak = shared_from_this();
+
+      _is_flush_posted = true;
+      boost::asio::post(_executor, [weak]() {
+        if (Pointer engine = weak.lock()) {
+          engine->_is_flush_posted = false;
+          engine->flush();
+        }
+      });
+    }
+
+    return sqe;
+  }
+
+  /**
+   * Completes the op in the passed slot with the passed result from a
+   * handler of its own, for ops that could not be queued. Callbacks
+   * thereby never run inside the call that started their op.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _fail_op(
+    uint32_t index,
+    int result)
+  {
+    std::weak_ptr<UringEngine> weak = shared_from_this();
+    uint64_t id = _id_of(index);
+
+    boost::asio::post(_executor, [weak, index, id, result]() {
+      if (Pointer engine = weak.lock()) {
+        if (engine->_id_of(index) == id) {
+          _Op& op = *engine->_ops[index];
+
+          op.invoke(op, result, 0);
+          engine->_free_op(index);
+        }
+      }
+    });
+  }
+
+  /**
+   * Waits for the eventfd the kernel signals whenever a completion is
+   * posted.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _begin_wait()
+  {
+    std::weak_ptr<UringEngine> weak = shared_from_this();
+
+    _notifier.async_read_some(boost::asio::buffer(&_notify_count, sizeof(_notify_count)),
+      [weak](boost::system::error_code error, std::size_t) {
+        if (error) {
+          return;
+        }
+
+        if (Pointer engine = weak.lock()) {
+          engine->_reap();
+          engine->_begin_wait();
+        }
+      }
+    );
+  }
+
+  /**
+   * Dispatches every completion currently in the completion queue.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _reap()
+  {
+    unsigned head = *_cq_head;
+
+    for (;;) {
+      unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+
+      if (head == tail) {
+        break;
+      }
+
+      io_uring_cqe cqe = _cqes[head & *_cq_mask];
+      head++;
+      __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+
+      uint32_t index = static_cast<uint32_t>(cqe.user_data & 0xFFFFFFFF);
+
+      if (!index || index > _ops.size() || _ops[index - 1]->generation != (cqe.user_data >> 32)) {
+        continue;
+      }
+
+      _Op& op = *_ops[index - 1];
+
+      op.invoke(op, cqe.res, cqe.flags);
+
+      if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        _free_op(index - 1);
+      }
+    }
+  }
+
+  /**
+   * Queues a multishot accept, or a single-shot one if the kernel turned
+   * out not to support multishot.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void _prep_accept(
+    int fd,
+    uint32_t index)
+  {
+    io_uring_sqe* sqe = _next_sqe();
+
+    if (!sqe) {
+      _fail_op(index, -EBUSY);
+      return;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = _id_of(index);
+
+    if (_has_multishot_accept) {
+      sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+    }
+  }
+public:
+  /**
+   * Use create() instead.
+   * */
+  UringEngine(
+    const boost::asio::any_io_executor& executor,
+    std::size_t buffer_nbytes,
+    unsigned nbuffers)
+    : _executor(executor),
+      _notifier(executor),
+      _ring_fd(-1),
+      _notify_count(0),
+      _sq_ring(nullptr),
+      _cq_ring(nullptr),
+      _sq_ring_nbytes(0),
+      _cq_ring_nbytes(0),
+      _sqes(nullptr),
+      _sqes_nbytes(0),
+      _npending(0),
+      _is_flush_posted(false),
+      _buffer_ring(nullptr),
+      _buffer_ring_nbytes(0),
+      _buffer_nbytes(buffer_nbytes),
+      _nbuffers(nbuffers),
+      _buffer_tail(0),
+      _has_multishot_accept(true)
+  {}
+
+  UringEngine(const UringEngine&) = delete;
+  UringEngine& operator = (const UringEngine&) = delete;
+
+  ~UringEngine()
+  {
+    for (_Op* op : _ops) {
+      if (op->destroy) {
+        op->destroy(*op);
+      }
+
+      delete op;
+    }
+
+    // Closing the ring first makes the kernel drop every request still
+    // referring to the provided buffers.
+    if (_ring_fd >= 0) {
+      ::close(_ring_fd);
+    }
+
+    if (_buffer_ring) {
+      ::munmap(_buffer_ring, _buffer_ring_nbytes);
+    }
+
+    if (_sqes) {
+      ::munmap(_sqes, _sqes_nbytes);
+    }
+
+    if (_cq_ring && _cq_ring != _sq_ring) {
+      ::munmap(_cq_ring, _cq_ring_nbytes);
+    }
+
+    if (_sq_ring) {
+      ::munmap(_sq_ring, _sq_ring_nbytes);
+    }
+  }
+
+  /**
+   * Sets up an engine running on the passed executor. Returns null if
+   * the running kernel lacks io_uring or any of the features the engine
+   * relies on, in which case the caller should keep using asio.
+   * 
+   * @param executor The executor completions are delivered on.
+   * @param nentries The size of the submission queue.
+   * @param buffer_nbytes The size of each provided receive buffer.
+   * @param nbuffers The number of provided receive buffers. Must be a power of two.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static Pointer create(
+    const boost::asio::any_io_executor& executor,
+    unsigned nentries = 4096,
+    std::size_t buffer_nbytes = 4096,
+    unsigned nbuffers = 1024)
+  {
+    Pointer engine = std::make_shared<UringEngine>(executor, buffer_nbytes, nbuffers);
+    io_uring_params params;
+
+    std::memset(&params, 0, sizeof(params));
+    engine->_ring_fd = _setup(nentries, &params);
+
+    if (engine->_ring_fd < 0 || !(params.features & IORING_FEAT_NODROP) || !engine->_map(params)) {
+      return Pointer();
+    }
+
+    if ((nbuffers & (nbuffers - 1)) || !engine->_map_buffers()) {
+      return Pointer();
+    }
+
+    int event_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (event_fd < 0) {
+      return Pointer();
+    }
+
+    if (_register(engine->_ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0) {
+      ::close(event_fd);
+      return Pointer();
+    }
+
+    engine->_notifier.assign(event_fd);
+    engine->_begin_wait();
+
+    return engine;
+  }
+
+  /**
+   * Submits every request queued since the last flush.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void flush()
+  {
+    while (_npending) {
+      int nsubmitted = _enter(_ring_fd, _npending, 0, 0);
+
+      if (nsubmitted < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+
+        break;
+      }
+
+      _npending -= std::min<unsigned>(_npending, static_cast<unsigned>(nsubmitted));
+    }
+  }
+
+  /**
+   * Starts accepting on the passed listening socket. The callback gets
+   * the new socket (or a negated errno) and whether more accepts will
+   * follow without calling accept() again. Returns an id for cancel().
+   * 
+   * @param fd The listening socket.
+   * @param fn Called as fn(int result, bool more).
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class FnTy>
+  uint64_t accept(
+    int fd,
+    FnTy fn)
+  {
+    uint32_t index = _make_op(
+      [this, fd, fn = std::move(fn)](int result, uint32_t flags) mutable {
+        if (result == -EINVAL && _has_multishot_accept) {
+          _has_multishot_accept = false;
+          fn(-EAGAIN, false);
+          return;
+        }
+
+        fn(result, (flags & IORING_CQE_F_MORE) != 0);
+      }
+    );
+
+    _prep_accept(fd, index);
+
+    return _id_of(index);
+  }
+
+  /**
+   * Receives from the passed socket into one of the provided buffers.
+   * The callback gets the number of bytes received (or a negated errno)
+   * and a pointer to them, which is only valid during the call.
+   * Returns an id for cancel().
+   * 
+   * @param fd The socket.
+   * @param fn Called as fn(int result, const char* data).
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class FnTy>
+  uint64_t recv(
+    int fd,
+    FnTy fn)
+  {
+    uint32_t index = _make_op(
+      [this, fn = std::move(fn)](int result, uint32_t flags) mutable {
+        if (!(flags & IORING_CQE_F_BUFFER)) {
+          fn(result > 0 ? -EIO : result, nullptr);
+          return;
+        }
+
+        uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+
+        fn(result, &_buffers[bid * _buffer_nbytes]);
+        _recycle_buffer(bid);
+      }
+    );
+
+    io_uring_sqe* sqe = _next_sqe();
+
+    if (!sqe) {
+      _fail_op(index, -EBUSY);
+      return _id_of(index);
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = _id_of(index);
+
+    return _id_of(index);
+  }
+
+  /**
+   * Sends the passed bytes on the passed socket. The callback gets the
+   * number of bytes sent, which may be less than requested, or a
+   * negated errno. The bytes must stay valid until then. Returns an id
+   * for cancel().
+   * 
+   * @param fd The socket.
+   * @param data The bytes to send.
+   * @param nbytes The number of bytes to send.
+   * @param fn Called as fn(int result).
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  template <class FnTy>
+  uint64_t send(
+    int fd,
+    const void* data,
+    std::size_t nbytes,
+    FnTy fn)
+  {
+    uint32_t index = _make_op(
+      [fn = std::move(fn)](int result, uint32_t) mutable {
+        fn(result);
+      }
+    );
+
+    io_uring_sqe* sqe = _next_sqe();
+
+    if (!sqe) {
+      _fail_op(index, -EBUSY);
+      return _id_of(index);
+    }
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(nbytes);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = _id_of(index);
+
+    return _id_of(index);
+  }
+
+  /**
+   * Closes a descriptor produced by accept() that could not be handed
+   * over to a socket object.
+   * 
+   * @param fd The descriptor.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  static void close_descriptor(
+    int fd)
+  {
+    ::close(fd);
+  }
+
+  /**
+   * Cancels the op with the passed id if it is still in flight. Its
+   * callback then completes with -ECANCELED. Nothing is cancelled while
+   * the submission queue is full; the op then completes on its own, as
+   * when closing its socket.
+   * 
+   * @param id The id returned when the op was started.
+   * 
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  void cancel(
+    uint64_t id)
+  {
+    io_uring_sqe* sqe = _next_sqe();
+
+    if (!sqe) {
+      return;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = id;
+    sqe->user_data = 0;
+  }
+};
+
+}
+
+#else
+
+namespace es {
+
+/**
+ * Stand-in used where io_uring is not available. create() always fails
+ * so servers keep using asio.
+ * */
+class UringEngine {
+public:
+  typedef std::shared_ptr<UringEngine> Pointer;
+
+  static Pointer create(
+    const boost::asio::any_io_executor& executor,
+    unsigned nentries = 4096,
+    std::size_t buffer_nbytes = 4096,
+    unsigned nbuffers = 1024)
+  {
+    return Pointer();
+  }
+
+  void flush() {}
+
+  template <class FnTy>
+  uint64_t accept(int fd, FnTy fn) { return 0; }
+
+  template <class FnTy>
+  uint64_t recv(int fd, FnTy fn) { return 0; }
+
+  template <class FnTy>
+  uint64_t send(int fd, const void* data, std::size_t nbytes, FnTy fn) { return 0; }
+
+  static void close_descriptor(int fd) {}
+
+  void cancel(uint64_t id) {}
+};
+
+}
+
+#endif
+
+#endif
\ No newline at end of file
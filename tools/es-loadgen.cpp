@@ -0,0 +1,1123 @@
+/*
+* EasySockets
+*
+* https://tylerobrien.com
+* https://github.com/TylerOBrien
+*
+* Copyright (c) 2018 Tyler O'Brien
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+* */
+
+
+
+
+/**
+ * es-loadgen: opens up to 100k loopback connections with TCPClient,
+ * replays a traffic pattern over them, and reports throughput and
+ * latency percentiles once per interval. Run "es-loadgen serve" in one
+ * process and "es-loadgen run" in another to measure the server's
+ * connections per GB and events/s per core on a single box.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+
+#include "EasySockets/TCPClient.hpp"
+#include "EasySockets/TCPServer.hpp"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <csignal>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace loadgen {
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Command line settings, given as --name=value.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+struct Options {
+  std::string mode;
+  std::string host;
+  uint16_t port;
+  std::size_t connections;
+  std::size_t targets;
+  double connect_rate;
+  std::chrono::milliseconds connect_timeout;
+  std::string pattern;
+  std::string trace;
+  std::size_t size;
+  double rate;
+  std::size_t burst;
+  std::size_t window;
+  std::chrono::seconds duration;
+  std::chrono::milliseconds interval;
+  std::chrono::microseconds tick;
+  uint64_t seed;
+  int8_t engine;
+  es::SocketOptions socket_options;
+
+  Options()
+    : host("127.0.0.1"),
+      port(5000),
+      connections(1000),
+      targets(0),
+      connect_rate(20000),
+      connect_timeout(5000),
+      pattern("framed"),
+      size(64),
+      rate(10),
+      burst(16),
+      window(64),
+      duration(10),
+      interval(1000),
+      tick(1000),
+      seed(1),
+      engine(es::ENGINE_EPOLL)
+  {}
+};
+
+/**
+ * Latency histogram with 64 linear buckets followed by 32 buckets per
+ * power of two, so any recorded value is reported within ~3% while the
+ * whole range up to ~18 minutes fits in a fixed array of counters.
+ * Values are in nanoseconds.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class LatencyHistogram {
+protected:
+  static const unsigned _SUB_BITS = 5;
+  static const unsigned _NLINEAR = 2u << _SUB_BITS;
+  static const unsigned _NBUCKETS = _NLINEAR + (40 - _SUB_BITS) * (1u << _SUB_BITS);
+
+  std::vector<uint64_t> _counts;
+  uint64_t _total;
+  uint64_t _max;
+
+  static unsigned _bucket_of(
+    uint64_t value)
+  {
+    if (value < _NLINEAR) {
+      return static_cast<unsigned>(value);
+    }
+
+    unsigned msb = 63 - static_cast<unsigned>(__builtin_clzll(value));
+    unsigned shift = msb - _SUB_BITS;
+    unsigned bucket = _NLINEAR + (msb - _SUB_BITS - 1) * (1u << _SUB_BITS) + static_cast<unsigned>((value >> shift) - (1u << _SUB_BITS));
+
+    return std::min(bucket, _NBUCKETS - 1);
+  }
+
+  static uint64_t _upper_bound_of(
+    unsigned bucket)
+  {
+    if (bucket < _NLINEAR) {
+      return bucket;
+    }
+
+    unsigned shift = (bucket - _NLINEAR) / (1u << _SUB_BITS) + 1;
+    uint64_t mantissa = (bucket - _NLINEAR) % (1u << _SUB_BITS) + (1u << _SUB_BITS);
+
+    return ((mantissa + 1) << shift) - 1;
+  }
+public:
+  LatencyHistogram()
+    : _counts(_NBUCKETS, 0),
+      _total(0),
+      _max(0)
+  {}
+
+  void record(
+    uint64_t value)
+  {
+    _counts[_bucket_of(value)]++;
+    _total++;
+    _max = std::max(_max, value);
+  }
+
+  /**
+   * Returns the smallest value at or below which the passed fraction of
+   * the recorded values lie, capped by the largest recorded value.
+   *
+   * @param fraction e.g. 0.99 for the 99th percentile.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint64_t percentile(
+    double fraction) const
+  {
+    if (!_total) {
+      return 0;
+    }
+
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * _total + 0.5));
+    uint64_t seen = 0;
+
+    for (unsigned bucket = 0; bucket < _NBUCKETS; bucket++) {
+      seen += _counts[bucket];
+      if (seen >= rank) {
+        return std::min(_upper_bound_of(bucket), _max);
+      }
+    }
+
+    return _max;
+  }
+
+  void merge(
+    const LatencyHistogram& other)
+  {
+    for (unsigned bucket = 0; bucket < _NBUCKETS; bucket++) {
+      _counts[bucket] += other._counts[bucket];
+    }
+
+    _total += other._total;
+    _max = std::max(_max, other._max);
+  }
+
+  void clear()
+  {
+    std::fill(_counts.begin(), _counts.end(), 0);
+    _total = 0;
+    _max = 0;
+  }
+
+  uint64_t total() const {
+    return _total;
+  }
+
+  uint64_t max() const {
+    return _max;
+  }
+};
+
+/**
+ * One message of a traffic pattern: how long to wait after the previous
+ * one, and how many bytes to send.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+struct Step {
+  uint32_t delay_us;
+  uint32_t nbytes;
+};
+
+/**
+ * Produces the messages each connection sends. Patterns are:
+ *
+ *  - framed: fixed size messages at a steady rate.
+ *  - delimited: newline terminated lines of 1/2 to 3/2 of the size.
+ *  - bursty: the same average rate, sent in back to back bursts.
+ *  - trace: replays a recorded file of "<delay_us> <nbytes>" lines.
+ *
+ * Every connection walks the pattern with its own seeded generator, so
+ * a run sends the same sequence of messages given the same seed.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class TrafficPattern {
+protected:
+  std::string _kind;
+  std::size_t _size;
+  uint32_t _interval_us;
+  std::size_t _burst;
+  std::vector<Step> _trace;
+public:
+  TrafficPattern(
+    const Options& options)
+    : _kind(options.trace.empty() ? options.pattern : "trace"),
+      _size(std::max<std::size_t>(options.size, 2)),
+      _interval_us(static_cast<uint32_t>(1000000.0 / std::max(options.rate, 0.001))),
+      _burst(std::max<std::size_t>(options.burst, 1))
+  {
+    if (options.trace.empty()) {
+      return;
+    }
+
+    std::ifstream file(options.trace);
+    std::string line;
+
+    while (std::getline(file, line)) {
+      std::istringstream fields(line);
+      Step step;
+      if (line.empty() || line[0] == '#' || !(fields >> step.delay_us >> step.nbytes) || !step.nbytes) {
+        continue;
+      }
+      _trace.push_back(step);
+    }
+  }
+
+  const std::string& kind() const {
+    return _kind;
+  }
+
+  bool is_valid() const {
+    if (_kind == "trace") {
+      return std::any_of(_trace.begin(), _trace.end(), [](const Step& step) { return step.delay_us > 0; });
+    }
+
+    return _kind == "framed" || _kind == "delimited" || _kind == "bursty";
+  }
+
+  bool is_delimited() const {
+    return _kind == "delimited";
+  }
+
+  /**
+   * Returns the largest message the pattern sends.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  std::size_t max_nbytes() const
+  {
+    if (_kind == "trace") {
+      uint32_t nbytes = 0;
+      for (const Step& step : _trace) {
+        nbytes = std::max(nbytes, step.nbytes);
+      }
+      return nbytes;
+    }
+
+    return _kind == "delimited" ? _size * 3 / 2 : _size;
+  }
+
+  /**
+   * Returns the message following the passed position, advancing it.
+   *
+   * @param position The connection's position within the pattern.
+   * @param random The connection's generator.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  Step next(
+    uint64_t& position,
+    std::mt19937_64& random) const
+  {
+    uint64_t index = position++;
+
+    if (_kind == "trace") {
+      return _trace[index % _trace.size()];
+    }
+
+    if (_kind == "delimited") {
+      return Step { _interval_us, static_cast<uint32_t>(_size / 2 + random() % (_size + 1)) };
+    }
+
+    if (_kind == "bursty") {
+      return Step { index % _burst ? 0 : static_cast<uint32_t>(_interval_us * _burst), static_cast<uint32_t>(_size) };
+    }
+
+    return Step { _interval_us, static_cast<uint32_t>(_size) };
+  }
+
+  /**
+   * Returns a random position and delay to start a connection at, so
+   * connections do not all send in lockstep.
+   *
+   * @param random The connection's generator.
+   * @param position Set to the starting position.
+   *
+   * @author Tyler O'Brien <contact@tylerobrien.com>
+   * */
+  uint32_t start(
+    std::mt19937_64& random,
+    uint64_t& position) const
+  {
+    position = _kind == "trace" ? random() % _trace.size() : 0;
+
+    uint32_t period = _kind == "bursty" ? static_cast<uint32_t>(_interval_us * _burst) : _interval_us;
+
+    return static_cast<uint32_t>(random() % (static_cast<uint64_t>(period) + 1));
+  }
+};
+
+/**
+ * Process wide figures read from the kernel.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+struct Usage {
+  std::size_t rss_nbytes;
+  double cpu_seconds;
+
+  static Usage now()
+  {
+    Usage usage { 0, 0 };
+
+    std::ifstream statm("/proc/self/statm");
+    std::size_t npages_total = 0;
+    std::size_t npages_resident = 0;
+
+    if (statm >> npages_total >> npages_resident) {
+      usage.rss_nbytes = npages_resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    struct rusage self;
+
+    if (!getrusage(RUSAGE_SELF, &self)) {
+      usage.cpu_seconds =
+        self.ru_utime.tv_sec + self.ru_utime.tv_usec / 1e6 +
+        self.ru_stime.tv_sec + self.ru_stime.tv_usec / 1e6;
+    }
+
+    return usage;
+  }
+};
+
+/**
+ * Raises the open file limit to the hard limit, and returns it.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+inline rlim_t raise_descriptor_limit()
+{
+  struct rlimit limit;
+
+  if (getrlimit(RLIMIT_NOFILE, &limit)) {
+    return 0;
+  }
+
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  getrlimit(RLIMIT_NOFILE, &limit);
+
+  return limit.rlim_cur;
+}
+
+/**
+ * Prints the memory figures shared by both modes: resident size, the
+ * resident size per connection, and how many connections fit in a GB
+ * at that rate.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+inline void print_memory(
+  const Usage& usage,
+  const Usage& baseline,
+  std::size_t nconnections)
+{
+  double nbytes = usage.rss_nbytes > baseline.rss_nbytes ? double(usage.rss_nbytes - baseline.rss_nbytes) : 0;
+
+  std::printf(" rss=%.1fMB", usage.rss_nbytes / 1048576.0);
+
+  if (nconnections && nbytes > 0) {
+    std::printf(" bytes/conn=%.0f conns/GB=%.0f", nbytes / nconnections, 1073741824.0 * nconnections / nbytes);
+  }
+}
+
+/**
+ * Echo server for the generator to load. Frames reads the way the
+ * pattern is sent: fixed size reads for framed traffic, line reads for
+ * delimited traffic, and whatever has arrived otherwise.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class EchoServer {
+protected:
+  const Options& _options;
+  TrafficPattern _pattern;
+  es::TCPServer _server;
+  boost::asio::steady_timer _report_timer;
+  boost::asio::signal_set _signals;
+  Usage _baseline;
+  Clock::time_point _began;
+  bool _is_running;
+  std::size_t _nconnections;
+  uint64_t _nevents;
+  uint64_t _nreads;
+  uint64_t _nbytes;
+  uint64_t _nevents_total;
+  uint64_t _nreads_total;
+
+  void _report()
+  {
+    Usage usage = Usage::now();
+    double seconds = std::chrono::duration<double>(_options.interval).count();
+
+    std::printf(
+      "t=%.0fs conns=%zu events/s=%.0f reads/s=%.0f MB/s=%.1f",
+      std::chrono::duration<double>(Clock::now() - _began).count(),
+      _nconnections, _nevents / seconds, _nreads / seconds, _nbytes / seconds / 1048576.0
+    );
+    print_memory(usage, _baseline, _nconnections);
+    std::printf(" events/cpu-s=%.0f\n", usage.cpu_seconds > _baseline.cpu_seconds ? _nevents_total / (usage.cpu_seconds - _baseline.cpu_seconds) : 0.0);
+    std::fflush(stdout);
+
+    _nevents = 0;
+    _nreads = 0;
+    _nbytes = 0;
+  }
+
+  void _begin_report()
+  {
+    _report_timer.expires_after(_options.interval);
+    _report_timer.async_wait([this](boost::system::error_code error) {
+      if (!error && _is_running) {
+        _report();
+        _begin_report();
+      }
+    });
+  }
+
+  void _handle(
+    const es::EventP& event)
+  {
+    _nevents++;
+    _nevents_total++;
+
+    switch (event->type) {
+    case es::ACCEPT_HANDLE:
+      _nconnections++;
+      break;
+    case es::CLOSE_HANDLE:
+      _nconnections--;
+      break;
+    case es::READ_HANDLE: {
+      es::ReadEventP r_event = std::static_pointer_cast<es::ReadEvent>(event);
+      _nreads++;
+      _nreads_total++;
+      _nbytes += r_event->buffer->size();
+      if (r_event->buffer->size()) {
+        _server.sendb(event->connection, r_event->buffer);
+      }
+      break;
+    }
+    }
+  }
+public:
+  EchoServer(
+    const Options& options)
+    : _options(options),
+      _pattern(options),
+      _server(options.host, options.port, options.engine, options.socket_options),
+      _report_timer(_server.executor()),
+      _signals(_server.executor(), SIGINT, SIGTERM),
+      _baseline(Usage::now()),
+      _is_running(true),
+      _nconnections(0),
+      _nevents(0),
+      _nreads(0),
+      _nbytes(0),
+      _nevents_total(0),
+      _nreads_total(0)
+  {
+    if (_pattern.kind() == "framed") {
+      _server.set_read_mode(es::READ_SOME);
+      _server.set_read_buffer_nbytes(_pattern.max_nbytes());
+    } else if (_pattern.is_delimited()) {
+      _server.set_read_mode(es::READ_UNTIL);
+      _server.set_read_delimeter("\n");
+    } else {
+      _server.set_read_mode(es::READ_AVAILABLE);
+      _server.set_read_buffer_nbytes(16 * 1024);
+    }
+
+    // Under load update() keeps running ready handlers, so events are
+    // taken as they are queued rather than left waiting for poll().
+    _server.set_event_handler([this](es::EventP event) {
+      _handle(event);
+    });
+  }
+
+  int run()
+  {
+    _signals.async_wait([this](boost::system::error_code error, int) {
+      if (!error) {
+        _is_running = false;
+        _report_timer.cancel();
+      }
+    });
+
+    _began = Clock::now();
+    _server.start();
+    _begin_report();
+
+    while (_is_running) {
+      _server.update();
+    }
+
+    _server.stop(std::chrono::milliseconds(100));
+
+    while (!_server.is_stopped()) {
+      _server.update();
+    }
+
+    Usage usage = Usage::now();
+
+    std::printf("total reads=%" PRIu64 " events=%" PRIu64 " conns=%zu", _nreads_total, _nevents_total, _nconnections);
+    print_memory(usage, _baseline, _nconnections);
+    std::printf(" cpu=%.2fs\n", usage.cpu_seconds - _baseline.cpu_seconds);
+
+    return 0;
+  }
+};
+
+/**
+ * Drives the load: opens connections at the connect rate, sends every
+ * connection's pattern from a timer, and times each message from the
+ * moment it is queued until its last byte comes back. Bytes echo back
+ * in order, so each connection only has to remember when and how much
+ * it sent, oldest first.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+class LoadGenerator {
+protected:
+  struct _Sent {
+    Clock::time_point when;
+    uint32_t nbytes;
+  };
+
+  struct _Peer {
+    es::ConnectionHandle handle;
+    uint64_t position;
+    Step step;
+    std::mt19937_64 random;
+    std::vector<_Sent> sent;
+    std::size_t head;
+    uint32_t head_received;
+  };
+
+  struct _Due {
+    Clock::time_point when;
+    es::ConnectionHandle handle;
+
+    bool operator > (const _Due& other) const {
+      return when > other.when;
+    }
+  };
+
+  const Options& _options;
+  TrafficPattern _pattern;
+  es::TCPClient _client;
+  boost::asio::steady_timer _tick_timer;
+  boost::asio::steady_timer _report_timer;
+  boost::asio::signal_set _signals;
+  std::vector<_Peer> _peers;
+  std::priority_queue<_Due, std::vector<_Due>, std::greater<_Due>> _due;
+  std::string _payload;
+  std::map<std::string, std::size_t> _errors;
+  std::map<uint64_t, std::size_t> _connect_index_of;
+  LatencyHistogram _interval_latency;
+  LatencyHistogram _total_latency;
+  Usage _baseline;
+  Clock::time_point _began;
+  Clock::time_point _ends;
+  double _nconnects_owed;
+  bool _is_running;
+  std::size_t _nconnects_begun;
+  std::size_t _nconnections;
+  std::size_t _nfailed;
+  std::size_t _nclosed;
+  uint64_t _nsent;
+  uint64_t _nheld;
+  uint64_t _nbytes_sent;
+  uint64_t _nbytes_received;
+  uint64_t _nevents;
+  uint64_t _nsent_total;
+  uint64_t _nbytes_total;
+  uint64_t _nevents_total;
+
+  _Peer* _find(
+    es::ConnectionHandle handle)
+  {
+    uint32_t slot = es::slot_of(handle);
+
+    if (slot >= _peers.size() || _peers[slot].handle != handle) {
+      return nullptr;
+    }
+
+    return &_peers[slot];
+  }
+
+  std::string _target_of(
+    std::size_t index) const
+  {
+    if (_options.targets <= 1) {
+      return _options.host;
+    }
+
+    return "127.0.0." + std::to_string(1 + index % _options.targets);
+  }
+
+  void _open_connections()
+  {
+    _nconnects_owed += _options.connect_rate * std::chrono::duration<double>(_options.tick).count();
+
+    while (_nconnects_owed >= 1 && _nconnects_begun < _options.connections) {
+      uint64_t event_id = _client.connect(_target_of(_nconnects_begun), _options.port, _options.connect_timeout);
+
+      _connect_index_of[event_id] = _nconnects_begun;
+      _nconnects_begun++;
+      _nconnects_owed -= 1;
+    }
+
+    if (_nconnects_begun == _options.connections) {
+      _nconnects_owed = 0;
+    }
+  }
+
+  void _send(
+    _Peer& peer,
+    uint32_t nbytes,
+    Clock::time_point now)
+  {
+    if (peer.sent.size() - peer.head >= _options.window) {
+      _nheld++;
+      return;
+    }
+
+    es::StreamBufferP buffer = std::make_shared<es::StreamBuffer>();
+
+    buffer->commit(boost::asio::buffer_copy(buffer->prepare(nbytes), boost::asio::buffer(_payload.data(), nbytes - 1)));
+    buffer->sputc(_pattern.is_delimited() ? '\n' : _payload[nbytes - 1]);
+
+    _client.sendb(peer.handle, std::move(buffer));
+
+    peer.sent.push_back(_Sent { now, nbytes });
+    _nsent++;
+    _nsent_total++;
+    _nbytes_sent += nbytes;
+  }
+
+  void _send_due()
+  {
+    Clock::time_point now = Clock::now();
+
+    while (!_due.empty() && _due.top().when <= now) {
+      _Due due = _due.top();
+      _Peer* peer = _find(due.handle);
+
+      _due.pop();
+
+      if (!peer) {
+        continue;
+      }
+
+      // Messages without a delay go out with the one before them, and a
+      // connection that fell behind resumes from now instead of sending
+      // everything it missed at once.
+      do {
+        _send(*peer, peer->step.nbytes, now);
+        peer->step = _pattern.next(peer->position, peer->random);
+      } while (!peer->step.delay_us);
+
+      _due.push(_Due { std::max(due.when + std::chrono::microseconds(peer->step.delay_us), now + std::chrono::microseconds(1)), due.handle });
+    }
+  }
+
+  void _begin_tick()
+  {
+    _tick_timer.expires_after(_options.tick);
+    _tick_timer.async_wait([this](boost::system::error_code error) {
+      if (error || !_is_running) {
+        return;
+      }
+      if (Clock::now() >= _ends) {
+        _is_running = false;
+        return;
+      }
+      _open_connections();
+      _send_due();
+      _begin_tick();
+    });
+  }
+
+  void _report()
+  {
+    Usage usage = Usage::now();
+    double seconds = std::chrono::duration<double>(_options.interval).count();
+
+    std::printf(
+      "t=%.0fs conns=%zu sent/s=%.0f recv/s=%" PRIu64 " MB/s=%.1f p50=%.1fus p90=%.1fus p99=%.1fus p999=%.1fus max=%.1fus",
+      std::chrono::duration<double>(Clock::now() - _began).count(),
+      _nconnections, _nsent / seconds, static_cast<uint64_t>(_interval_latency.total() / seconds),
+      (_nbytes_sent + _nbytes_received) / seconds / 1048576.0,
+      _interval_latency.percentile(0.50) / 1e3, _interval_latency.percentile(0.90) / 1e3,
+      _interval_latency.percentile(0.99) / 1e3, _interval_latency.percentile(0.999) / 1e3,
+      _interval_latency.max() / 1e3
+    );
+
+    if (_nheld) {
+      std::printf(" held=%" PRIu64, _nheld);
+    }
+
+    print_memory(usage, _baseline, _nconnections);
+    std::printf("\n");
+    std::fflush(stdout);
+
+    _total_latency.merge(_interval_latency);
+    _interval_latency.clear();
+    _nsent = 0;
+    _nheld = 0;
+    _nbytes_total += _nbytes_sent + _nbytes_received;
+    _nbytes_sent = 0;
+    _nbytes_received = 0;
+  }
+
+  void _begin_report()
+  {
+    _report_timer.expires_after(_options.interval);
+    _report_timer.async_wait([this](boost::system::error_code error) {
+      if (!error && _is_running) {
+        _report();
+        _begin_report();
+      }
+    });
+  }
+
+  void _handle_connect(
+    const es::EventP& event)
+  {
+    // Seeding from the order connect() was called in, rather than the
+    // order connections complete in, keeps runs with the same seed alike.
+    auto it = _connect_index_of.find(event->uid);
+    std::size_t index = it == _connect_index_of.end() ? 0 : it->second;
+
+    if (it != _connect_index_of.end()) {
+      _connect_index_of.erase(it);
+    }
+
+    if (event->error) {
+      _nfailed++;
+      _errors[event->error.code.message()]++;
+      return;
+    }
+
+    uint32_t slot = es::slot_of(event->connection);
+
+    if (slot >= _peers.size()) {
+      _peers.resize(slot + 1);
+    }
+
+    _Peer& peer = _peers[slot];
+
+    peer.handle = event->connection;
+    peer.random.seed(_options.seed * 0x9E3779B97F4A7C15ull + index);
+    peer.sent.clear();
+    peer.head = 0;
+    peer.head_received = 0;
+
+    uint32_t delay_us = _pattern.start(peer.random, peer.position);
+
+    peer.step = _pattern.next(peer.position, peer.random);
+
+    _due.push(_Due { Clock::now() + std::chrono::microseconds(delay_us), peer.handle });
+    _nconnections++;
+  }
+
+  void _handle_read(
+    const es::EventP& event)
+  {
+    _Peer* peer = _find(event->connection);
+    std::size_t nbytes = std::static_pointer_cast<es::ReadEvent>(event)->buffer->size();
+
+    _nbytes_received += nbytes;
+
+    if (!peer) {
+      return;
+    }
+
+    Clock::time_point now = Clock::now();
+
+    while (nbytes && peer->head < peer->sent.size()) {
+      _Sent& sent = peer->sent[peer->head];
+      uint32_t ntaken = static_cast<uint32_t>(std::min<std::size_t>(nbytes, sent.nbytes - peer->head_received));
+
+      nbytes -= ntaken;
+      peer->head_received += ntaken;
+
+      if (peer->head_received == sent.nbytes) {
+        _interval_latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - sent.when).count());
+        peer->head++;
+        peer->head_received = 0;
+      }
+    }
+
+    if (peer->head == peer->sent.size()) {
+      peer->sent.clear();
+      peer->head = 0;
+    }
+  }
+
+  void _handle(
+    const es::EventP& event)
+  {
+    _nevents++;
+    _nevents_total++;
+
+    switch (event->type) {
+    case es::CONNECT_HANDLE:
+      _handle_connect(event);
+      break;
+    case es::READ_HANDLE:
+      _handle_read(event);
+      break;
+    case es::CLOSE_HANDLE:
+      if (_Peer* peer = _find(event->connection)) {
+        peer->handle = es::NULL_HANDLE;
+        _nconnections--;
+        _nclosed++;
+      }
+      break;
+    case es::ERROR_HANDLE:
+      _errors[event->error.code.message()]++;
+      break;
+    }
+  }
+public:
+  LoadGenerator(
+    const Options& options)
+    : _options(options),
+      _pattern(options),
+      _tick_timer(_client.executor()),
+      _report_timer(_client.executor()),
+      _signals(_client.executor(), SIGINT, SIGTERM),
+      _payload(std::max<std::size_t>(_pattern.max_nbytes(), 1), 'x'),
+      _baseline(Usage::now()),
+      _nconnects_owed(0),
+      _is_running(true),
+      _nconnects_begun(0),
+      _nconnections(0),
+      _nfailed(0),
+      _nclosed(0),
+      _nsent(0),
+      _nheld(0),
+      _nbytes_sent(0),
+      _nbytes_received(0),
+      _nevents(0),
+      _nsent_total(0),
+      _nbytes_total(0),
+      _nevents_total(0)
+  {
+    std::mt19937_64 random(options.seed);
+
+    for (char& c : _payload) {
+      c = static_cast<char>('a' + random() % 26);
+    }
+
+    _client.set_socket_options(options.socket_options);
+    _client.set_read_mode(es::READ_AVAILABLE);
+    _client.set_read_buffer_nbytes(16 * 1024);
+    _client.set_event_handler([this](es::EventP event) {
+      _handle(event);
+    });
+  }
+
+  bool is_valid() const {
+    return _pattern.is_valid();
+  }
+
+  int run()
+  {
+    _signals.async_wait([this](boost::system::error_code error, int) {
+      if (!error) {
+        _is_running = false;
+      }
+    });
+
+    _began = Clock::now();
+    _ends = _began + _options.duration;
+    _begin_tick();
+    _begin_report();
+
+    while (_is_running) {
+      _client.update();
+    }
+
+    _tick_timer.cancel();
+    _report_timer.cancel();
+    _signals.cancel();
+
+    double seconds = std::chrono::duration<double>(Clock::now() - _began).count();
+    Usage usage = Usage::now();
+
+    _total_latency.merge(_interval_latency);
+    _nbytes_total += _nbytes_sent + _nbytes_received;
+
+    std::printf(
+      "total conns=%zu failed=%zu closed=%zu sent=%" PRIu64 " received=%" PRIu64 " msgs/s=%.0f MB/s=%.1f p50=%.1fus p90=%.1fus p99=%.1fus p999=%.1fus max=%.1fus events/cpu-s=%.0f\n",
+      _nconnections, _nfailed, _nclosed, _nsent_total, _total_latency.total(), _total_latency.total() / seconds,
+      _nbytes_total / seconds / 1048576.0,
+      _total_latency.percentile(0.50) / 1e3, _total_latency.percentile(0.90) / 1e3,
+      _total_latency.percentile(0.99) / 1e3, _total_latency.percentile(0.999) / 1e3,
+      _total_latency.max() / 1e3,
+      usage.cpu_seconds > _baseline.cpu_seconds ? _nevents_total / (usage.cpu_seconds - _baseline.cpu_seconds) : 0.0
+    );
+
+    for (const auto& error : _errors) {
+      std::printf("error %zux %s\n", error.second, error.first.c_str());
+    }
+
+    return _nfailed ? 1 : 0;
+  }
+};
+
+/**
+ * Parses --name=value arguments into the passed options. Returns false
+ * on an unknown name or a missing mode.
+ *
+ * @author Tyler O'Brien <contact@tylerobrien.com>
+ * */
+inline bool parse(
+  int argc,
+  char** argv,
+  Options& options)
+{
+  if (argc < 2) {
+    return false;
+  }
+
+  options.mode = argv[1];
+
+  for (int i = 2; i < argc; i++) {
+    std::string arg(argv[i]);
+    std::size_t equals = arg.find('=');
+
+    if (arg.compare(0, 2, "--") || equals == std::string::npos) {
+      return false;
+    }
+
+    std::string name = arg.substr(2, equals - 2);
+    std::string value = arg.substr(equals + 1);
+
+    if (name == "host") options.host = value;
+    else if (name == "port") options.port = static_cast<uint16_t>(std::stoul(value));
+    else if (name == "connections") options.connections = std::stoul(value);
+    else if (name == "targets") options.targets = std::stoul(value);
+    else if (name == "connect-rate") options.connect_rate = std::stod(value);
+    else if (name == "connect-timeout-ms") options.connect_timeout = std::chrono::milliseconds(std::stoul(value));
+    else if (name == "pattern") options.pattern = value;
+    else if (name == "trace") options.trace = value;
+    else if (name == "size") options.size = std::stoul(value);
+    else if (name == "rate") options.rate = std::stod(value);
+    else if (name == "burst") options.burst = std::stoul(value);
+    else if (name == "window") options.window = std::stoul(value);
+    else if (name == "duration") options.duration = std::chrono::seconds(std::stoul(value));
+    else if (name == "interval-ms") options.interval = std::chrono::milliseconds(std::stoul(value));
+    else if (name == "tick-us") options.tick = std::chrono::microseconds(std::stoul(value));
+    else if (name == "seed") options.seed = std::stoull(value);
+    else if (name == "engine" && (value == "epoll" || value == "uring")) options.engine = value == "uring" ? es::ENGINE_IO_URING : es::ENGINE_EPOLL;
+    else if (name == "profile" && value == "default") options.socket_options = es::SocketOptions();
+    else if (name == "profile" && value == "low_latency") options.socket_options = es::SocketOptions::low_latency();
+    else if (name == "profile" && value == "high_throughput") options.socket_options = es::SocketOptions::high_throughput();
+    else return false;
+  }
+
+  if (options.targets == 0) {
+    options.targets = (options.connections + 24999) / 25000;
+  }
+
+  return options.mode == "serve" || options.mode == "run";
+}
+
+inline void usage()
+{
+  std::fprintf(stderr,
+    "usage: es-loadgen serve|run [--name=value ...]\n"
+    "\n"
+    "  --host=127.0.0.1         address to listen on (serve) or connect to (run)\n"
+    "  --port=5000\n"
+    "  --pattern=framed         framed, delimited or bursty\n"
+    "  --trace=FILE             replay \"<delay_us> <nbytes>\" lines instead of a pattern\n"
+    "  --size=64                message size in bytes\n"
+    "  --engine=epoll           epoll or uring\n"
+    "  --profile=default        default, low_latency or high_throughput\n"
+    "\n"
+    "run only:\n"
+    "  --connections=1000       up to 100000 on one box\n"
+    "  --targets=N              spread over 127.0.0.1..N for more source ports\n"
+    "                           (default one per 25000 connections; serve on 0.0.0.0)\n"
+    "  --connect-rate=20000     connections opened per second\n"
+    "  --connect-timeout-ms=5000\n"
+    "  --rate=10                messages per second per connection\n"
+    "  --burst=16               messages per burst for the bursty pattern\n"
+    "  --window=64              unanswered messages per connection before holding\n"
+    "  --duration=10            seconds\n"
+    "  --interval-ms=1000       report interval\n"
+    "  --tick-us=1000           send timer resolution\n"
+    "  --seed=1\n"
+  );
+}
+
+}
+
+int main(
+  int argc,
+  char** argv)
+{
+  loadgen::Options options;
+
+  if (!loadgen::parse(argc, argv, options)) {
+    loadgen::usage();
+    return 2;
+  }
+
+  rlim_t ndescriptors = loadgen::raise_descriptor_limit();
+
+  std::printf(
+    "es-loadgen %s pattern=%s size=%zu profile=%s engine=%s nofile=%llu",
+    options.mode.c_str(), options.trace.empty() ? options.pattern.c_str() : options.trace.c_str(), options.size,
+    options.socket_options.name.c_str(),
+    options.engine == es::ENGINE_IO_URING ? "uring" : "epoll",
+    static_cast<unsigned long long>(ndescriptors)
+  );
+
+  if (options.mode == "run") {
+    std::printf(" connections=%zu targets=%zu rate=%.1f/s seed=%" PRIu64, options.connections, options.targets, options.rate, options.seed);
+    if (ndescriptors < options.connections + 64) {
+      std::printf(" (descriptor limit too low for the connection count)");
+    }
+  }
+
+  std::printf("\n");
+  std::fflush(stdout);
+
+  if (options.mode == "serve") {
+    loadgen::EchoServer server(options);
+    return server.run();
+  }
+
+  loadgen::LoadGenerator generator(options);
+
+  if (!generator.is_valid()) {
+    loadgen::usage();
+    return 2;
+  }
+
+  return generator.run();
+}
\ No newline at end of file